@@ -0,0 +1,215 @@
+#include "affinity.hpp"
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#ifdef __linux__
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+/**
+ * @brief parseCpuList Parses a Linux cpulist string such as "0-3,8-11"
+ * @param list The string to parse
+ * @return The cpus in the list
+ */
+static std::vector<int> parseCpuList(const std::string &list)
+{
+    std::vector<int> cpus;
+    std::stringstream stream(list);
+    std::string range;
+    while (std::getline(stream, range, ','))
+    {
+        int first, last;
+        char dash;
+        std::stringstream rangeStream(range);
+        if (!(rangeStream >> first))
+        {
+            continue;
+        }
+        if (!(rangeStream >> dash >> last))
+        {
+            last = first;
+        }
+        for (int cpu = first; cpu <= last; ++cpu)
+        {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+static std::vector<int> getCpusOfNumaNode(int node)
+{
+    std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+    std::string list;
+    std::getline(file, list);
+    return parseCpuList(list);
+}
+
+/**
+ * @brief getNumaNodeCount Counts the NUMA nodes of this machine.
+ * Machines without NUMA information are treated as a single node.
+ */
+int getNumaNodeCount()
+{
+    int nodes = 0;
+    while (std::ifstream("/sys/devices/system/node/node" + std::to_string(nodes) + "/cpulist"))
+    {
+        ++nodes;
+    }
+    return nodes > 0 ? nodes : 1;
+}
+
+/**
+ * @brief getThreadCpus Lists the cpus the calling thread may run on,
+ * which the process cpuset and any earlier pinning limit
+ * @return The cpus, or an empty list if they are unknown
+ */
+std::vector<int> getThreadCpus()
+{
+    std::vector<int> cpus;
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0)
+    {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+        {
+            if (CPU_ISSET(cpu, &set))
+            {
+                cpus.push_back(cpu);
+            }
+        }
+    }
+#endif
+    return cpus;
+}
+
+/**
+ * @brief setThreadCpus Lets the calling thread run on any of a list of
+ * cpus, such as one saved by getThreadCpus before pinning
+ * @return Whether the thread's cpus were changed
+ */
+bool setThreadCpus(const std::vector<int> &cpus)
+{
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (size_t k = 0; k < cpus.size(); ++k)
+    {
+        if (cpus[k] >= 0 && cpus[k] < CPU_SETSIZE)
+        {
+            CPU_SET(cpus[k], &set);
+        }
+    }
+    return CPU_COUNT(&set) > 0 && sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+    (void) cpus;
+    return false;
+#endif
+}
+
+/**
+ * @brief getCpusByNumaNode Lists the cpus the calling thread may run on
+ * so that all the cpus of one NUMA node come before the cpus of the
+ * next. Pinning consecutive threads to consecutive entries means a
+ * static schedule hands each node one contiguous block of the framebuffer.
+ * @param nodes If not null, receives the node of each cpu
+ * @return The ordered cpus, or an empty list if they are unknown
+ */
+std::vector<int> getCpusByNumaNode(std::vector<int> *nodes)
+{
+    std::vector<int> allowed = getThreadCpus();
+    std::vector<int> cpus, cpuNodes;
+    int nodeCount = getNumaNodeCount();
+    for (int node = 0; node < nodeCount; ++node)
+    {
+        std::vector<int> nodeCpus = getCpusOfNumaNode(node);
+        for (size_t k = 0; k < nodeCpus.size(); ++k)
+        {
+            if (std::find(allowed.begin(), allowed.end(), nodeCpus[k]) != allowed.end())
+            {
+                cpus.push_back(nodeCpus[k]);
+                cpuNodes.push_back(node);
+            }
+        }
+    }
+
+    //Without NUMA information every allowed cpu is on the one node
+    if (cpus.empty())
+    {
+        cpus = allowed;
+        cpuNodes.assign(cpus.size(), 0);
+    }
+    if (nodes)
+    {
+        *nodes = cpuNodes;
+    }
+    return cpus;
+}
+
+bool pinThreadToCpu(int cpu)
+{
+    return setThreadCpus(std::vector<int>(1, cpu));
+}
+
+/**
+ * The cpus render threads are pinned to, in the order of
+ * getCpusByNumaNode, and the NUMA node of each
+ */
+struct RenderCpus
+{
+    std::vector<int> cpus, nodes;
+
+    RenderCpus()
+    {
+        cpus = getCpusByNumaNode(&nodes);
+    }
+};
+
+/**
+ * @brief getRenderCpus Lists the cpus of render threads. They are chosen
+ * from those the first caller was allowed to use, so the caller must not
+ * already be pinned.
+ */
+static const RenderCpus & getRenderCpus()
+{
+    static const RenderCpus renderCpus;
+    return renderCpus;
+}
+
+/**
+ * @brief pinRenderThread Pins the calling render thread to a cpu so that
+ * threads are packed onto one NUMA node before spilling onto the next.
+ * The cpus are chosen from those the first caller was allowed to use,
+ * so the thread must not already be pinned when this is first called.
+ * @param threadIndex The index of the calling thread within its team
+ * @return Whether the thread was pinned
+ */
+bool pinRenderThread(int threadIndex)
+{
+    const std::vector<int> &cpus = getRenderCpus().cpus;
+    if (cpus.empty())
+    {
+        return false;
+    }
+    return pinThreadToCpu(cpus[threadIndex % cpus.size()]);
+}
+
+/**
+ * @brief getRenderThreadNode The NUMA node pinRenderThread pins a render
+ * thread to
+ * @param threadIndex The index of the thread within its team
+ * @return The node, which is 0 if the cpus are unknown
+ */
+int getRenderThreadNode(int threadIndex)
+{
+    const std::vector<int> &nodes = getRenderCpus().nodes;
+    if (nodes.empty())
+    {
+        return 0;
+    }
+    return nodes[threadIndex % nodes.size()];
+}
@@ -0,0 +1,14 @@
+#ifndef AFFINITY_HPP
+#define AFFINITY_HPP
+
+#include <vector>
+
+int getNumaNodeCount();
+std::vector<int> getThreadCpus();
+bool setThreadCpus(const std::vector<int> &cpus);
+std::vector<int> getCpusByNumaNode(std::vector<int> *nodes);
+bool pinThreadToCpu(int cpu);
+bool pinRenderThread(int threadIndex);
+int getRenderThreadNode(int threadIndex);
+
+#endif // AFFINITY_HPP
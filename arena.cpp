@@ -0,0 +1,69 @@
+#include "arena.hpp"
+#include <stdint.h>
+#include <new>
+
+//Blocks are large enough that a scene of small primitives needs few of
+//them, and larger allocations get a block of their own
+static const size_t BLOCK_SIZE = 64*1024;
+
+Arena::Arena()
+{
+    next = NULL;
+    end = NULL;
+    bytesAllocated = 0;
+}
+
+Arena::~Arena()
+{
+    release();
+}
+
+/**
+ * @brief allocate Returns uninitialised memory that lives until the
+ * arena is released
+ * @param size The number of bytes to allocate
+ * @param alignment The alignment of the memory, a power of two no
+ * larger than CACHE_LINE_SIZE
+ * @return The memory
+ */
+void * Arena::allocate(size_t size, size_t alignment)
+{
+    uintptr_t address = ((uintptr_t) next + alignment - 1) & ~(uintptr_t) (alignment - 1);
+    if (!next || address + size > (uintptr_t) end)
+    {
+        //Over-allocate so that the block can start on a cache line
+        size_t blockSize = size > BLOCK_SIZE ? size : BLOCK_SIZE;
+        void *block = ::operator new(blockSize + CACHE_LINE_SIZE);
+        blocks.push_back(block);
+
+        address = ((uintptr_t) block + CACHE_LINE_SIZE - 1) & ~(uintptr_t) (CACHE_LINE_SIZE - 1);
+        end = (char *) address + blockSize;
+        bytesAllocated += blockSize + CACHE_LINE_SIZE;
+    }
+    next = (char *) (address + size);
+    return (void *) address;
+}
+
+/**
+ * @brief release Frees every block of the arena. Anything allocated from
+ * it must no longer be used.
+ */
+void Arena::release()
+{
+    for (void *block : blocks)
+    {
+        ::operator delete(block);
+    }
+    blocks.clear();
+    next = NULL;
+    end = NULL;
+    bytesAllocated = 0;
+}
+
+/**
+ * @brief getBytesAllocated The memory held by the arena's blocks
+ */
+size_t Arena::getBytesAllocated() const
+{
+    return bytesAllocated;
+}
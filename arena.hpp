@@ -0,0 +1,36 @@
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+#include <stddef.h>
+#include <vector>
+
+/**
+ * Hands out memory from large cache line aligned blocks, so that objects
+ * allocated one after another are contiguous. Individual allocations
+ * cannot be freed; all of the memory is released at once when the arena
+ * is released or destroyed.
+ * @brief The Arena class
+ */
+class Arena
+{
+    public:
+        static const size_t CACHE_LINE_SIZE = 64;
+
+        Arena();
+        ~Arena();
+
+        void * allocate(size_t size, size_t alignment);
+        void release();
+        size_t getBytesAllocated() const;
+
+    private:
+        std::vector<void *> blocks;
+        char *next;
+        char *end;
+        size_t bytesAllocated;
+
+        Arena(const Arena &) = delete;
+        Arena & operator=(const Arena &) = delete;
+};
+
+#endif // ARENA_HPP
@@ -0,0 +1,427 @@
+//Measures the cost of the innermost kernels of the renderer: every
+//Surface::hitWithRay, including the rotated and translated instances and
+//a SphereCloud against the same spheres as separate objects, and every
+//Material::scatter, alone and mixed as the renderer shades them.
+//Intersections are timed against rays that mostly hit and rays that
+//mostly miss, since the two take different paths through each test.
+//Results are printed as JSON.
+//
+//Usage: microBench [--min-time seconds] [--isa level] [--output file]
+
+#include "compiledscene.hpp"
+#include "cpudispatch.hpp"
+#include "material.hpp"
+#include "scene.hpp"
+#include "spherecloud.hpp"
+#include "surface.hpp"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+static const int RAY_COUNT = 4096;
+static const int SAMPLE_COUNT = 5;
+
+//Every primitive is centred on this point, in front of the ray origins
+static const Vector3 TARGET = Vector3(0, 0, -3);
+
+struct Result
+{
+    string name;
+    string rays;
+    long long calls;
+    double nanosecondsPerCall;
+    double rate;
+};
+
+/**
+ * A small deterministic generator, so that every run measures the same rays
+ */
+class BenchRandom
+{
+    public:
+        BenchRandom(unsigned int seed) : state(seed) {}
+
+        float getFloat(float min, float max)
+        {
+            state = state * 1664525u + 1013904223u;
+            return min + (max - min) * ((state >> 8) * (1.0f / 16777216.0f));
+        }
+
+    private:
+        unsigned int state;
+};
+
+/**
+ * @brief makeHitRays Makes rays from near the origin towards the middle
+ * of the primitives, which nearly all hit them
+ */
+static vector<Ray> makeHitRays()
+{
+    BenchRandom random(1);
+    vector<Ray> rays;
+    for (int k = 0; k < RAY_COUNT; ++k)
+    {
+        float ox = random.getFloat(-0.1, 0.1);
+        float oy = random.getFloat(-0.1, 0.1);
+        float tx = random.getFloat(-0.5, 0.5);
+        float ty = random.getFloat(-0.5, 0.5);
+        Vector3 origin = Vector3(ox, oy, 0);
+        rays.push_back(Ray(origin, TARGET + Vector3(tx, ty, 0) - origin));
+    }
+    return rays;
+}
+
+/**
+ * @brief makeMissRays Makes rays in uniformly random directions, which
+ * nearly all miss every primitive except the infinite plane
+ */
+static vector<Ray> makeMissRays()
+{
+    BenchRandom random(2);
+    vector<Ray> rays;
+    while ((int) rays.size() < RAY_COUNT)
+    {
+        float x = random.getFloat(-1, 1);
+        float y = random.getFloat(-1, 1);
+        float z = random.getFloat(-1, 1);
+        Vector3 direction = Vector3(x, y, z);
+        if (direction.getLength() <= 1 && !direction.isZeroVector())
+        {
+            rays.push_back(Ray(Vector3(0, 0, 0), direction));
+        }
+    }
+    return rays;
+}
+
+/**
+ * @brief measure Times a kernel that makes callCount calls each time it
+ * runs. The kernel is repeated until it has run for at least minSeconds
+ * and the median of several such samples is reported.
+ * @param kernel Makes callCount calls and returns how many of them
+ * succeeded, e.g. hit the surface
+ * @return The result, with rate set to the fraction that succeeded
+ */
+template <typename Kernel>
+static Result measure(const string &name, const string &rays, long long callCount, Kernel kernel, double minSeconds)
+{
+    //Warm up and find how many repeats fill minSeconds
+    long long repeats = 1;
+    long long successes = 0;
+    while (true)
+    {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for (long long r = 0; r < repeats; ++r)
+        {
+            successes = kernel();
+        }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        if (seconds >= minSeconds / SAMPLE_COUNT)
+        {
+            break;
+        }
+        repeats *= 2;
+    }
+
+    vector<double> samples;
+    for (int s = 0; s < SAMPLE_COUNT; ++s)
+    {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for (long long r = 0; r < repeats; ++r)
+        {
+            successes = kernel();
+        }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        samples.push_back(seconds * 1e9 / (repeats * callCount));
+    }
+    sort(samples.begin(), samples.end());
+
+    Result result;
+    result.name = name;
+    result.rays = rays;
+    result.calls = repeats * callCount * SAMPLE_COUNT;
+    result.nanosecondsPerCall = samples[SAMPLE_COUNT / 2];
+    result.rate = successes / (double) callCount;
+    return result;
+}
+
+static void benchmarkSurface(const string &name, const Surface *surface, const vector<Ray> &hitRays,
+                             const vector<Ray> &missRays, double minSeconds, vector<Result> &results)
+{
+    const vector<Ray> *distributions[] = {&hitRays, &missRays};
+    const char *distributionNames[] = {"hit", "miss"};
+    for (int d = 0; d < 2; ++d)
+    {
+        const vector<Ray> &rays = *distributions[d];
+        results.push_back(measure(name + "::hitWithRay", distributionNames[d], rays.size(), [&] {
+            long long hits = 0;
+            HitRecord record;
+            for (const Ray &ray : rays)
+            {
+                hits += surface->hitWithRay(ray, 0.001, FLT_MAX, record);
+            }
+            return hits;
+        }, minSeconds));
+    }
+}
+
+//The closest hit among CLOUD_SIZE spheres packed around TARGET, found by
+//testing separate Sphere objects and by a single SphereCloud
+static const int CLOUD_SIZE = 64;
+
+static void benchmarkSphereCloud(Scene &scene, Material *material, const vector<Ray> &hitRays,
+                                 const vector<Ray> &missRays, double minSeconds, vector<Result> &results)
+{
+    vector<Surface *> spheres;
+    SphereCloud *cloud = scene.create<SphereCloud>();
+    Sampler placement(0, 0, 1);
+    for (int k = 0; k < CLOUD_SIZE; ++k)
+    {
+        float x = 2 * placement.getFloat() - 1;
+        float y = 2 * placement.getFloat() - 1;
+        float z = 2 * placement.getFloat() - 1;
+        Vector3 centre = TARGET + Vector3(x, y, z);
+        spheres.push_back(scene.create<Sphere>(centre, 0.2, material));
+        cloud->addSphere(centre, 0.2, material);
+    }
+
+    const string suffix = "(" + to_string(CLOUD_SIZE) + ")";
+    const vector<Ray> *distributions[] = {&hitRays, &missRays};
+    const char *distributionNames[] = {"hit", "miss"};
+    for (int d = 0; d < 2; ++d)
+    {
+        const vector<Ray> &rays = *distributions[d];
+        results.push_back(measure("Sphere" + suffix + "::hitWithRay", distributionNames[d], rays.size(), [&] {
+            long long hits = 0;
+            HitRecord record;
+            for (const Ray &ray : rays)
+            {
+                bool hit = false;
+                float closest = FLT_MAX;
+                for (const Surface *sphere : spheres)
+                {
+                    if (sphere->hitWithRay(ray, 0.001, closest, record))
+                    {
+                        hit = true;
+                        closest = record.t;
+                    }
+                }
+                hits += hit;
+            }
+            return hits;
+        }, minSeconds));
+        results.push_back(measure("SphereCloud" + suffix + "::hitWithRay", distributionNames[d], rays.size(), [&] {
+            long long hits = 0;
+            HitRecord record;
+            for (const Ray &ray : rays)
+            {
+                hits += cloud->hitWithRay(ray, 0.001, FLT_MAX, record);
+            }
+            return hits;
+        }, minSeconds));
+    }
+}
+
+static void benchmarkMaterial(const string &name, const Material *material, const vector<Ray> &hitRays,
+                              const vector<HitRecord> &records, double minSeconds, vector<Result> &results)
+{
+    results.push_back(measure(name + "::scatter", "hit", records.size(), [&] {
+        long long scattered = 0;
+        Vector3 attenuation;
+        Ray scatteredRay;
+        Sampler sampler;
+        for (size_t k = 0; k < records.size(); ++k)
+        {
+            scattered += material->scatter(hitRays[k], records[k], attenuation, scatteredRay, sampler);
+        }
+        return scattered;
+    }, minSeconds));
+}
+
+//Scatters each hit off a different material, picked in an irregular order
+//as a mixed-material scene would, through the virtual Material::scatter
+//and through the flattened material table the renderer shades with
+static void benchmarkMixedMaterials(const vector<Material *> &materials, const vector<Ray> &hitRays,
+                                    const vector<HitRecord> &records, double minSeconds, vector<Result> &results)
+{
+    vector<FlatMaterial> flatMaterials(materials.size());
+    for (size_t m = 0; m < materials.size(); ++m)
+    {
+        materials[m]->flatten(flatMaterials[m]);
+    }
+
+    vector<uint32_t> materialIndices(records.size());
+    Sampler order(0, 0, 0);
+    for (size_t k = 0; k < records.size(); ++k)
+    {
+        materialIndices[k] = (uint32_t) (order.getFloat() * materials.size()) % materials.size();
+    }
+
+    results.push_back(measure("Mixed::scatter", "hit", records.size(), [&] {
+        long long scattered = 0;
+        Vector3 attenuation;
+        Ray scatteredRay;
+        Sampler sampler;
+        for (size_t k = 0; k < records.size(); ++k)
+        {
+            const Material *material = materials[materialIndices[k]];
+            attenuation = material->emitted();
+            scattered += material->scatter(hitRays[k], records[k], attenuation, scatteredRay, sampler);
+        }
+        return scattered;
+    }, minSeconds));
+
+    results.push_back(measure("Mixed::scatterFlatMaterial", "hit", records.size(), [&] {
+        long long scattered = 0;
+        Vector3 attenuation;
+        Ray scatteredRay;
+        Sampler sampler;
+        for (size_t k = 0; k < records.size(); ++k)
+        {
+            const FlatMaterial &material = flatMaterials[materialIndices[k]];
+            attenuation = getFlatEmitted(material);
+            scattered += scatterFlatMaterial(material, hitRays[k], records[k], attenuation, scatteredRay, sampler);
+        }
+        return scattered;
+    }, minSeconds));
+}
+
+static void writeJson(ostream &out, const vector<Result> &results, double minSeconds)
+{
+    out << "{\n";
+    out << "  \"benchmark\": \"microBench\",\n";
+#ifdef __VERSION__
+    out << "  \"compiler\": \"" << __VERSION__ << "\",\n";
+#endif
+    out << "  \"isa\": \"" << getCpuLevelName(getCpuLevel()) << "\",\n";
+    out << "  \"rays_per_repeat\": " << RAY_COUNT << ",\n";
+    out << "  \"min_time_s\": " << minSeconds << ",\n";
+    out << "  \"results\": [\n";
+    for (size_t k = 0; k < results.size(); ++k)
+    {
+        const Result &result = results[k];
+        out << "    {\"name\": \"" << result.name << "\", \"rays\": \"" << result.rays
+            << "\", \"calls\": " << result.calls
+            << ", \"ns_per_call\": " << result.nanosecondsPerCall
+            << ", \"mcalls_per_s\": " << 1e3 / result.nanosecondsPerCall
+            << ", \"success_rate\": " << result.rate << "}"
+            << (k + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n";
+    out << "}\n";
+}
+
+int main(int argc, char **argv)
+{
+    double minSeconds = 0.5;
+    string outputFile;
+    for (int k = 1; k < argc; ++k)
+    {
+        if (strcmp(argv[k], "--min-time") == 0 && k + 1 < argc)
+        {
+            minSeconds = atof(argv[++k]);
+        }
+        else if (strcmp(argv[k], "--isa") == 0 && k + 1 < argc)
+        {
+            CpuLevel limit;
+            if (!parseCpuLevel(argv[++k], limit))
+            {
+                cerr << "Unknown instruction set level " << argv[k] << endl;
+                return 1;
+            }
+            setCpuLevelLimit(limit);
+        }
+        else if (strcmp(argv[k], "--output") == 0 && k + 1 < argc)
+        {
+            outputFile = argv[++k];
+        }
+        else
+        {
+            cerr << "Usage: microBench [--min-time seconds] [--isa level] [--output file]" << endl;
+            return 1;
+        }
+    }
+
+    vector<Ray> hitRays = makeHitRays();
+    vector<Ray> missRays = makeMissRays();
+
+    //Owns the surfaces and materials that are benchmarked
+    Scene scene;
+    Material *diffuse = scene.create<Diffuse>(Vector3(0.5, 0.5, 0.5));
+    vector<Result> results;
+
+    //Each primitive faces the ray origins from around TARGET
+    benchmarkSurface("Plane", scene.create<Plane>(TARGET, Vector3(0, 0, 1), diffuse),
+                     hitRays, missRays, minSeconds, results);
+    benchmarkSurface("Sphere", scene.create<Sphere>(TARGET, 1, diffuse),
+                     hitRays, missRays, minSeconds, results);
+    benchmarkSurface("Rectangle", scene.create<Rectangle>(TARGET, Vector3(0, 0, 1), 1, 1, diffuse),
+                     hitRays, missRays, minSeconds, results);
+    benchmarkSurface("Triangle", scene.create<Triangle>(TARGET + Vector3(-1.5, -1, 0), TARGET + Vector3(1.5, -1, 0),
+                                              TARGET + Vector3(0, 1.5, 0), diffuse),
+                     hitRays, missRays, minSeconds, results);
+
+    benchmarkSphereCloud(scene, diffuse, hitRays, missRays, minSeconds, results);
+
+    //The instances wrap a sphere at the origin and are moved in front of
+    //the rays by an outer translation, which is timed on its own first
+    Surface *sphere = scene.create<Sphere>(Vector3(0, 0, 0), 1, diffuse);
+    benchmarkSurface("TranslatedSurface", sphere->translate(scene, TARGET),
+                     hitRays, missRays, minSeconds, results);
+    benchmarkSurface("XRotatedSurface+TranslatedSurface", sphere->rotateAroundX(scene, 30)->translate(scene, TARGET),
+                     hitRays, missRays, minSeconds, results);
+    benchmarkSurface("YRotatedSurface+TranslatedSurface", sphere->rotateAroundY(scene, 30)->translate(scene, TARGET),
+                     hitRays, missRays, minSeconds, results);
+    benchmarkSurface("ZRotatedSurface+TranslatedSurface", sphere->rotateAroundZ(scene, 30)->translate(scene, TARGET),
+                     hitRays, missRays, minSeconds, results);
+
+    //Scatter every hit ray off the front of a unit sphere at TARGET
+    Sphere target(TARGET, 1, diffuse);
+    vector<Ray> scatterRays;
+    vector<HitRecord> records;
+    for (const Ray &ray : hitRays)
+    {
+        HitRecord record;
+        if (target.hitWithRay(ray, 0.001, FLT_MAX, record))
+        {
+            scatterRays.push_back(ray);
+            records.push_back(record);
+        }
+    }
+
+    vector<Material *> materials;
+    materials.push_back(diffuse);
+    materials.push_back(scene.create<Metal>(Vector3(0.8, 0.8, 0.8), 0));
+    materials.push_back(scene.create<Metal>(Vector3(0.8, 0.8, 0.8), 0.3));
+    materials.push_back(scene.create<Dielectric>(1.5));
+    materials.push_back(scene.create<Light>(Vector3(1, 1, 1)));
+    const char *materialNames[] = {"Diffuse", "Metal", "Metal(fuzz)", "Dielectric", "Light"};
+    for (size_t m = 0; m < materials.size(); ++m)
+    {
+        benchmarkMaterial(materialNames[m], materials[m], scatterRays, records, minSeconds, results);
+    }
+    benchmarkMixedMaterials(materials, scatterRays, records, minSeconds, results);
+
+    if (outputFile.empty())
+    {
+        writeJson(cout, results, minSeconds);
+    }
+    else
+    {
+        ofstream out(outputFile.c_str());
+        writeJson(out, results, minSeconds);
+        if (!out)
+        {
+            cerr << "Could not write " << outputFile << endl;
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,110 @@
+//Compares the encode throughput of the parallel PNG writer against
+//stbi_write_png on a synthetic image that compresses like a render:
+//smooth gradients with some per-pixel noise.
+//
+//Usage: pngBench [width] [height] [repeats]
+
+#include "pngwriter.hpp"
+#include "stb_image_write.h"
+#include <chrono>
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace std;
+
+static vector<unsigned char> makeImage(int width, int height)
+{
+    vector<unsigned char> pixels(width * (size_t) height * 4);
+    unsigned int seed = 12345;
+    for (int j = 0; j < height; ++j)
+    {
+        for (int i = 0; i < width; ++i)
+        {
+            seed = seed * 1664525u + 1013904223u;
+            int noise = (seed >> 24) & 7;
+            unsigned char *p = &pixels[(j * (size_t) width + i) * 4];
+            p[0] = (unsigned char) (255 * i / width + noise);
+            p[1] = (unsigned char) (255 * j / height + noise);
+            p[2] = (unsigned char) (128 + noise);
+            p[3] = 255;
+        }
+    }
+    return pixels;
+}
+
+static long getFileSize(const char *filename)
+{
+    FILE *file = fopen(filename, "rb");
+    if (!file)
+    {
+        return -1;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fclose(file);
+    return size;
+}
+
+template <typename Encoder>
+static double timeEncoder(Encoder encode, int repeats)
+{
+    double best = 0;
+    for (int r = 0; r < repeats; ++r)
+    {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        if (!encode())
+        {
+            cerr << "Encoding failed" << endl;
+            exit(1);
+        }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        if (r == 0 || seconds < best)
+        {
+            best = seconds;
+        }
+    }
+    return best;
+}
+
+int main(int argc, char **argv)
+{
+    int width = argc > 1 ? atoi(argv[1]) : 7680;
+    int height = argc > 2 ? atoi(argv[2]) : 4320;
+    int repeats = argc > 3 ? atoi(argv[3]) : 3;
+
+    vector<unsigned char> pixels = makeImage(width, height);
+    double megabytes = pixels.size() / (1024.0*1024.0);
+
+    int threads = 1;
+#ifdef _OPENMP
+    threads = omp_get_max_threads();
+#endif
+
+    const char *stbFile = "pngbench_stb.png";
+    const char *parallelFile = "pngbench_parallel.png";
+
+    double stbSeconds = timeEncoder([&] {
+        return stbi_write_png(stbFile, width, height, 4, pixels.data(), width * 4) != 0;
+    }, repeats);
+    double parallelSeconds = timeEncoder([&] {
+        return writePng(parallelFile, width, height, 4, pixels.data(), width * 4);
+    }, repeats);
+
+    cout << "Image: " << width << "x" << height << " RGBA (" << megabytes << " MB), "
+         << threads << " thread(s), best of " << repeats << endl;
+    cout << "stb:      " << stbSeconds << " s, " << megabytes / stbSeconds << " MB/s, "
+         << getFileSize(stbFile) << " bytes" << endl;
+    cout << "parallel: " << parallelSeconds << " s, " << megabytes / parallelSeconds << " MB/s, "
+         << getFileSize(parallelFile) << " bytes" << endl;
+    cout << "speedup:  " << stbSeconds / parallelSeconds << "x" << endl;
+
+    remove(stbFile);
+    remove(parallelFile);
+    return 0;
+}
@@ -0,0 +1,431 @@
+//Renders a set of reference scenes for a fixed amount of time each and
+//compares the results against converged reference images, so that a
+//change which makes rendering faster but noisier or biased is caught.
+//Each scene reports RMSE, relMSE and SSIM against its reference, and an
+//efficiency of 1 / (relMSE * render seconds), which is independent of
+//the time budget for an unbiased renderer. Results are printed as JSON.
+//
+//The references are rendered once, at a high sample count, with
+//--make-references. A later run given --baseline fails if the efficiency
+//of any scene has dropped by more than the tolerance. Efficiency depends
+//on the machine, so baselines should come from the same machine.
+//
+//Usage: qualityBench --references dir [--make-references] [--time seconds]
+//                    [--reference-spp N] [--baseline file] [--tolerance fraction]
+//                    [--output file]
+
+#include "camera.hpp"
+#include "hdrimage.hpp"
+#include "renderscene.hpp"
+#include "sceneparser.hpp"
+#include "scenegenerator.hpp"
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+static const int WIDTH = 96;
+static const int HEIGHT = 54;
+
+//The samples per pixel rendered between checks of the time budget
+static const int PASS_SAMPLES = 4;
+
+//SSIM is computed over windows of this size, spaced half a window apart
+static const int SSIM_WINDOW = 8;
+
+//The same box as scenes/box.scene, kept here so that the harness does
+//not depend on the directory it is run from
+static const char *BOX_SCENE =
+        "camera position 0 0 0 lookat 0 0 -1 fov 90\n"
+        "background 1 1 1\n"
+        "material ceiling diffuse 0.2 0.2 0.2\n"
+        "material red diffuse 1 0.3 0.3\n"
+        "material green diffuse 0.3 1 0.3\n"
+        "material blue diffuse 0.3 0.3 1\n"
+        "material floor diffuse 0.7 0.7 0.7\n"
+        "material lamp light 1 0.8 0\n"
+        "plane 0 1.5 0  0 1 0  ceiling\n"
+        "plane -2 0 0  1 0 0  red\n"
+        "plane 0 0 -2  0 0 1  green\n"
+        "plane 2 0 0  1 0 0  blue\n"
+        "plane 0 -1.5 0  0 1 0  floor\n"
+        "triangle -2 0 -1.999  2 0 -1.999  2 2 -1.999  lamp\n";
+
+struct ReferenceScene
+{
+    const char *name;
+
+    //The kind of generated scene, or NULL for BOX_SCENE
+    const char *kind;
+    long long count;
+};
+
+//Diffuse interreflection, metal and glass, and many small lights
+static const ReferenceScene REFERENCE_SCENES[] = {
+    {"box", NULL, 0},
+    {"spheres-50", "spheres", 50},
+    {"lights-16", "lights", 16}
+};
+
+struct Quality
+{
+    int samplesPerPixel;
+    double renderSeconds;
+    double rmse, relMse, ssim;
+    double efficiency;
+};
+
+static double getSecondsSince(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+static bool buildScene(const ReferenceScene &reference, Scene &scene, CameraOptions &cameraOptions)
+{
+    if (!reference.kind)
+    {
+        string error;
+        return parseScene(BOX_SCENE, scene, cameraOptions, error);
+    }
+    return generateScene(reference.kind, reference.count, 1, scene, cameraOptions);
+}
+
+/**
+ * @brief render Renders a scene in passes of PASS_SAMPLES samples per
+ * pixel until either the time budget or the sample count is used up
+ * @param seconds The time budget, or 0 for no limit
+ * @param maxSamples The most samples per pixel to render, or 0 for no limit
+ * @param seed The seed of the samples. References use a different seed
+ * from the images compared against them, so their noise is independent.
+ * @param samplesPerPixel Receives the number of samples rendered
+ * @param renderSeconds Receives the time spent rendering
+ * @return The average of every pass, which the caller must delete
+ */
+static Framebuffer * render(const ReferenceScene &reference, double seconds, int maxSamples, unsigned int seed,
+                            int &samplesPerPixel, double &renderSeconds)
+{
+    Scene scene;
+    CameraOptions cameraOptions;
+    if (!buildScene(reference, scene, cameraOptions))
+    {
+        cerr << "Could not build scene " << reference.name << endl;
+        exit(1);
+    }
+    Camera camera(WIDTH, HEIGHT, cameraOptions);
+    RenderScene *renderScene = scene.compile();
+
+    RenderOptions options;
+    options.samplesPerPixel = PASS_SAMPLES;
+    options.seed = seed;
+
+    Framebuffer *sum = new Framebuffer(WIDTH, HEIGHT);
+    Vector3 *colour = sum->getColour();
+    for (int k = 0; k < WIDTH * HEIGHT; ++k)
+    {
+        colour[k] = Vector3();
+    }
+
+    samplesPerPixel = 0;
+    renderSeconds = 0;
+    while ((seconds <= 0 || renderSeconds < seconds) && (maxSamples <= 0 || samplesPerPixel < maxSamples))
+    {
+        //Every pass renders new samples of the same sequence
+        options.firstSample = samplesPerPixel;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        Framebuffer *pass = camera.captureScene(*renderScene, options);
+        renderSeconds += getSecondsSince(start);
+
+        const Vector3 *passColour = pass->getColour();
+        for (int k = 0; k < WIDTH * HEIGHT; ++k)
+        {
+            colour[k] += passColour[k];
+        }
+        samplesPerPixel += PASS_SAMPLES;
+        delete pass;
+    }
+    delete renderScene;
+
+    //Each pass is already an average of PASS_SAMPLES samples
+    float passes = float(samplesPerPixel / PASS_SAMPLES);
+    for (int k = 0; k < WIDTH * HEIGHT; ++k)
+    {
+        colour[k] /= passes;
+    }
+    return sum;
+}
+
+//The display luminance of a pixel, in [0, 1], tonemapped as for a PNG
+static float getDisplayLuminance(const Vector3 &colour)
+{
+    float luminance = 0.2126*colour.x + 0.7152*colour.y + 0.0722*colour.z;
+    return sqrtf(fminf(fmaxf(luminance, 0), 1));
+}
+
+/**
+ * @brief getSsim The mean structural similarity of the display luminance
+ * of two images, over windows of SSIM_WINDOW pixels
+ */
+static double getSsim(const Vector3 *image, const Vector3 *reference, int width, int height)
+{
+    const double c1 = 0.01*0.01, c2 = 0.03*0.03;
+    const int step = SSIM_WINDOW / 2;
+    const int area = SSIM_WINDOW * SSIM_WINDOW;
+    double total = 0;
+    int windows = 0;
+    for (int y = 0; y + SSIM_WINDOW <= height; y += step)
+    {
+        for (int x = 0; x + SSIM_WINDOW <= width; x += step)
+        {
+            double sumA = 0, sumB = 0, sumAA = 0, sumBB = 0, sumAB = 0;
+            for (int j = y; j < y + SSIM_WINDOW; ++j)
+            {
+                for (int i = x; i < x + SSIM_WINDOW; ++i)
+                {
+                    double a = getDisplayLuminance(image[j*width + i]);
+                    double b = getDisplayLuminance(reference[j*width + i]);
+                    sumA += a;
+                    sumB += b;
+                    sumAA += a*a;
+                    sumBB += b*b;
+                    sumAB += a*b;
+                }
+            }
+            double meanA = sumA / area, meanB = sumB / area;
+            double varianceA = sumAA / area - meanA*meanA;
+            double varianceB = sumBB / area - meanB*meanB;
+            double covariance = sumAB / area - meanA*meanB;
+            total += (2*meanA*meanB + c1) * (2*covariance + c2) /
+                    ((meanA*meanA + meanB*meanB + c1) * (varianceA + varianceB + c2));
+            windows++;
+        }
+    }
+    return windows > 0 ? total / windows : 1;
+}
+
+static Quality compare(const Framebuffer &image, const Framebuffer &reference)
+{
+    const float *a = &image.getColour()[0].x;
+    const float *b = &reference.getColour()[0].x;
+    int count = 3 * WIDTH * HEIGHT;
+
+    //relMSE divides by the squared reference, offset so that black
+    //pixels do not dominate
+    double squaredError = 0, relativeError = 0;
+    for (int k = 0; k < count; ++k)
+    {
+        double difference = a[k] - b[k];
+        squaredError += difference*difference;
+        relativeError += difference*difference / (b[k]*b[k] + 0.01);
+    }
+
+    Quality quality;
+    quality.rmse = sqrt(squaredError / count);
+    quality.relMse = relativeError / count;
+    quality.ssim = getSsim(image.getColour(), reference.getColour(), WIDTH, HEIGHT);
+    return quality;
+}
+
+/**
+ * @brief readBaseline Reads the efficiency of each scene from the output
+ * of an earlier run, which has one scene per line
+ * @return Whether the file could be read
+ */
+static bool readBaseline(const string &filename, vector<string> &names, vector<double> &efficiencies)
+{
+    ifstream in(filename.c_str());
+    if (!in)
+    {
+        return false;
+    }
+
+    string line;
+    while (getline(in, line))
+    {
+        size_t name = line.find("{\"name\": \"");
+        size_t efficiency = line.find("\"efficiency\": ");
+        if (name == string::npos || efficiency == string::npos)
+        {
+            continue;
+        }
+        name += strlen("{\"name\": \"");
+        names.push_back(line.substr(name, line.find('"', name) - name));
+        efficiencies.push_back(atof(line.c_str() + efficiency + strlen("\"efficiency\": ")));
+    }
+    return true;
+}
+
+static string getReferenceFilename(const string &directory, const ReferenceScene &reference)
+{
+    return directory + "/" + reference.name + ".pfm";
+}
+
+static void printUsage()
+{
+    cerr << "Usage: qualityBench --references dir [--make-references] [--time seconds]\n"
+            "                    [--reference-spp N] [--baseline file] [--tolerance fraction]\n"
+            "                    [--output file]" << endl;
+}
+
+int main(int argc, char **argv)
+{
+    string referenceDirectory, baselineFile, outputFile;
+    bool makeReferences = false;
+    double seconds = 2;
+    int referenceSamples = 4096;
+    double tolerance = 0.1;
+
+    for (int k = 1; k < argc; ++k)
+    {
+        bool hasValue = k + 1 < argc;
+        if (strcmp(argv[k], "--references") == 0 && hasValue)
+        {
+            referenceDirectory = argv[++k];
+        }
+        else if (strcmp(argv[k], "--make-references") == 0)
+        {
+            makeReferences = true;
+        }
+        else if (strcmp(argv[k], "--time") == 0 && hasValue)
+        {
+            seconds = atof(argv[++k]);
+        }
+        else if (strcmp(argv[k], "--reference-spp") == 0 && hasValue)
+        {
+            referenceSamples = atoi(argv[++k]);
+        }
+        else if (strcmp(argv[k], "--baseline") == 0 && hasValue)
+        {
+            baselineFile = argv[++k];
+        }
+        else if (strcmp(argv[k], "--tolerance") == 0 && hasValue)
+        {
+            tolerance = atof(argv[++k]);
+        }
+        else if (strcmp(argv[k], "--output") == 0 && hasValue)
+        {
+            outputFile = argv[++k];
+        }
+        else
+        {
+            printUsage();
+            return 1;
+        }
+    }
+    if (referenceDirectory.empty() || seconds <= 0 || referenceSamples < PASS_SAMPLES)
+    {
+        printUsage();
+        return 1;
+    }
+
+    size_t sceneCount = sizeof(REFERENCE_SCENES) / sizeof(REFERENCE_SCENES[0]);
+    if (makeReferences)
+    {
+        for (size_t s = 0; s < sceneCount; ++s)
+        {
+            int samplesPerPixel;
+            double renderSeconds;
+            Framebuffer *image = render(REFERENCE_SCENES[s], 0, referenceSamples, 1, samplesPerPixel, renderSeconds);
+            string filename = getReferenceFilename(referenceDirectory, REFERENCE_SCENES[s]);
+            if (!writePfm(filename, *image))
+            {
+                cerr << "Could not write " << filename << endl;
+                return 1;
+            }
+            cerr << "Wrote " << filename << " (" << samplesPerPixel << " spp, " << renderSeconds << " s)" << endl;
+            delete image;
+        }
+        return 0;
+    }
+
+    vector<string> baselineNames;
+    vector<double> baselineEfficiencies;
+    if (!baselineFile.empty() && !readBaseline(baselineFile, baselineNames, baselineEfficiencies))
+    {
+        cerr << "Could not read " << baselineFile << endl;
+        return 1;
+    }
+
+    ofstream file;
+    if (!outputFile.empty())
+    {
+        file.open(outputFile.c_str());
+    }
+    ostream &out = outputFile.empty() ? cout : file;
+
+    out << "{\n";
+    out << "  \"benchmark\": \"qualityBench\",\n";
+#ifdef __VERSION__
+    out << "  \"compiler\": \"" << __VERSION__ << "\",\n";
+#endif
+    out << "  \"width\": " << WIDTH << ",\n";
+    out << "  \"height\": " << HEIGHT << ",\n";
+    out << "  \"time_s\": " << seconds << ",\n";
+    out << "  \"scenes\": [\n";
+
+    bool regressed = false;
+    for (size_t s = 0; s < sceneCount; ++s)
+    {
+        const ReferenceScene &reference = REFERENCE_SCENES[s];
+        string filename = getReferenceFilename(referenceDirectory, reference);
+        Framebuffer *referenceImage = readPfm(filename);
+        if (!referenceImage || referenceImage->getWidth() != WIDTH || referenceImage->getHeight() != HEIGHT)
+        {
+            cerr << "Could not read a " << WIDTH << "x" << HEIGHT << " reference from " << filename
+                 << "; create it with --make-references" << endl;
+            return 1;
+        }
+
+        int samplesPerPixel;
+        double renderSeconds;
+        Framebuffer *image = render(reference, seconds, 0, 0, samplesPerPixel, renderSeconds);
+        Quality quality = compare(*image, *referenceImage);
+        quality.samplesPerPixel = samplesPerPixel;
+        quality.renderSeconds = renderSeconds;
+        quality.efficiency = 1 / (quality.relMse * renderSeconds);
+        delete image;
+        delete referenceImage;
+
+        out << "    {\"name\": \"" << reference.name << "\""
+            << ", \"spp\": " << quality.samplesPerPixel
+            << ", \"render_s\": " << quality.renderSeconds
+            << ", \"rmse\": " << quality.rmse
+            << ", \"relmse\": " << quality.relMse
+            << ", \"ssim\": " << quality.ssim
+            << ", \"efficiency\": " << quality.efficiency;
+
+        for (size_t b = 0; b < baselineNames.size(); ++b)
+        {
+            if (baselineNames[b] == reference.name)
+            {
+                double change = quality.efficiency / baselineEfficiencies[b] - 1;
+                bool sceneRegressed = change < -tolerance;
+                regressed = regressed || sceneRegressed;
+                out << ", \"baseline_efficiency\": " << baselineEfficiencies[b]
+                    << ", \"efficiency_change\": " << change
+                    << ", \"regressed\": " << (sceneRegressed ? "true" : "false");
+                if (sceneRegressed)
+                {
+                    cerr << reference.name << ": efficiency dropped by " << -change * 100 << "%" << endl;
+                }
+            }
+        }
+        out << "}" << (s + 1 < sceneCount ? "," : "") << "\n";
+        out.flush();
+    }
+
+    out << "  ]\n";
+    out << "}\n";
+
+    if (!out)
+    {
+        cerr << "Could not write " << outputFile << endl;
+        return 1;
+    }
+    return regressed ? 1 : 0;
+}
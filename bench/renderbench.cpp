@@ -0,0 +1,443 @@
+//Renders a fixed set of reference scenes end to end at 1, 2, 4, ... up
+//to the maximum number of threads, with the threads left free and then
+//pinned to NUMA nodes, and reports rays per second, the time spent in
+//each phase, memory use and how well rendering scales. On a machine with
+//more than one node the pinned runs render from a copy of the scene per
+//node, so comparing them shows what cross-socket reads cost.
+//
+//The integrators are then compared on a scene far larger than the
+//caches: tracing one path at a time against tracing each row as a batch
+//with coherence-sorted secondary rays. Last-level cache misses are
+//counted where the kernel provides hardware perf counters.
+//Results are printed as JSON so that builds and machines can be compared.
+//
+//Usage: rayTracerBench [--width N] [--height N] [--spp N] [--max-threads N] [--large-spheres N] [--isa level] [--output file]
+
+#include "affinity.hpp"
+#include "camera.hpp"
+#include "cpudispatch.hpp"
+#include "pngwriter.hpp"
+#include "renderscene.hpp"
+#include "sceneparser.hpp"
+#include "scenegenerator.hpp"
+#include "tonemap.hpp"
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+using namespace std;
+
+//The same box as scenes/box.scene, kept here so that the benchmark does
+//not depend on the directory it is run from
+static const char *BOX_SCENE =
+        "camera position 0 0 0 lookat 0 0 -1 fov 90\n"
+        "background 1 1 1\n"
+        "material ceiling diffuse 0.2 0.2 0.2\n"
+        "material red diffuse 1 0.3 0.3\n"
+        "material green diffuse 0.3 1 0.3\n"
+        "material blue diffuse 0.3 0.3 1\n"
+        "material floor diffuse 0.7 0.7 0.7\n"
+        "material lamp light 1 0.8 0\n"
+        "plane 0 1.5 0  0 1 0  ceiling\n"
+        "plane -2 0 0  1 0 0  red\n"
+        "plane 0 0 -2  0 0 1  green\n"
+        "plane 2 0 0  1 0 0  blue\n"
+        "plane 0 -1.5 0  0 1 0  floor\n"
+        "triangle -2 0 -1.999  2 0 -1.999  2 2 -1.999  lamp\n";
+
+struct ReferenceScene
+{
+    const char *name;
+
+    //The kind of generated scene, or NULL for BOX_SCENE
+    const char *kind;
+    long long count;
+};
+
+static const ReferenceScene REFERENCE_SCENES[] = {
+    {"box", NULL, 0},
+    {"spheres-100", "spheres", 100},
+    {"triangles-100", "triangles", 100},
+    {"instances-20", "instances", 20},
+    {"lights-16", "lights", 16},
+    {"particles-1000", "particles", 1000}
+};
+
+//The scene the integrators are compared on is a cloud of this many
+//spheres, about 16 bytes each, so the default does not fit in the caches
+//of current cpus. Every ray tests every sphere, so it is rendered small.
+static const long long LARGE_SCENE_SPHERES = 8000000;
+static const int LARGE_SCENE_WIDTH = 32, LARGE_SCENE_HEIGHT = 18, LARGE_SCENE_SPP = 1;
+
+struct Run
+{
+    int threads;
+    bool pinned, sorted;
+    double setupSeconds, renderSeconds, encodeSeconds;
+    RenderStatistics statistics;
+
+    //The resident memory the run added, measured while its scene and
+    //framebuffer were still alive
+    long memoryGrowth;
+
+    //Last-level cache misses of the render threads while rendering, or
+    //-1 if they could not be counted
+    long long cacheMisses;
+};
+
+static double getSecondsSince(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * @brief getPeakMemory The most memory the process has had resident so
+ * far, in kilobytes, or -1 if it is not known
+ */
+static long getPeakMemory()
+{
+#if defined(__unix__) || defined(__APPLE__)
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+    {
+#ifdef __APPLE__
+        return usage.ru_maxrss / 1024;
+#else
+        return usage.ru_maxrss;
+#endif
+    }
+#endif
+    return -1;
+}
+
+/**
+ * @brief getResidentMemory The memory the process has resident now, in
+ * kilobytes, or -1 if it is not known
+ */
+static long getResidentMemory()
+{
+#ifdef __linux__
+    FILE *file = fopen("/proc/self/statm", "r");
+    long pages, residentPages;
+    bool read = file && fscanf(file, "%ld %ld", &pages, &residentPages) == 2;
+    if (file)
+    {
+        fclose(file);
+    }
+    if (read)
+    {
+        return residentPages * (sysconf(_SC_PAGESIZE) / 1024);
+    }
+#endif
+    return -1;
+}
+
+/**
+ * @brief openCacheMissCounters Starts counting the last-level cache
+ * misses of each thread of the OpenMP team. The counters follow threads,
+ * not the process, so they count the render as long as its parallel
+ * regions reuse the team's threads, as OpenMP runtimes do.
+ * @return A perf descriptor per thread, -1 where counting failed
+ */
+static vector<int> openCacheMissCounters()
+{
+    vector<int> descriptors;
+#if defined(__linux__) && defined(_OPENMP)
+    descriptors.assign(omp_get_max_threads(), -1);
+#pragma omp parallel
+    {
+        perf_event_attr attributes;
+        memset(&attributes, 0, sizeof(attributes));
+        attributes.type = PERF_TYPE_HARDWARE;
+        attributes.size = sizeof(attributes);
+        attributes.config = PERF_COUNT_HW_CACHE_MISSES;
+        attributes.exclude_kernel = 1;
+        attributes.exclude_hv = 1;
+        int thread = omp_get_thread_num();
+        if (thread < (int) descriptors.size())
+        {
+            descriptors[thread] = (int) syscall(__NR_perf_event_open, &attributes, 0, -1, -1, 0);
+        }
+    }
+#endif
+    return descriptors;
+}
+
+/**
+ * @brief closeCacheMissCounters Stops counters opened by
+ * openCacheMissCounters
+ * @return The misses of every thread, or -1 if any could not be counted
+ */
+static long long closeCacheMissCounters(const vector<int> &descriptors)
+{
+    long long misses = descriptors.empty() ? -1 : 0;
+#ifdef __linux__
+    for (size_t k = 0; k < descriptors.size(); ++k)
+    {
+        long long count;
+        if (descriptors[k] < 0 || read(descriptors[k], &count, sizeof(count)) != sizeof(count))
+        {
+            misses = -1;
+        }
+        else if (misses >= 0)
+        {
+            misses += count;
+        }
+        if (descriptors[k] >= 0)
+        {
+            close(descriptors[k]);
+        }
+    }
+#endif
+    return misses;
+}
+
+static bool buildScene(const ReferenceScene &reference, Scene &scene, CameraOptions &cameraOptions)
+{
+    if (!reference.kind)
+    {
+        string error;
+        return parseScene(BOX_SCENE, scene, cameraOptions, error);
+    }
+    return generateScene(reference.kind, reference.count, 1, scene, cameraOptions);
+}
+
+static Run runScene(const ReferenceScene &reference, int threads, bool pinned, bool sorted,
+                    int width, int height, int samplesPerPixel)
+{
+#ifdef _OPENMP
+    omp_set_num_threads(threads);
+#endif
+
+    Run run;
+    run.threads = threads;
+    run.pinned = pinned;
+    run.sorted = sorted;
+    long startMemory = getResidentMemory();
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    Scene scene;
+    CameraOptions cameraOptions;
+    if (!buildScene(reference, scene, cameraOptions))
+    {
+        cerr << "Could not build scene " << reference.name << endl;
+        exit(1);
+    }
+    Camera camera(width, height, cameraOptions);
+    RenderScene *renderScene = scene.compile();
+    run.setupSeconds = getSecondsSince(start);
+
+    RenderOptions options;
+    options.samplesPerPixel = samplesPerPixel;
+    options.pinThreads = pinned;
+    options.sortSecondaryRays = sorted;
+    options.statistics = &run.statistics;
+    vector<int> cacheMissCounters = openCacheMissCounters();
+    start = chrono::steady_clock::now();
+    Framebuffer *framebuffer = camera.captureScene(*renderScene, options);
+    run.renderSeconds = getSecondsSince(start);
+    run.cacheMisses = closeCacheMissCounters(cacheMissCounters);
+
+    start = chrono::steady_clock::now();
+    vector<RGBAVector> pixels(width * (size_t) height);
+    tonemap(framebuffer->getColour(), (size_t) width * height, ToneMapOptions(), pixels.data());
+    const char *filename = "renderbench.png";
+    if (!writePng(filename, width, height, 4, pixels.data(), width * 4))
+    {
+        cerr << "Could not write " << filename << endl;
+        exit(1);
+    }
+    remove(filename);
+    run.encodeSeconds = getSecondsSince(start);
+
+    long endMemory = getResidentMemory();
+    run.memoryGrowth = startMemory >= 0 && endMemory >= 0 ? endMemory - startMemory : -1;
+    delete framebuffer;
+    delete renderScene;
+    return run;
+}
+
+/**
+ * @brief writeRun Writes the measurements of a run as JSON fields, after
+ * the fields that say which run it was
+ */
+static void writeRun(ostream &out, const Run &run)
+{
+    out << ", \"setup_s\": " << run.setupSeconds
+        << ", \"render_s\": " << run.renderSeconds
+        << ", \"encode_s\": " << run.encodeSeconds
+        << ", \"primary_rays\": " << run.statistics.primaryRays
+        << ", \"total_rays\": " << run.statistics.totalRays
+        << ", \"primary_mrays_per_s\": " << run.statistics.primaryRays / run.renderSeconds / 1e6
+        << ", \"total_mrays_per_s\": " << run.statistics.totalRays / run.renderSeconds / 1e6
+        << ", \"cache_misses\": " << run.cacheMisses
+        << ", \"rss_growth_kb\": " << run.memoryGrowth
+        << ", \"cumulative_peak_rss_kb\": " << getPeakMemory();
+#ifdef RAYTRACER_STATS
+    out << ", \"counters\": ";
+    writeRenderCountersJson(out, run.statistics.counters);
+#endif
+}
+
+int main(int argc, char **argv)
+{
+    int width = 160, height = 90, samplesPerPixel = 8;
+    int maxThreads = 1;
+#ifdef _OPENMP
+    maxThreads = omp_get_max_threads();
+#endif
+    long long largeSpheres = LARGE_SCENE_SPHERES;
+    string outputFile;
+
+    for (int k = 1; k < argc; ++k)
+    {
+        bool hasValue = k + 1 < argc;
+        if (strcmp(argv[k], "--width") == 0 && hasValue)
+        {
+            width = atoi(argv[++k]);
+        }
+        else if (strcmp(argv[k], "--height") == 0 && hasValue)
+        {
+            height = atoi(argv[++k]);
+        }
+        else if (strcmp(argv[k], "--spp") == 0 && hasValue)
+        {
+            samplesPerPixel = atoi(argv[++k]);
+        }
+        else if (strcmp(argv[k], "--max-threads") == 0 && hasValue)
+        {
+            maxThreads = atoi(argv[++k]);
+        }
+        else if (strcmp(argv[k], "--large-spheres") == 0 && hasValue)
+        {
+            largeSpheres = atoll(argv[++k]);
+        }
+        else if (strcmp(argv[k], "--isa") == 0 && hasValue)
+        {
+            CpuLevel limit;
+            if (!parseCpuLevel(argv[++k], limit))
+            {
+                cerr << "Unknown instruction set level " << argv[k] << endl;
+                return 1;
+            }
+            setCpuLevelLimit(limit);
+        }
+        else if (strcmp(argv[k], "--output") == 0 && hasValue)
+        {
+            outputFile = argv[++k];
+        }
+        else
+        {
+            cerr << "Usage: rayTracerBench [--width N] [--height N] [--spp N] [--max-threads N] [--large-spheres N] "
+                    "[--isa level] [--output file]" << endl;
+            return 1;
+        }
+    }
+    if (width < 1 || height < 1 || samplesPerPixel < 1 || maxThreads < 1 || largeSpheres < 1)
+    {
+        cerr << "Sizes, samples and threads must be positive" << endl;
+        return 1;
+    }
+
+    //Powers of two up to, and always including, the maximum
+    vector<int> threadCounts;
+    for (int threads = 1; threads < maxThreads; threads *= 2)
+    {
+        threadCounts.push_back(threads);
+    }
+    threadCounts.push_back(maxThreads);
+
+    ofstream file;
+    if (!outputFile.empty())
+    {
+        file.open(outputFile.c_str());
+    }
+    ostream &out = outputFile.empty() ? cout : file;
+
+    out << "{\n";
+    out << "  \"benchmark\": \"rayTracerBench\",\n";
+#ifdef __VERSION__
+    out << "  \"compiler\": \"" << __VERSION__ << "\",\n";
+#endif
+    out << "  \"isa\": \"" << getCpuLevelName(getCpuLevel()) << "\",\n";
+    out << "  \"width\": " << width << ",\n";
+    out << "  \"height\": " << height << ",\n";
+    out << "  \"spp\": " << samplesPerPixel << ",\n";
+    out << "  \"max_threads\": " << maxThreads << ",\n";
+    out << "  \"numa_nodes\": " << getNumaNodeCount() << ",\n";
+    out << "  \"scenes\": [\n";
+
+    size_t sceneCount = sizeof(REFERENCE_SCENES) / sizeof(REFERENCE_SCENES[0]);
+    for (size_t s = 0; s < sceneCount; ++s)
+    {
+        const ReferenceScene &reference = REFERENCE_SCENES[s];
+        out << "    {\"name\": \"" << reference.name << "\", \"runs\": [\n";
+
+        //Both runs of each thread count are compared with one free thread
+        double singleThreadSeconds = 0;
+        size_t runCount = threadCounts.size() * 2;
+        for (size_t r = 0; r < runCount; ++r)
+        {
+            Run run = runScene(reference, threadCounts[r / 2], r % 2 == 1, false, width, height, samplesPerPixel);
+            if (r == 0)
+            {
+                singleThreadSeconds = run.renderSeconds * run.threads;
+            }
+
+            //How close the speedup over one thread is to the thread count
+            double efficiency = singleThreadSeconds / (run.renderSeconds * run.threads);
+            out << "      {\"threads\": " << run.threads
+                << ", \"pinned\": " << (run.pinned ? "true" : "false")
+                << ", \"parallel_efficiency\": " << efficiency;
+            writeRun(out, run);
+            out << "}" << (r + 1 < runCount ? "," : "") << "\n";
+            out.flush();
+        }
+        out << "    ]}" << (s + 1 < sceneCount ? "," : "") << "\n";
+    }
+
+    out << "  ],\n";
+
+    //Both integrators on every thread, on a scene that does not fit in cache
+    ReferenceScene large = {"particles", "particles", largeSpheres};
+    out << "  \"integrators\": {\"scene\": \"particles-" << largeSpheres << "\""
+        << ", \"width\": " << LARGE_SCENE_WIDTH << ", \"height\": " << LARGE_SCENE_HEIGHT
+        << ", \"spp\": " << LARGE_SCENE_SPP << ", \"runs\": [\n";
+    for (int sorted = 0; sorted < 2; ++sorted)
+    {
+        Run run = runScene(large, maxThreads, false, sorted == 1, LARGE_SCENE_WIDTH, LARGE_SCENE_HEIGHT, LARGE_SCENE_SPP);
+        out << "    {\"integrator\": \"" << (run.sorted ? "sorted" : "path") << "\", \"threads\": " << run.threads;
+        writeRun(out, run);
+        out << "}" << (sorted == 0 ? "," : "") << "\n";
+        out.flush();
+    }
+    out << "  ]},\n";
+    out << "  \"peak_rss_kb\": " << getPeakMemory() << "\n";
+    out << "}\n";
+
+    if (!out)
+    {
+        cerr << "Could not write " << outputFile << endl;
+        return 1;
+    }
+    return 0;
+}
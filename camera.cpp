@@ -3,8 +3,18 @@
 #include <iostream>
 #include <fstream>
 #include "geometry.hpp"
+#include "affinity.hpp"
+#include "denoiser.hpp"
+#include "tracing.hpp"
+#include "renderscene.hpp"
 #include <float.h>
 #include <math.h>
+#include <algorithm>
+#include <chrono>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 
 //Constructors
@@ -19,6 +29,27 @@ CameraOptions::CameraOptions()
     cameraRoll = 0;
 }
 
+RenderStatistics::RenderStatistics()
+{
+    primaryRays = 0;
+    totalRays = 0;
+    counters.clear();
+}
+
+RenderOptions::RenderOptions()
+{
+    samplesPerPixel = 100;
+    seed = 0;
+    firstSample = 0;
+    sortSecondaryRays = false;
+    pinThreads = false;
+    tileHeight = 64;
+    outputAovs = false;
+    outputCost = false;
+    denoise = false;
+    statistics = NULL;
+}
+
 /**
  * @brief Camera Constructs a simple pinhole Camera with no focus blur.
  * The field of view is set to 105 degrees by default. The camera is positioned
@@ -50,7 +81,7 @@ Camera::Camera(int x, int y, const CameraOptions &options)
     float cameraRollRadians = options.cameraRoll * M_PI/180;
 
     float halfHeight = tan(fovRadians/2);
-    float halfWidth = float(x/y) * halfHeight;
+    float halfWidth = float(x)/float(y) * halfHeight;
 
     lensRadius = options.lensRadius;
 
@@ -102,86 +133,572 @@ Camera::Camera(int x, int y, const CameraOptions &options)
     vertical = 2*halfHeight*options.focusDistance*v;
 }
 
-RGBAVector * Camera::captureScene(const Scene &scene, int samplesPerPixel) const
+/**
+ * @brief addFirstHit Adds the AOVs of one sample to a pixel
+ * @param row The row containing the pixel
+ * @param i The column of the pixel
+ * @param ray The primary ray of the sample
+ * @param record The first surface hit by the ray, or a record with a
+ * negative t if the ray hit nothing
+ * @param scene The scene being rendered
+ */
+static void addFirstHit(const FramebufferRow &row, int i, const Ray &ray, const HitRecord &record, const RenderScene &scene)
 {
-    RGBAVector *pixels = new RGBAVector[horizontalPixels * verticalPixels];
+    if (record.t >= 0)
+    {
+        row.depth[i] += record.t * ray.getDirection().getLength();
+        row.normal[i] += record.normal.getUnitVector();
 
-#pragma omp parallel for
-    for (int j = 0; j < verticalPixels; ++j)
+        //A flattened material's colour is its albedo
+        row.albedo[i] += scene.getMaterial(record.materialIndex).colour;
+    }
+    else
     {
-        for (int i = 0; i < horizontalPixels; ++i)
+        //Rays that escape see the background, which has no depth or normal
+        row.albedo[i] += scene.getBackground();
+    }
+}
+
+Framebuffer * Camera::captureScene(const Scene &scene, int samplesPerPixel) const
+{
+    RenderOptions options;
+    options.samplesPerPixel = samplesPerPixel;
+    return captureScene(scene, options);
+}
+
+/**
+ * @brief captureScene Compiles the scene and renders it into a linear
+ * float framebuffer. When rendering a scene more than once, compile it
+ * once with Scene::compile() and render the result instead.
+ */
+Framebuffer * Camera::captureScene(const Scene &scene, const RenderOptions &options) const
+{
+    RenderScene *renderScene = scene.compile();
+    Framebuffer *framebuffer = captureScene(*renderScene, options);
+    delete renderScene;
+    return framebuffer;
+}
+
+/**
+ * @brief captureScene Compiles the scene and renders it one tile row
+ * at a time, as the RenderScene overload does
+ */
+bool Camera::captureScene(const Scene &scene, const RenderOptions &options, ScanlineSink &sink) const
+{
+    RenderScene *renderScene = scene.compile();
+    bool written = captureScene(*renderScene, options, sink);
+    delete renderScene;
+    return written;
+}
+
+/**
+ * @brief captureScene Renders the scene into a linear float framebuffer.
+ * No tonemapping is applied, so the result can be written as HDR or
+ * tonemapped as many times as needed.
+ * @param scene The scene to render
+ * @param options The options to render with
+ * @return The rendered image, which the caller must delete
+ */
+Framebuffer * Camera::captureScene(const RenderScene &scene, const RenderOptions &options) const
+{
+    //The denoiser is guided by the AOVs, so it always needs them
+    Framebuffer *framebuffer = new Framebuffer(horizontalPixels, verticalPixels,
+                                               options.outputAovs || options.denoise, options.outputCost);
+    std::vector<RenderScene *> nodeScenes = replicateScene(scene, options);
+    renderRows(scene, nodeScenes, options, 0, verticalPixels, *framebuffer);
+    deleteScenes(nodeScenes);
+
+    if (options.denoise)
+    {
+        TraceSpan span("denoise");
+        ::denoise(*framebuffer, options.denoiseOptions);
+    }
+    return framebuffer;
+}
+
+/**
+ * @brief captureScene Renders the scene one tile row at a time, handing
+ * each finished tile row to the sink before rendering the next. Only
+ * a single tile row is kept in memory, so the size of the image is not
+ * limited by the memory available for a framebuffer.
+ * @param scene The scene to render
+ * @param options The options to render with. tileHeight sets how many
+ * rows are rendered before they are flushed.
+ * @param sink Receives the rows of the image in order
+ * @return Whether the sink accepted every row
+ */
+bool Camera::captureScene(const RenderScene &scene, const RenderOptions &options, ScanlineSink &sink) const
+{
+    int tileHeight = std::max(1, std::min(options.tileHeight, verticalPixels));
+    Framebuffer tile(horizontalPixels, tileHeight);
+
+    //The copies are made once and used for every tile row
+    std::vector<RenderScene *> nodeScenes = replicateScene(scene, options);
+    bool written = true;
+    for (int firstRow = 0; firstRow < verticalPixels && written; firstRow += tileHeight)
+    {
+        int rowCount = std::min(tileHeight, verticalPixels - firstRow);
+        renderRows(scene, nodeScenes, options, firstRow, rowCount, tile);
+        written = sink.writeRows(tile.getColour(), firstRow, rowCount);
+    }
+    deleteScenes(nodeScenes);
+    return written;
+}
+
+/**
+ * @brief replicateScene Copies the scene once for each NUMA node that
+ * pinned render threads run on. Each copy is made by the first render
+ * thread of its node, pinned as it will be while rendering, so the copy
+ * is placed in that node's memory and rays are traced without reading
+ * the scene across the interconnect. Nothing is copied unless threads
+ * are pinned and the render threads span more than one node.
+ * @return The copy for each node, indexed by node, or an empty list
+ */
+std::vector<RenderScene *> Camera::replicateScene(const RenderScene &scene, const RenderOptions &options)
+{
+    std::vector<RenderScene *> nodeScenes;
+#ifdef _OPENMP
+    if (!options.pinThreads)
+    {
+        return nodeScenes;
+    }
+
+    //The thread that makes the copy of each node, or -1
+    std::vector<int> copyingThreads;
+    int nodeCount = 0;
+    for (int thread = 0; thread < omp_get_max_threads(); ++thread)
+    {
+        size_t node = getRenderThreadNode(thread);
+        if (node >= copyingThreads.size())
         {
-            Vector3 col;
-            for (int s = 0; s < samplesPerPixel; ++s)
+            copyingThreads.resize(node + 1, -1);
+        }
+        if (copyingThreads[node] < 0)
+        {
+            copyingThreads[node] = thread;
+            ++nodeCount;
+        }
+    }
+    if (nodeCount < 2)
+    {
+        return nodeScenes;
+    }
+
+    TraceSpan span("replicate scene", "nodes", nodeCount);
+    nodeScenes.resize(copyingThreads.size(), NULL);
+#pragma omp parallel
+    {
+        int thread = omp_get_thread_num();
+        size_t node = getRenderThreadNode(thread);
+        if (node < copyingThreads.size() && copyingThreads[node] == thread)
+        {
+            std::vector<int> unpinnedCpus = getThreadCpus();
+            bool pinned = pinRenderThread(thread);
+            nodeScenes[node] = scene.replicate();
+            if (pinned)
             {
-                //Send out a ray to a random spot somewhere inside the current pixel
-                float x = float(i + rand() / ((float) RAND_MAX+1)) / float(horizontalPixels);
-                float y = float(j + rand() / ((float) RAND_MAX+1)) / float(verticalPixels);
+                setThreadCpus(unpinnedCpus);
+            }
+        }
+    }
+#else
+    (void) scene;
+    (void) options;
+#endif
+    return nodeScenes;
+}
+
+void Camera::deleteScenes(std::vector<RenderScene *> &scenes)
+{
+    for (RenderScene *scene : scenes)
+    {
+        delete scene;
+    }
+    scenes.clear();
+}
 
-                Vector3 rd = lensRadius*getRandomPointOnUnitDisc();
-                Vector3 offset = u*rd.x + v*rd.y;
-                Ray r(position + offset, upperLeftCorner + horizontal*x - vertical*y - position - offset);
+/**
+ * @brief renderRows Renders a block of rows of the image in parallel
+ * @param scene The scene to render
+ * @param nodeScenes Copies of the scene made by replicateScene, which
+ * threads use instead of the scene if there is one for their node
+ * @param options The options to render with
+ * @param firstRow The first row of the image to render
+ * @param rowCount The number of rows to render
+ * @param target Receives the average radiance (and AOVs, if it has
+ * them) of each pixel of the rendered rows, starting with firstRow
+ */
+void Camera::renderRows(const RenderScene &scene, const std::vector<RenderScene *> &nodeScenes, const RenderOptions &options,
+                        int firstRow, int rowCount, Framebuffer &target) const
+{
+    long long totalRays = 0;
+
+#pragma omp parallel
+    {
+        long long rays = 0;
+
+#ifdef RAYTRACER_STATS
+        threadRenderCounters.clear();
+#endif
 
-                col += traceRay(r, scene, 0);
+        //Pinning lasts only for the render, so the threads that tonemap,
+        //denoise and write the image afterwards may use every cpu
+        std::vector<int> unpinnedCpus;
+        bool pinned = false;
+        const RenderScene *threadScene = &scene;
+#ifdef _OPENMP
+        if (options.pinThreads)
+        {
+            unpinnedCpus = getThreadCpus();
+            pinned = pinRenderThread(omp_get_thread_num());
+
+            size_t node = getRenderThreadNode(omp_get_thread_num());
+            if (node < nodeScenes.size() && nodeScenes[node])
+            {
+                threadScene = nodeScenes[node];
             }
+        }
+        setTraceThreadName("render " + std::to_string(omp_get_thread_num()));
+#else
+        setTraceThreadName("render");
+#endif
 
-            //Take the average colour of all the samples for this pixel
-            col /= float(samplesPerPixel);
+        //Covers the rows of this thread and the wait for the others, so
+        //threads that finish early show up as idle time
+        TraceSpan threadSpan("render rows", "first row", firstRow);
 
-            //Applies a filter which should brighten the image a bit
-            col = Vector3(sqrt(col.x), sqrt(col.y), sqrt(col.z));
+#pragma omp for schedule(static)
+        for (int j = firstRow; j < firstRow + rowCount; ++j)
+        {
+            TraceSpan rowSpan("row", "row", j);
+            FramebufferRow row = target.getRow(j-firstRow);
+            rays += renderRow(*threadScene, options, j, row);
 
-            //Colours must be converted from range [0, 1] to [0, 255].
-            //Using slightly less than 256 eliminates the problem where
-            //we have 256*1.0=256, which is outside the valid range.
-            col.x = fmin(col.x, 1);
-            col.y = fmin(col.y, 1);
-            col.z = fmin(col.z, 1);
+            //Take the average colour of all the samples for each pixel
+            float samples = float(options.samplesPerPixel);
+            for (int i = 0; i < horizontalPixels; ++i)
+            {
+                row.colour[i] /= samples;
+            }
+
+            if (target.hasAovs())
+            {
+                for (int i = 0; i < horizontalPixels; ++i)
+                {
+                    row.depth[i] /= samples;
+                    row.normal[i] /= samples;
+                    row.albedo[i] /= samples;
+                    row.sampleCount[i] = samples;
+                }
+            }
+        }
 
-            col *= 255.99;
+#pragma omp atomic
+        totalRays += rays;
 
-            pixels[j*horizontalPixels + i] = RGBAVector(col);
+        if (pinned)
+        {
+            setThreadCpus(unpinnedCpus);
         }
+
+#ifdef RAYTRACER_STATS
+        if (options.statistics)
+        {
+#pragma omp critical
+            options.statistics->counters.add(threadRenderCounters);
+        }
+#endif
+    }
+
+    if (options.statistics)
+    {
+        options.statistics->primaryRays += (long long) rowCount * horizontalPixels * options.samplesPerPixel;
+        options.statistics->totalRays += totalRays;
     }
-    return pixels;
 }
 
-Vector3 Camera::traceRay(const Ray &ray, const Scene &scene, int depth)
+/**
+ * @brief renderRow Traces every sample of one row of pixels
+ * @param scene The scene to render
+ * @param options The options to render with
+ * @param j The row to render
+ * @param row Receives the sum of the samples of each pixel in the row
+ * @return The number of rays traced
+ */
+long long Camera::renderRow(const RenderScene &scene, const RenderOptions &options, int j, const FramebufferRow &row) const
 {
-    HitRecord record;
-    bool surfaceHit = false;
-    float closestObjectDistance = FLT_MAX;
+    long long rayCount = 0;
+    int samplesPerPixel = options.samplesPerPixel;
+    for (int i = 0; i < horizontalPixels; ++i)
+    {
+        row.colour[i] = Vector3();
+        if (row.depth)
+        {
+            row.depth[i] = 0;
+            row.normal[i] = Vector3();
+            row.albedo[i] = Vector3();
+        }
+        if (row.time)
+        {
+            row.time[i] = 0;
+            row.rayCount[i] = 0;
+        }
+    }
 
-    //Find the closest object that is hit by the ray
-    for (Surface *surface : scene.getSurfaces())
+    if (options.sortSecondaryRays)
     {
-        if (surface->hitWithRay(ray, 0.001, closestObjectDistance, record))
+        //Trace every sample in the row together so that the
+        //secondary rays can be reordered between bounces
+        std::vector<PathState> paths;
+        paths.reserve(horizontalPixels * samplesPerPixel);
+        for (int i = 0; i < horizontalPixels; ++i)
         {
-            surfaceHit = true;
-            closestObjectDistance = record.t;
+            for (int s = 0; s < samplesPerPixel; ++s)
+            {
+                PathState path;
+                path.sampler = Sampler((uint64_t) j*horizontalPixels + i, options.firstSample + s, options.seed);
+                path.ray = getRay(i, j, path.sampler);
+                path.throughput = Vector3(1, 1, 1);
+                path.pixel = i;
+                path.depth = 0;
+                paths.push_back(path);
+            }
         }
+        rayCount = tracePaths(paths, scene, row);
     }
+    else
+    {
+        for (int i = 0; i < horizontalPixels; ++i)
+        {
+            std::chrono::steady_clock::time_point start;
+            long long pixelRays = rayCount;
+            if (row.time)
+            {
+                start = std::chrono::steady_clock::now();
+            }
+
+            for (int s = 0; s < samplesPerPixel; ++s)
+            {
+                Sampler sampler((uint64_t) j*horizontalPixels + i, options.firstSample + s, options.seed);
+                Ray ray = getRay(i, j, sampler);
+                if (row.depth)
+                {
+                    HitRecord firstHit;
+                    firstHit.t = -1;
+                    row.colour[i] += traceRay(ray, scene, 0, &firstHit, sampler, rayCount);
+                    addFirstHit(row, i, ray, firstHit, scene);
+                }
+                else
+                {
+                    row.colour[i] += traceRay(ray, scene, 0, NULL, sampler, rayCount);
+                }
+            }
+
+            if (row.time)
+            {
+                row.time[i] = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+                row.rayCount[i] = float(rayCount - pixelRays);
+            }
+        }
+    }
+    return rayCount;
+}
+
+/**
+ * @brief getRay Creates a ray through a random spot somewhere inside a pixel
+ * @param i The column of the pixel
+ * @param j The row of the pixel
+ * @param sampler The random numbers of the sample
+ * @return The ray leaving the camera lens
+ */
+Ray Camera::getRay(int i, int j, Sampler &sampler) const
+{
+    float x = float(i + sampler.getFloat()) / float(horizontalPixels);
+    float y = float(j + sampler.getFloat()) / float(verticalPixels);
+
+    Vector3 rd = lensRadius*getRandomPointOnUnitDisc(sampler);
+    Vector3 offset = u*rd.x + v*rd.y;
+    return Ray(position + offset, upperLeftCorner + horizontal*x - vertical*y - position - offset);
+}
+
+/**
+ * @brief traceRay Computes the radiance arriving along a ray
+ * @param ray The ray to trace
+ * @param scene The scene to trace the ray through
+ * @param depth The number of times the ray has been scattered so far
+ * @param firstHit If not null, receives the record of the surface the
+ * ray hits. It is left untouched if the ray hits nothing.
+ * @param sampler The random numbers of the sample the ray belongs to
+ * @param rayCount Incremented for this ray and every ray scattered from it
+ * @return The radiance arriving along the ray
+ */
+Vector3 Camera::traceRay(const Ray &ray, const RenderScene &scene, int depth, HitRecord *firstHit,
+                         Sampler &sampler, long long &rayCount)
+{
+    rayCount++;
+    if (depth == 0)
+    {
+        COUNT_STAT(primaryRays);
+    }
+    else
+    {
+        COUNT_STAT(secondaryRays);
+    }
+
+    //Find the closest object that is hit by the ray
+    HitRecord record;
+    bool surfaceHit = scene.hitWithRay(ray, 0.001, FLT_MAX, record);
 
     //If an object was hit
     if (surfaceHit)
     {
+        if (firstHit)
+        {
+            *firstHit = record;
+        }
+
         Ray scatteredRay;
         Vector3 attenuation;
-        Vector3 emitted = record.material->emitted();
+        const FlatMaterial &material = scene.getMaterial(record.materialIndex);
+        Vector3 emitted = getFlatEmitted(material);
 
         //If this material scatters the ray and this ray has not been scattered a lot
-        if (depth < 50 && record.material->scatter(ray, record, attenuation, scatteredRay))
+        if (depth < 50 && scatterFlatMaterial(material, ray, record, attenuation, scatteredRay, sampler))
         {
             //Trace the scattered ray
-            return emitted + traceRay(scatteredRay, scene, depth+1)*attenuation;
+            return emitted + traceRay(scatteredRay, scene, depth+1, NULL, sampler, rayCount)*attenuation;
         }
         else
         {
+            if (depth >= 50)
+            {
+                COUNT_STAT(depthLimited);
+            }
+            COUNT_STAT(pathLengths[depth]);
+
             //There are no more scattered rays, so return the emitted colour of the material
             return emitted;
         }
     }
 
     //Otherwise draw the background
+    COUNT_STAT(pathLengths[depth]);
     return scene.getBackground();
 }
+
+/**
+ * @brief chargePathStep Adds the time since start to the cost of a pixel
+ * and restarts the timer for the next path step
+ * @param row The row containing the pixel
+ * @param pixel The pixel the timed step belonged to, or -1 if no step
+ * has been timed
+ * @param start When the timed step started
+ */
+static void chargePathStep(const FramebufferRow &row, int pixel, std::chrono::steady_clock::time_point &start)
+{
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (pixel >= 0)
+    {
+        row.time[pixel] += std::chrono::duration<float>(now - start).count();
+    }
+    start = now;
+}
+
+/**
+ * @brief tracePaths Traces a batch of paths one bounce at a time until
+ * every path has terminated. This produces the same result as calling
+ * traceRay for each path, but lets the secondary rays be reordered
+ * between bounces so that neighbouring rays hit the same surfaces.
+ * @param paths The paths to trace. This is consumed by the call.
+ * @param scene The scene to trace the paths through
+ * @param row The radiance of each path is added to row.colour[path.pixel],
+ * as are its first hit AOVs and its cost if the row has them
+ * @return The number of rays traced
+ */
+long long Camera::tracePaths(std::vector<PathState> &paths, const RenderScene &scene, const FramebufferRow &row)
+{
+    std::vector<PathState> scratch;
+    long long rayCount = 0;
+
+    //The paths of a pixel are traced interleaved with those of the other
+    //pixels, so each step is timed and charged to its own pixel
+    int costPixel = -1;
+    std::chrono::steady_clock::time_point costStart;
+
+    while (!paths.empty())
+    {
+        rayCount += paths.size();
+        size_t activePaths = 0;
+        for (size_t k = 0; k < paths.size(); ++k)
+        {
+            PathState &path = paths[k];
+            if (row.time)
+            {
+                chargePathStep(row, costPixel, costStart);
+                costPixel = path.pixel;
+                row.rayCount[path.pixel]++;
+            }
+
+            if (path.depth == 0)
+            {
+                COUNT_STAT(primaryRays);
+            }
+            else
+            {
+                COUNT_STAT(secondaryRays);
+            }
+
+            //Find the closest object that is hit by the ray
+            HitRecord record;
+            bool surfaceHit = scene.hitWithRay(path.ray, 0.001, FLT_MAX, record);
+
+            if (path.depth == 0 && row.depth)
+            {
+                if (!surfaceHit)
+                {
+                    record.t = -1;
+                }
+                addFirstHit(row, path.pixel, path.ray, record, scene);
+            }
+
+            //Otherwise draw the background
+            if (!surfaceHit)
+            {
+                row.colour[path.pixel] += path.throughput*scene.getBackground();
+                COUNT_STAT(pathLengths[path.depth]);
+                continue;
+            }
+
+            Ray scatteredRay;
+            Vector3 attenuation;
+            const FlatMaterial &material = scene.getMaterial(record.materialIndex);
+            row.colour[path.pixel] += path.throughput*getFlatEmitted(material);
+
+            //Keep the path alive if this material scatters the ray and
+            //it has not been scattered a lot
+            if (path.depth < 50 && scatterFlatMaterial(material, path.ray, record, attenuation, scatteredRay, path.sampler))
+            {
+                path.ray = scatteredRay;
+                path.throughput = path.throughput*attenuation;
+                path.depth++;
+                paths[activePaths++] = path;
+            }
+            else
+            {
+                if (path.depth >= 50)
+                {
+                    COUNT_STAT(depthLimited);
+                }
+                COUNT_STAT(pathLengths[path.depth]);
+            }
+        }
+        if (row.time)
+        {
+            chargePathStep(row, costPixel, costStart);
+            costPixel = -1;
+        }
+        paths.resize(activePaths);
+        sortPathsByCoherence(paths, scratch);
+    }
+    return rayCount;
+}
@@ -2,7 +2,13 @@
 #define CAMERA_HPP
 
 #include "scene.hpp"
-#include "rgbvector.hpp"
+#include "framebuffer.hpp"
+#include "denoiser.hpp"
+#include "raybatch.hpp"
+#include "scanlinesink.hpp"
+#include "renderstats.hpp"
+
+class RenderScene;
 
 class CameraOptions
 {
@@ -16,13 +22,84 @@ class CameraOptions
         CameraOptions();
 };
 
+/**
+ * Counts of the work done by a render
+ * @brief The RenderStatistics class
+ */
+class RenderStatistics
+{
+    public:
+        long long primaryRays;
+
+        //Every ray cast into the scene, primary and scattered
+        long long totalRays;
+
+        //Detailed counts, which are only gathered when the renderer is
+        //built with RAYTRACER_STATS and are left at zero otherwise
+        RenderCounters counters;
+
+        RenderStatistics();
+};
+
+class RenderOptions
+{
+    public:
+        int samplesPerPixel;
+
+        //The random numbers of every sample are derived from its pixel,
+        //its index and this seed, so the same options always give the
+        //same image. Rendering samples starting from firstSample lets
+        //separate renders of the same pixels be merged.
+        unsigned int seed;
+        int firstSample;
+
+        //Trace each row as a batch of paths and reorder the secondary
+        //rays by origin cell and direction octant before every bounce.
+        //Without an acceleration structure every ray reads the whole
+        //scene, so the order gives no locality: rayTracerBench measures
+        //it slightly slower than tracing one path at a time, and it is
+        //not offered as a command line option.
+        bool sortSecondaryRays;
+
+        //Pin each render thread to a cpu, filling one NUMA node before
+        //the next, so that the rows a thread renders stay node-local.
+        //When the threads span several nodes, each node renders from
+        //its own copy of the RenderScene. Threads are unpinned again
+        //when the render finishes.
+        bool pinThreads;
+
+        //The number of rows rendered before they are handed to a ScanlineSink
+        int tileHeight;
+
+        //Fill the depth, normal, albedo and sample count buffers of the
+        //Framebuffer from the first surface hit by each sample
+        bool outputAovs;
+
+        //Record the time spent on and the rays traced for each pixel in
+        //the cost buffers of the Framebuffer
+        bool outputCost;
+
+        //Run the AOV-guided denoiser over the finished framebuffer
+        bool denoise;
+        DenoiseOptions denoiseOptions;
+
+        //If not null, the counts of the render are added to this
+        RenderStatistics *statistics;
+
+        RenderOptions();
+};
+
 class Camera
 {
     public:
         Camera(int x, int y);
         Camera(int x, int y, const CameraOptions &options);
 
-        RGBAVector * captureScene(const Scene &scene, int samplesPerPixel) const;
+        Framebuffer * captureScene(const Scene &scene, int samplesPerPixel) const;
+        Framebuffer * captureScene(const Scene &scene, const RenderOptions &options) const;
+        bool captureScene(const Scene &scene, const RenderOptions &options, ScanlineSink &sink) const;
+        Framebuffer * captureScene(const RenderScene &scene, const RenderOptions &options) const;
+        bool captureScene(const RenderScene &scene, const RenderOptions &options, ScanlineSink &sink) const;
 
     private:
         Vector3 position, lookAt;
@@ -32,8 +109,16 @@ class Camera
         float lensRadius;
         Vector3 u, v, w;
 
-        static Vector3 traceRay(const Ray &ray, const Scene &scene, int depth);
+        Ray getRay(int i, int j, Sampler &sampler) const;
+        void renderRows(const RenderScene &scene, const std::vector<RenderScene *> &nodeScenes, const RenderOptions &options,
+                        int firstRow, int rowCount, Framebuffer &target) const;
+        long long renderRow(const RenderScene &scene, const RenderOptions &options, int j, const FramebufferRow &row) const;
 
+        static std::vector<RenderScene *> replicateScene(const RenderScene &scene, const RenderOptions &options);
+        static void deleteScenes(std::vector<RenderScene *> &scenes);
+        static Vector3 traceRay(const Ray &ray, const RenderScene &scene, int depth, HitRecord *firstHit,
+                                Sampler &sampler, long long &rayCount);
+        static long long tracePaths(std::vector<PathState> &paths, const RenderScene &scene, const FramebufferRow &row);
 
 };
 
@@ -0,0 +1,862 @@
+#include "compiledscene.hpp"
+#include "surfaceinstance.hpp"
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define HAVE_MMAP
+#endif
+
+static const char COMPILED_SCENE_MAGIC[8] = {'R', 'T', 'S', 'C', 'E', 'N', 'E', '\0'};
+static const uint32_t BYTE_ORDER_MARK = 0x01020304;
+static const uint64_t SECTION_ALIGNMENT = 16;
+
+SceneCompiler::SceneCompiler()
+{
+}
+
+/**
+ * @brief getMaterialIndex Finds the index of a material in the material
+ * table, adding it the first time it is seen
+ */
+uint32_t SceneCompiler::getMaterialIndex(Material *material)
+{
+    std::unordered_map<Material *, uint32_t>::const_iterator it = materialIndices.find(material);
+    if (it != materialIndices.end())
+    {
+        return it->second;
+    }
+
+    FlatMaterial flat;
+    material->flatten(flat);
+    uint32_t index = (uint32_t) scene.materials.size();
+    scene.materials.push_back(flat);
+    materialIndices[material] = index;
+    return index;
+}
+
+/**
+ * @brief addLight Records a primitive that was just added as a light if
+ * its material emits light
+ */
+void SceneCompiler::addLight(FlatPrimitiveType type, size_t index, uint32_t material)
+{
+    if (scene.materials[material].type == FLAT_LIGHT)
+    {
+        FlatLight light;
+        light.type = type;
+        light.index = (uint32_t) index;
+        scene.lights.push_back(light);
+    }
+}
+
+Vector3 SceneCompiler::transformPoint(Vector3 point) const
+{
+    //The innermost transform is applied first
+    for (size_t k = transforms.size(); k-- > 0;)
+    {
+        const Transform &transform = transforms[k];
+        if (!transform.isRotation)
+        {
+            point += transform.offset;
+        }
+        else if (transform.axis == X_AXIS)
+        {
+            point = rotateAboutX(point, transform.theta);
+        }
+        else if (transform.axis == Y_AXIS)
+        {
+            point = rotateAboutY(point, transform.theta);
+        }
+        else
+        {
+            point = rotateAboutZ(point, transform.theta);
+        }
+    }
+    return point;
+}
+
+Vector3 SceneCompiler::transformDirection(Vector3 direction) const
+{
+    for (size_t k = transforms.size(); k-- > 0;)
+    {
+        const Transform &transform = transforms[k];
+        if (!transform.isRotation)
+        {
+            continue;
+        }
+        else if (transform.axis == X_AXIS)
+        {
+            direction = rotateAboutX(direction, transform.theta);
+        }
+        else if (transform.axis == Y_AXIS)
+        {
+            direction = rotateAboutY(direction, transform.theta);
+        }
+        else
+        {
+            direction = rotateAboutZ(direction, transform.theta);
+        }
+    }
+    return direction;
+}
+
+void SceneCompiler::pushRotation(Axis axis, float theta)
+{
+    Transform transform;
+    transform.isRotation = true;
+    transform.axis = axis;
+    transform.theta = theta;
+    transforms.push_back(transform);
+}
+
+void SceneCompiler::pushTranslation(Vector3 offset)
+{
+    Transform transform;
+    transform.isRotation = false;
+    transform.axis = X_AXIS;
+    transform.theta = 0;
+    transform.offset = offset;
+    transforms.push_back(transform);
+}
+
+void SceneCompiler::popTransform()
+{
+    transforms.pop_back();
+}
+
+void SceneCompiler::addPlane(Vector3 point, Vector3 normal, Material *material)
+{
+    FlatPlane plane;
+    plane.point = transformPoint(point);
+    plane.normal = transformDirection(normal);
+    plane.material = getMaterialIndex(material);
+    addLight(FLAT_PLANE, scene.planes.size(), plane.material);
+    scene.planes.push_back(plane);
+}
+
+void SceneCompiler::addSphere(Vector3 centre, float radius, Material *material)
+{
+    centre = transformPoint(centre);
+    uint32_t materialIndex = getMaterialIndex(material);
+    addLight(FLAT_SPHERE, scene.sphereX.size(), materialIndex);
+    scene.sphereX.push_back(centre.x);
+    scene.sphereY.push_back(centre.y);
+    scene.sphereZ.push_back(centre.z);
+    scene.sphereRadius.push_back(radius);
+    scene.sphereMaterials.push_back(materialIndex);
+}
+
+void SceneCompiler::addRectangle(Vector3 centre, Vector3 normal, Vector3 a, Vector3 b, Vector3 d, Material *material)
+{
+    FlatRectangle rectangle;
+    rectangle.centre = transformPoint(centre);
+    rectangle.normal = transformDirection(normal);
+    rectangle.a = transformPoint(a);
+    rectangle.b = transformPoint(b);
+    rectangle.d = transformPoint(d);
+    rectangle.material = getMaterialIndex(material);
+    addLight(FLAT_RECTANGLE, scene.rectangles.size(), rectangle.material);
+    scene.rectangles.push_back(rectangle);
+}
+
+void SceneCompiler::addTriangle(Vector3 a, Vector3 b, Vector3 c, Material *material)
+{
+    FlatTriangle triangle;
+    triangle.a = transformPoint(a);
+    triangle.b = transformPoint(b);
+    triangle.c = transformPoint(c);
+    triangle.material = getMaterialIndex(material);
+    addLight(FLAT_TRIANGLE, scene.triangles.size(), triangle.material);
+    scene.triangles.push_back(triangle);
+}
+
+/**
+ * @brief addSphereCloud Adds the spheres of a SphereCloud. Unless a
+ * transform is pushed, the arrays are referred to rather than copied, so
+ * they must not change while the compiler or a FlatScene taken from it
+ * is in use.
+ * @param materialIndices The index of each sphere's material in materials
+ * @param materials The materials of the cloud
+ */
+void SceneCompiler::addSphereCloud(const SphereArrays &spheres, const uint16_t *materialIndices,
+                                   Material * const *materials, size_t materialCount)
+{
+    if (!transforms.empty())
+    {
+        for (size_t k = 0; k < spheres.count; ++k)
+        {
+            addSphere(Vector3(spheres.x[k], spheres.y[k], spheres.z[k]), spheres.radius[k],
+                      materials[materialIndices[k]]);
+        }
+        return;
+    }
+
+    FlatSphereCloud cloud;
+    cloud.spheres = spheres;
+    cloud.materialIndices = materialIndices;
+    for (size_t k = 0; k < materialCount; ++k)
+    {
+        cloud.materials.push_back(getMaterialIndex(materials[k]));
+    }
+    scene.clouds.push_back(cloud);
+}
+
+/**
+ * @brief addCloudLights Adds the lights among the spheres of clouds, which
+ * are numbered after every other sphere, so only once no more spheres
+ * will be added
+ */
+void SceneCompiler::addCloudLights()
+{
+    size_t first = scene.sphereX.size();
+    for (const FlatSphereCloud &cloud : scene.clouds)
+    {
+        bool hasLight = false;
+        for (uint32_t material : cloud.materials)
+        {
+            hasLight = hasLight || scene.materials[material].type == FLAT_LIGHT;
+        }
+        for (size_t k = 0; hasLight && k < cloud.spheres.count; ++k)
+        {
+            addLight(FLAT_SPHERE, first + k, cloud.materials[cloud.materialIndices[k]]);
+        }
+        first += cloud.spheres.count;
+    }
+}
+
+static CompiledSceneSection placeSection(uint64_t count, uint64_t recordSize, uint64_t &offset)
+{
+    CompiledSceneSection section;
+    offset = (offset + SECTION_ALIGNMENT - 1) / SECTION_ALIGNMENT * SECTION_ALIGNMENT;
+    section.offset = offset;
+    section.count = count;
+    offset += count * recordSize;
+    return section;
+}
+
+template <typename T>
+static CompiledSceneSection placeSection(const std::vector<T> &records, uint64_t &offset)
+{
+    return placeSection(records.size(), sizeof(T), offset);
+}
+
+template <typename T>
+static bool writeRecords(FILE *file, const T *records, size_t count)
+{
+    return count == 0 || fwrite(records, sizeof(T), count, file) == count;
+}
+
+template <typename T>
+static bool writeSection(FILE *file, const std::vector<T> &records, const CompiledSceneSection &section)
+{
+    static const char padding[SECTION_ALIGNMENT] = {0};
+    long position = ftell(file);
+    if (position < 0 || (uint64_t) position > section.offset ||
+            fwrite(padding, 1, section.offset - position, file) != section.offset - position)
+    {
+        return false;
+    }
+    return writeRecords(file, records.data(), records.size());
+}
+
+//Writes one coordinate of every sphere: those of the arrays, then those
+//of each cloud
+static bool writeSphereSection(FILE *file, const std::vector<float> &values, const std::vector<FlatSphereCloud> &clouds,
+                               const float * SphereArrays::*field, const CompiledSceneSection &section)
+{
+    bool written = writeSection(file, values, section);
+    for (size_t k = 0; k < clouds.size() && written; ++k)
+    {
+        written = writeRecords(file, clouds[k].spheres.*field, clouds[k].spheres.count);
+    }
+    return written;
+}
+
+//Writes the material of every sphere, mapping those of clouds to the
+//material table a block at a time
+static bool writeSphereMaterials(FILE *file, const std::vector<uint32_t> &materials, const std::vector<FlatSphereCloud> &clouds,
+                                 const CompiledSceneSection &section)
+{
+    bool written = writeSection(file, materials, section);
+    std::vector<uint32_t> block;
+    for (size_t k = 0; k < clouds.size() && written; ++k)
+    {
+        const FlatSphereCloud &cloud = clouds[k];
+        for (size_t first = 0; first < cloud.spheres.count && written; first += block.size())
+        {
+            block.resize(std::min(cloud.spheres.count - first, (size_t) 4096));
+            for (size_t m = 0; m < block.size(); ++m)
+            {
+                block[m] = cloud.materials[cloud.materialIndices[first + m]];
+            }
+            written = writeRecords(file, block.data(), block.size());
+        }
+    }
+    return written;
+}
+
+/**
+ * @brief write Writes the collected primitives as a compiled scene
+ * @param filename The file to write
+ * @param background The background colour of the scene
+ * @param cameraOptions The camera to store with the scene
+ * @return Whether the file was written
+ */
+bool SceneCompiler::write(const std::string &filename, const Vector3 &background, const CameraOptions &cameraOptions) const
+{
+    CompiledSceneHeader header = {};
+    memcpy(header.magic, COMPILED_SCENE_MAGIC, sizeof(header.magic));
+    header.version = COMPILED_SCENE_VERSION;
+    header.byteOrder = BYTE_ORDER_MARK;
+    header.headerSize = sizeof(CompiledSceneHeader);
+    header.background = background;
+    header.cameraPosition = cameraOptions.cameraPosition;
+    header.lookAt = cameraOptions.lookAt;
+    header.cameraRoll = cameraOptions.cameraRoll;
+    header.fieldOfView = cameraOptions.fieldOfView;
+    header.lensRadius = cameraOptions.lensRadius;
+    header.focusDistance = cameraOptions.focusDistance;
+
+    uint64_t offset = sizeof(CompiledSceneHeader);
+    header.materials = placeSection(scene.materials, offset);
+    header.planes = placeSection(scene.planes, offset);
+    header.rectangles = placeSection(scene.rectangles, offset);
+    header.triangles = placeSection(scene.triangles, offset);
+    size_t sphereCount = scene.getSphereCount();
+    header.sphereX = placeSection(sphereCount, sizeof(float), offset);
+    header.sphereY = placeSection(sphereCount, sizeof(float), offset);
+    header.sphereZ = placeSection(sphereCount, sizeof(float), offset);
+    header.sphereRadius = placeSection(sphereCount, sizeof(float), offset);
+    header.sphereMaterials = placeSection(sphereCount, sizeof(uint32_t), offset);
+
+    FILE *file = fopen(filename.c_str(), "wb");
+    if (!file)
+    {
+        return false;
+    }
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+            writeSection(file, scene.materials, header.materials) &&
+            writeSection(file, scene.planes, header.planes) &&
+            writeSection(file, scene.rectangles, header.rectangles) &&
+            writeSection(file, scene.triangles, header.triangles) &&
+            writeSphereSection(file, scene.sphereX, scene.clouds, &SphereArrays::x, header.sphereX) &&
+            writeSphereSection(file, scene.sphereY, scene.clouds, &SphereArrays::y, header.sphereY) &&
+            writeSphereSection(file, scene.sphereZ, scene.clouds, &SphereArrays::z, header.sphereZ) &&
+            writeSphereSection(file, scene.sphereRadius, scene.clouds, &SphereArrays::radius, header.sphereRadius) &&
+            writeSphereMaterials(file, scene.sphereMaterials, scene.clouds, header.sphereMaterials);
+    return fclose(file) == 0 && written;
+}
+
+template <typename T>
+static const T * getSection(const CompiledSceneHeader *header, const CompiledSceneSection &section)
+{
+    return (const T *) ((const char *) header + section.offset);
+}
+
+static inline uint32_t getRecordMaterial(const FlatPlane &plane)
+{
+    return plane.material;
+}
+
+static inline uint32_t getRecordMaterial(const FlatRectangle &rectangle)
+{
+    return rectangle.material;
+}
+
+static inline uint32_t getRecordMaterial(const FlatTriangle &triangle)
+{
+    return triangle.material;
+}
+
+static inline uint32_t getRecordMaterial(uint32_t sphereMaterial)
+{
+    return sphereMaterial;
+}
+
+/**
+ * @brief checkMaterials Checks that every primitive of a section refers
+ * to an entry of the material table, since they are looked up without
+ * any further checks while rendering, and lists the ones that are lights
+ * @return Whether every material index was valid
+ */
+template <typename T>
+static bool checkMaterials(const CompiledSceneHeader *header, const CompiledSceneSection &section,
+                           FlatPrimitiveType type, std::vector<FlatLight> &lights)
+{
+    const FlatMaterial *materials = getSection<FlatMaterial>(header, header->materials);
+    const T *records = getSection<T>(header, section);
+    for (uint64_t k = 0; k < section.count; ++k)
+    {
+        uint32_t material = getRecordMaterial(records[k]);
+        if (material >= header->materials.count)
+        {
+            return false;
+        }
+        if (materials[material].type == FLAT_LIGHT)
+        {
+            FlatLight light;
+            light.type = type;
+            light.index = (uint32_t) k;
+            lights.push_back(light);
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief takeScene Hands the primitives and materials added so far over
+ * to a FlatScene, leaving the compiler empty
+ */
+void SceneCompiler::takeScene(FlatScene &scene)
+{
+    addCloudLights();
+    std::swap(this->scene, scene);
+    this->scene = FlatScene();
+    materialIndices.clear();
+}
+
+size_t FlatScene::getSphereCount() const
+{
+    size_t count = sphereX.size();
+    for (const FlatSphereCloud &cloud : clouds)
+    {
+        count += cloud.spheres.count;
+    }
+    return count;
+}
+
+/**
+ * @brief getPrimitives Points at the primitives of the scene. They are
+ * invalidated by changing the scene. The spheres of clouds are not
+ * included.
+ */
+FlatPrimitives FlatScene::getPrimitives() const
+{
+    FlatPrimitives primitives;
+    primitives.planes = planes.data();
+    primitives.rectangles = rectangles.data();
+    primitives.triangles = triangles.data();
+    primitives.planeCount = planes.size();
+    primitives.rectangleCount = rectangles.size();
+    primitives.triangleCount = triangles.size();
+    primitives.spheres.x = sphereX.data();
+    primitives.spheres.y = sphereY.data();
+    primitives.spheres.z = sphereZ.data();
+    primitives.spheres.radius = sphereRadius.data();
+    primitives.spheres.count = sphereX.size();
+    primitives.sphereMaterials = sphereMaterials.data();
+    return primitives;
+}
+
+static inline Material * getFlatMaterialObject(Material * const *materials, uint32_t index)
+{
+    return materials ? materials[index] : NULL;
+}
+
+/**
+ * @brief hitFlatPrimitives Finds the closest primitive hit by a ray
+ * @param primitives The primitives to intersect
+ * @param materials The Material objects the primitives refer to, or null
+ * if only HitRecord::materialIndex is wanted
+ * @param r The ray
+ * @param minT The nearest distance along the ray to accept a hit
+ * @param maxT The furthest distance along the ray to accept a hit
+ * @param rec Receives the closest hit
+ * @return Whether any primitive was hit
+ */
+bool hitFlatPrimitives(const FlatPrimitives &primitives, Material * const *materials,
+                       const Ray &r, float minT, float maxT, HitRecord &rec)
+{
+    bool surfaceHit = false;
+    float closestObjectDistance = maxT;
+
+    for (size_t k = 0; k < primitives.planeCount; ++k)
+    {
+        const FlatPlane &plane = primitives.planes[k];
+        if (hitPlane(plane.point, plane.normal, getFlatMaterialObject(materials, plane.material), r, minT, closestObjectDistance, rec))
+        {
+            surfaceHit = true;
+            closestObjectDistance = rec.t;
+            rec.materialIndex = plane.material;
+        }
+    }
+    for (size_t k = 0; k < primitives.rectangleCount; ++k)
+    {
+        const FlatRectangle &rectangle = primitives.rectangles[k];
+        if (hitRectangle(rectangle.centre, rectangle.normal, rectangle.a, rectangle.b, rectangle.d,
+                         getFlatMaterialObject(materials, rectangle.material), r, minT, closestObjectDistance, rec))
+        {
+            surfaceHit = true;
+            closestObjectDistance = rec.t;
+            rec.materialIndex = rectangle.material;
+        }
+    }
+    for (size_t k = 0; k < primitives.triangleCount; ++k)
+    {
+        const FlatTriangle &triangle = primitives.triangles[k];
+        if (hitTriangle(triangle.a, triangle.b, triangle.c, getFlatMaterialObject(materials, triangle.material), r, minT, closestObjectDistance, rec))
+        {
+            surfaceHit = true;
+            closestObjectDistance = rec.t;
+            rec.materialIndex = triangle.material;
+        }
+    }
+
+    //Spheres are tested last, several at a time
+    float t;
+    size_t index;
+    if (hitSphereArrays(primitives.spheres, r, minT, closestObjectDistance, t, index))
+    {
+        fillSphereHit(primitives.spheres, index, r, t, rec);
+        rec.material = getFlatMaterialObject(materials, primitives.sphereMaterials[index]);
+        rec.materialIndex = primitives.sphereMaterials[index];
+        surfaceHit = true;
+    }
+
+    return surfaceHit;
+}
+
+/**
+ * @brief FlatSceneSurface Refers to the sections of a mapped compiled
+ * scene, which must have been checked by CompiledScene::open
+ * @param materials The Material objects of the material table
+ * @param lights The primitives that emit light
+ */
+FlatSceneSurface::FlatSceneSurface(const CompiledSceneHeader *header, Material * const *materials,
+                                   const std::vector<FlatLight> &lights)
+    : header(header), materials(materials), lights(lights)
+{
+    primitives.planes = getSection<FlatPlane>(header, header->planes);
+    primitives.rectangles = getSection<FlatRectangle>(header, header->rectangles);
+    primitives.triangles = getSection<FlatTriangle>(header, header->triangles);
+    primitives.planeCount = header->planes.count;
+    primitives.rectangleCount = header->rectangles.count;
+    primitives.triangleCount = header->triangles.count;
+    primitives.spheres.x = getSection<float>(header, header->sphereX);
+    primitives.spheres.y = getSection<float>(header, header->sphereY);
+    primitives.spheres.z = getSection<float>(header, header->sphereZ);
+    primitives.spheres.radius = getSection<float>(header, header->sphereRadius);
+    primitives.spheres.count = header->sphereX.count;
+    primitives.sphereMaterials = getSection<uint32_t>(header, header->sphereMaterials);
+}
+
+bool FlatSceneSurface::hitWithRay(const Ray r, const float minT, const float maxT, HitRecord &rec) const
+{
+    return hitFlatPrimitives(primitives, materials, r, minT, maxT, rec);
+}
+
+void FlatSceneSurface::flatten(SceneCompiler &compiler) const
+{
+    for (size_t k = 0; k < primitives.planeCount; ++k)
+    {
+        const FlatPlane &plane = primitives.planes[k];
+        compiler.addPlane(plane.point, plane.normal, materials[plane.material]);
+    }
+    const SphereArrays &spheres = primitives.spheres;
+    for (size_t k = 0; k < spheres.count; ++k)
+    {
+        compiler.addSphere(Vector3(spheres.x[k], spheres.y[k], spheres.z[k]), spheres.radius[k],
+                           materials[primitives.sphereMaterials[k]]);
+    }
+    for (size_t k = 0; k < primitives.rectangleCount; ++k)
+    {
+        const FlatRectangle &rectangle = primitives.rectangles[k];
+        compiler.addRectangle(rectangle.centre, rectangle.normal, rectangle.a, rectangle.b, rectangle.d,
+                              materials[rectangle.material]);
+    }
+    for (size_t k = 0; k < primitives.triangleCount; ++k)
+    {
+        const FlatTriangle &triangle = primitives.triangles[k];
+        compiler.addTriangle(triangle.a, triangle.b, triangle.c, materials[triangle.material]);
+    }
+}
+
+/**
+ * @brief getPrimitives The primitives, where they lie in the mapped file
+ */
+const FlatPrimitives & FlatSceneSurface::getPrimitives() const
+{
+    return primitives;
+}
+
+/**
+ * @brief getFlatMaterials The material table, where it lies in the
+ * mapped file
+ */
+const FlatMaterial * FlatSceneSurface::getFlatMaterials() const
+{
+    return getSection<FlatMaterial>(header, header->materials);
+}
+
+size_t FlatSceneSurface::getMaterialCount() const
+{
+    return header->materials.count;
+}
+
+/**
+ * @brief getLights The primitives that emit light, found when the
+ * compiled scene was opened
+ */
+const std::vector<FlatLight> & FlatSceneSurface::getLights() const
+{
+    return lights;
+}
+
+CompiledScene::CompiledScene()
+{
+    mapping = NULL;
+    mappingSize = 0;
+    header = NULL;
+    surface = NULL;
+}
+
+CompiledScene::~CompiledScene()
+{
+    close();
+}
+
+static bool isSectionValid(const CompiledSceneSection &section, size_t recordSize, size_t fileSize)
+{
+    return section.offset % 4 == 0 && section.offset <= fileSize &&
+            section.count <= (fileSize - section.offset) / recordSize;
+}
+
+/**
+ * @brief open Maps a compiled scene into memory. The header, the
+ * material types and the material index of every primitive are checked,
+ * the lights are listed and the material table is built; the primitives
+ * are used where they lie in the file.
+ * @param filename The compiled scene to open
+ * @param error Receives a description of the problem if opening fails
+ * @return Whether the scene was opened
+ */
+bool CompiledScene::open(const std::string &filename, std::string &error)
+{
+    close();
+
+    const char *data = NULL;
+    size_t size = 0;
+#ifdef HAVE_MMAP
+    int descriptor = ::open(filename.c_str(), O_RDONLY);
+    struct stat status;
+    if (descriptor < 0 || fstat(descriptor, &status) != 0)
+    {
+        if (descriptor >= 0)
+        {
+            ::close(descriptor);
+        }
+        error = "could not open " + filename;
+        return false;
+    }
+    size = status.st_size;
+    if (size > 0)
+    {
+        mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    }
+    ::close(descriptor);
+    if (mapping == MAP_FAILED || mapping == NULL)
+    {
+        mapping = NULL;
+        error = "could not map " + filename;
+        return false;
+    }
+    mappingSize = size;
+    data = (const char *) mapping;
+#else
+    FILE *file = fopen(filename.c_str(), "rb");
+    if (!file)
+    {
+        error = "could not open " + filename;
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    buffer.resize(size);
+    bool read = size == 0 || fread(buffer.data(), 1, size, file) == size;
+    fclose(file);
+    if (!read)
+    {
+        error = "could not read " + filename;
+        return false;
+    }
+    data = buffer.data();
+#endif
+
+    const CompiledSceneHeader *candidate = (const CompiledSceneHeader *) data;
+    if (size < sizeof(CompiledSceneHeader) || memcmp(candidate->magic, COMPILED_SCENE_MAGIC, sizeof(candidate->magic)) != 0)
+    {
+        error = filename + " is not a compiled scene";
+    }
+    else if (candidate->byteOrder != BYTE_ORDER_MARK)
+    {
+        error = filename + " was compiled on an incompatible machine";
+    }
+    else if (candidate->version != COMPILED_SCENE_VERSION)
+    {
+        error = filename + " was compiled for version " + std::to_string(candidate->version) +
+                " rather than " + std::to_string(COMPILED_SCENE_VERSION);
+    }
+    else if (candidate->headerSize != sizeof(CompiledSceneHeader))
+    {
+        error = filename + " was compiled on an incompatible machine";
+    }
+    else if (!isSectionValid(candidate->materials, sizeof(FlatMaterial), size) ||
+             !isSectionValid(candidate->planes, sizeof(FlatPlane), size) ||
+             !isSectionValid(candidate->rectangles, sizeof(FlatRectangle), size) ||
+             !isSectionValid(candidate->triangles, sizeof(FlatTriangle), size) ||
+             !isSectionValid(candidate->sphereX, sizeof(float), size) ||
+             !isSectionValid(candidate->sphereY, sizeof(float), size) ||
+             !isSectionValid(candidate->sphereZ, sizeof(float), size) ||
+             !isSectionValid(candidate->sphereRadius, sizeof(float), size) ||
+             !isSectionValid(candidate->sphereMaterials, sizeof(uint32_t), size) ||
+             candidate->sphereY.count != candidate->sphereX.count ||
+             candidate->sphereZ.count != candidate->sphereX.count ||
+             candidate->sphereRadius.count != candidate->sphereX.count ||
+             candidate->sphereMaterials.count != candidate->sphereX.count)
+    {
+        error = filename + " is truncated or corrupt";
+    }
+    else
+    {
+        header = candidate;
+    }
+
+    if (header)
+    {
+        const FlatMaterial *flatMaterials = getSection<FlatMaterial>(header, header->materials);
+        for (size_t k = 0; k < header->materials.count; ++k)
+        {
+            if (flatMaterials[k].type > FLAT_LIGHT)
+            {
+                error = filename + " has a material of unknown type " + std::to_string(flatMaterials[k].type);
+                header = NULL;
+                break;
+            }
+        }
+    }
+    if (header && (!checkMaterials<FlatPlane>(header, header->planes, FLAT_PLANE, lights) ||
+                   !checkMaterials<FlatRectangle>(header, header->rectangles, FLAT_RECTANGLE, lights) ||
+                   !checkMaterials<FlatTriangle>(header, header->triangles, FLAT_TRIANGLE, lights) ||
+                   !checkMaterials<uint32_t>(header, header->sphereMaterials, FLAT_SPHERE, lights)))
+    {
+        error = filename + " has a primitive with a material that is not in its material table";
+        header = NULL;
+    }
+
+    if (!header)
+    {
+        close();
+        return false;
+    }
+
+    const FlatMaterial *flatMaterials = getSection<FlatMaterial>(header, header->materials);
+    for (size_t k = 0; k < header->materials.count; ++k)
+    {
+        const FlatMaterial &flat = flatMaterials[k];
+        switch (flat.type)
+        {
+            case FLAT_DIFFUSE:
+                materials.push_back(new Diffuse(flat.colour));
+                break;
+            case FLAT_METAL:
+                materials.push_back(new Metal(flat.colour, flat.parameter));
+                break;
+            case FLAT_DIELECTRIC:
+                materials.push_back(new Dielectric(flat.parameter));
+                break;
+            case FLAT_LIGHT:
+                materials.push_back(new Light(flat.colour));
+                break;
+        }
+    }
+
+    surface = new FlatSceneSurface(header, materials.data(), lights);
+    return true;
+}
+
+void CompiledScene::close()
+{
+    delete surface;
+    surface = NULL;
+    for (Material *material : materials)
+    {
+        delete material;
+    }
+    materials.clear();
+    lights.clear();
+    header = NULL;
+
+#ifdef HAVE_MMAP
+    if (mapping)
+    {
+        munmap(mapping, mappingSize);
+    }
+#endif
+    mapping = NULL;
+    mappingSize = 0;
+    buffer.clear();
+}
+
+/**
+ * @brief addToScene Sets the background and camera from the compiled
+ * scene and adds its primitives to a scene as a single Surface
+ */
+void CompiledScene::addToScene(Scene &scene, CameraOptions &cameraOptions) const
+{
+    if (!header)
+    {
+        return;
+    }
+
+    scene.setBackground(header->background);
+    scene.addSurface(surface);
+    cameraOptions.cameraPosition = header->cameraPosition;
+    cameraOptions.lookAt = header->lookAt;
+    cameraOptions.cameraRoll = header->cameraRoll;
+    cameraOptions.fieldOfView = header->fieldOfView;
+    cameraOptions.lensRadius = header->lensRadius;
+    cameraOptions.focusDistance = header->focusDistance;
+}
+
+/**
+ * @brief writeCompiledScene Flattens a scene and writes it as a compiled
+ * scene
+ * @param filename The file to write
+ * @param scene The scene to compile
+ * @param cameraOptions The camera to store with the scene
+ * @return Whether the file was written
+ */
+bool writeCompiledScene(const std::string &filename, const Scene &scene, const CameraOptions &cameraOptions)
+{
+    SceneCompiler compiler;
+    for (Surface *surface : scene.getSurfaces())
+    {
+        surface->flatten(compiler);
+    }
+    return compiler.write(filename, scene.getBackground(), cameraOptions);
+}
+
+/**
+ * @brief isCompiledScene Checks whether a file starts like a compiled
+ * scene, so that it can be told apart from a text scene file
+ */
+bool isCompiledScene(const std::string &filename)
+{
+    char magic[sizeof(COMPILED_SCENE_MAGIC)];
+    FILE *file = fopen(filename.c_str(), "rb");
+    if (!file)
+    {
+        return false;
+    }
+    bool matches = fread(magic, 1, sizeof(magic), file) == sizeof(magic) &&
+            memcmp(magic, COMPILED_SCENE_MAGIC, sizeof(magic)) == 0;
+    fclose(file);
+    return matches;
+}
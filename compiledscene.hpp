@@ -0,0 +1,266 @@
+#ifndef COMPILEDSCENE_HPP
+#define COMPILEDSCENE_HPP
+
+#include "camera.hpp"
+#include "material.hpp"
+#include "spherecloud.hpp"
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * A compiled scene is a binary snapshot of a Scene and its CameraOptions
+ * that is memory-mapped and rendered in place. Every transform is baked
+ * into the primitives and each primitive type is stored as one flat
+ * array of plain records, so loading involves no parsing, no allocation
+ * per surface and no pointer fixups. Sections are located by byte
+ * offsets from the start of the file and materials are referred to by
+ * their index in the material table, so the layout does not depend on
+ * where the file is mapped.
+ *
+ * The file is a CompiledSceneHeader followed by the material, plane,
+ * rectangle and triangle sections and the x, y, z, radius and material
+ * sections of the spheres, each aligned to 16 bytes. Spheres are stored
+ * one array per field, as SphereArrays, so they are tested in place.
+ * Files are written in the byte order of the machine that compiled them
+ * and are rejected by machines with a different one.
+ */
+
+static const uint32_t COMPILED_SCENE_VERSION = 2;
+
+enum FlatMaterialType
+{
+    FLAT_DIFFUSE,
+    FLAT_METAL,
+    FLAT_DIELECTRIC,
+    FLAT_LIGHT
+};
+
+struct FlatMaterial
+{
+    uint32_t type;
+    Vector3 colour;
+
+    //The fuzz of a metal or the refractive index of a dielectric
+    float parameter;
+};
+
+struct FlatPlane
+{
+    Vector3 point, normal;
+    uint32_t material;
+};
+
+struct FlatRectangle
+{
+    Vector3 centre, normal;
+    Vector3 a, b, d;
+    uint32_t material;
+};
+
+struct FlatTriangle
+{
+    Vector3 a, b, c;
+    uint32_t material;
+};
+
+enum FlatPrimitiveType
+{
+    FLAT_PLANE,
+    FLAT_SPHERE,
+    FLAT_RECTANGLE,
+    FLAT_TRIANGLE
+};
+
+/**
+ * An emissive primitive of a flat scene
+ * @brief The FlatLight struct
+ */
+struct FlatLight
+{
+    FlatPrimitiveType type;
+    uint32_t index;
+};
+
+/**
+ * The flat primitive arrays of a scene, wherever they are stored
+ * @brief The FlatPrimitives struct
+ */
+struct FlatPrimitives
+{
+    const FlatPlane *planes;
+    const FlatRectangle *rectangles;
+    const FlatTriangle *triangles;
+    size_t planeCount, rectangleCount, triangleCount;
+
+    SphereArrays spheres;
+    const uint32_t *sphereMaterials;
+};
+
+/**
+ * The spheres of a SphereCloud, left where the cloud keeps them. The
+ * cloud refers to its materials by 16-bit indices into a table of its
+ * own, which materials maps to the material table of the scene.
+ * @brief The FlatSphereCloud struct
+ */
+struct FlatSphereCloud
+{
+    SphereArrays spheres;
+    const uint16_t *materialIndices;
+    std::vector<uint32_t> materials;
+};
+
+/**
+ * The flat arrays of a scene, owned, apart from the spheres of clouds.
+ * SceneCompiler fills them and a RenderScene takes them over without
+ * copying. Spheres are numbered with the spheres of the arrays first,
+ * then those of each cloud in turn, which is their order in a compiled
+ * scene.
+ * @brief The FlatScene struct
+ */
+struct FlatScene
+{
+    std::vector<FlatMaterial> materials;
+    std::vector<FlatPlane> planes;
+    std::vector<FlatRectangle> rectangles;
+    std::vector<FlatTriangle> triangles;
+    std::vector<float> sphereX, sphereY, sphereZ, sphereRadius;
+    std::vector<uint32_t> sphereMaterials;
+    std::vector<FlatSphereCloud> clouds;
+    std::vector<FlatLight> lights;
+
+    FlatPrimitives getPrimitives() const;
+    size_t getSphereCount() const;
+};
+
+bool hitFlatPrimitives(const FlatPrimitives &primitives, Material * const *materials,
+                       const Ray &r, float minT, float maxT, HitRecord &rec);
+
+struct CompiledSceneSection
+{
+    uint64_t offset;
+    uint64_t count;
+};
+
+struct CompiledSceneHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t headerSize;
+
+    Vector3 background;
+    Vector3 cameraPosition, lookAt;
+    float cameraRoll, fieldOfView, lensRadius, focusDistance;
+
+    CompiledSceneSection materials, planes, rectangles, triangles;
+    CompiledSceneSection sphereX, sphereY, sphereZ, sphereRadius, sphereMaterials;
+};
+
+/**
+ * Collects the flat primitives of a Scene as each Surface flattens
+ * itself, then writes them out as a compiled scene. Transform surfaces
+ * push their transform for the duration of flattening the surface they
+ * wrap, so primitives are added in world space.
+ * @brief The SceneCompiler class
+ */
+class SceneCompiler
+{
+    public:
+        enum Axis { X_AXIS, Y_AXIS, Z_AXIS };
+
+        SceneCompiler();
+
+        void addPlane(Vector3 point, Vector3 normal, Material *material);
+        void addSphere(Vector3 centre, float radius, Material *material);
+        void addRectangle(Vector3 centre, Vector3 normal, Vector3 a, Vector3 b, Vector3 d, Material *material);
+        void addTriangle(Vector3 a, Vector3 b, Vector3 c, Material *material);
+        void addSphereCloud(const SphereArrays &spheres, const uint16_t *materialIndices,
+                            Material * const *materials, size_t materialCount);
+
+        void pushRotation(Axis axis, float theta);
+        void pushTranslation(Vector3 offset);
+        void popTransform();
+
+        bool write(const std::string &filename, const Vector3 &background, const CameraOptions &cameraOptions) const;
+        void takeScene(FlatScene &scene);
+
+    private:
+        struct Transform
+        {
+            bool isRotation;
+            Axis axis;
+            float theta;
+            Vector3 offset;
+        };
+
+        std::vector<Transform> transforms;
+        std::unordered_map<Material *, uint32_t> materialIndices;
+        FlatScene scene;
+
+        uint32_t getMaterialIndex(Material *material);
+        void addLight(FlatPrimitiveType type, size_t index, uint32_t material);
+        void addCloudLights();
+        Vector3 transformPoint(Vector3 point) const;
+        Vector3 transformDirection(Vector3 direction) const;
+};
+
+/**
+ * Intersects rays with the flat primitive arrays of a compiled scene
+ * directly, without any Surface objects for the individual primitives
+ * @brief The FlatSceneSurface class
+ */
+class FlatSceneSurface : public Surface
+{
+    public:
+        FlatSceneSurface(const CompiledSceneHeader *header, Material * const *materials,
+                         const std::vector<FlatLight> &lights);
+
+        virtual bool hitWithRay(const Ray r, const float minT, const float maxT, HitRecord &rec) const;
+        virtual void flatten(SceneCompiler &compiler) const;
+
+        const FlatPrimitives & getPrimitives() const;
+        const FlatMaterial * getFlatMaterials() const;
+        size_t getMaterialCount() const;
+        const std::vector<FlatLight> & getLights() const;
+
+    private:
+        const CompiledSceneHeader *header;
+        FlatPrimitives primitives;
+        Material * const *materials;
+        const std::vector<FlatLight> &lights;
+};
+
+/**
+ * A compiled scene file mapped into memory. The scene it is added to
+ * refers to the mapping, so it must outlive any renders of that scene.
+ * @brief The CompiledScene class
+ */
+class CompiledScene
+{
+    public:
+        CompiledScene();
+        ~CompiledScene();
+
+        bool open(const std::string &filename, std::string &error);
+        void close();
+        void addToScene(Scene &scene, CameraOptions &cameraOptions) const;
+
+    private:
+        void *mapping;
+        size_t mappingSize;
+        std::vector<char> buffer;
+        const CompiledSceneHeader *header;
+        std::vector<Material *> materials;
+        std::vector<FlatLight> lights;
+        FlatSceneSurface *surface;
+
+        CompiledScene(const CompiledScene &) = delete;
+        CompiledScene & operator=(const CompiledScene &) = delete;
+};
+
+bool writeCompiledScene(const std::string &filename, const Scene &scene, const CameraOptions &cameraOptions);
+bool isCompiledScene(const std::string &filename);
+
+#endif // COMPILEDSCENE_HPP
@@ -0,0 +1,62 @@
+#include "cpudispatch.hpp"
+
+static const char *CPU_LEVEL_NAMES[] = {"baseline", "sse4.2", "avx2", "avx512"};
+
+static CpuLevel cpuLevelLimit = CPU_LEVEL_AVX512;
+
+/**
+ * @brief detectCpuLevel Asks the cpu, through cpuid, which instructions
+ * it supports
+ */
+static CpuLevel detectCpuLevel()
+{
+#ifdef RAYTRACER_CPU_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+    {
+        return CPU_LEVEL_AVX512;
+    }
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return CPU_LEVEL_AVX2;
+    }
+    if (__builtin_cpu_supports("sse4.2"))
+    {
+        return CPU_LEVEL_SSE42;
+    }
+#endif
+    return CPU_LEVEL_BASELINE;
+}
+
+CpuLevel getCpuLevel()
+{
+    static const CpuLevel detected = detectCpuLevel();
+    return detected < cpuLevelLimit ? detected : cpuLevelLimit;
+}
+
+void setCpuLevelLimit(CpuLevel limit)
+{
+    cpuLevelLimit = limit;
+}
+
+const char * getCpuLevelName(CpuLevel level)
+{
+    return CPU_LEVEL_NAMES[level];
+}
+
+/**
+ * @brief parseCpuLevel Reads a level by the name getCpuLevelName gives it
+ * @return Whether the name was a level
+ */
+bool parseCpuLevel(const std::string &name, CpuLevel &level)
+{
+    for (int k = CPU_LEVEL_BASELINE; k <= CPU_LEVEL_AVX512; ++k)
+    {
+        if (name == CPU_LEVEL_NAMES[k])
+        {
+            level = (CpuLevel) k;
+            return true;
+        }
+    }
+    return false;
+}
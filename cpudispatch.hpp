@@ -0,0 +1,50 @@
+#ifndef CPUDISPATCH_HPP
+#define CPUDISPATCH_HPP
+
+#include <string>
+
+/*
+ * The hot kernels are compiled once for each of these instruction set
+ * levels, and the best one the cpu supports is picked when they are
+ * first used. One binary therefore runs the baseline x86-64 code on old
+ * machines and AVX2 or AVX-512 code on new ones, without building with
+ * architecture flags.
+ */
+enum CpuLevel
+{
+    CPU_LEVEL_BASELINE,
+    CPU_LEVEL_SSE42,
+    CPU_LEVEL_AVX2,
+    CPU_LEVEL_AVX512
+};
+
+/**
+ * @brief getCpuLevel The level the kernels use: the highest the cpu
+ * supports, lowered to any limit given to setCpuLevelLimit
+ */
+CpuLevel getCpuLevel();
+
+/**
+ * @brief setCpuLevelLimit Stops the kernels using instructions above a
+ * level, to compare the levels on one machine. This must be called
+ * before any kernel runs.
+ */
+void setCpuLevelLimit(CpuLevel limit);
+
+const char * getCpuLevelName(CpuLevel level);
+bool parseCpuLevel(const std::string &name, CpuLevel &level);
+
+//Kernels for the higher levels are written as functions with these
+//attributes, which may use the level's intrinsics and are vectorised
+//for it. Code they call is only compiled for the level if it is inlined.
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define RAYTRACER_CPU_DISPATCH
+#define TARGET_SSE42 __attribute__((target("sse4.2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_AVX512 __attribute__((target("avx512f")))
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define ALWAYS_INLINE inline
+#endif
+
+#endif // CPUDISPATCH_HPP
@@ -0,0 +1,330 @@
+#include "denoiser.hpp"
+#include "cpudispatch.hpp"
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+DenoiseOptions::DenoiseOptions()
+{
+    iterations = 5;
+    colourSigma = 0.3;
+    normalSigma = 0.1;
+    depthSigma = 0.2;
+    albedoSigma = 0.1;
+}
+
+/**
+ * The framebuffer split into one plane per channel so that the filter
+ * loops run over contiguous floats and vectorise
+ * @brief The Planes struct
+ */
+struct Planes
+{
+    public:
+        std::vector<float> r, g, b;
+
+        Planes(size_t size)
+            : r(size), g(size), b(size)
+        {
+        }
+};
+
+/**
+ * @brief expNegative Approximates expf(-x) for x >= 0, to about 2e-6
+ * relative error, with arithmetic that vectorises where expf does not.
+ * exp(-x) = 2^-t for t = x*log2(e), split into 2^-n for the nearest
+ * integer n, built in the exponent bits, and a polynomial for the rest.
+ * Arguments past 126/log2(e), and NaN, give 2^-126.
+ */
+static ALWAYS_INLINE float expNegative(float x)
+{
+    float t = x * 1.44269504f;
+    t = t < 126 ? t : 126;
+    int n = (int) (t + 0.5f);
+    float r = (n - t) * 0.693147181f;
+    float p = 1 + r*(1 + r*(0.5f + r*(1.0f/6 + r*(1.0f/24 + r*(1.0f/120)))));
+    int bits = (127 - n) << 23;
+    float scale;
+    memcpy(&scale, &bits, sizeof(scale));
+    return p * scale;
+}
+
+/**
+ * The rows one tap of the filter reads and the sums it adds to, all
+ * starting at the first column whose tap lands inside the image
+ * @brief The TapRows struct
+ */
+struct TapRows
+{
+    public:
+        const float *centreR, *centreG, *centreB;
+        const float *tapR, *tapG, *tapB;
+        const float *centreNormalX, *centreNormalY, *centreNormalZ;
+        const float *tapNormalX, *tapNormalY, *tapNormalZ;
+        const float *centreDepth, *tapDepth;
+        const float *centreAlbedo, *tapAlbedo;
+        float *sumR, *sumG, *sumB, *sumWeight;
+        int count;
+};
+
+/**
+ * The factors each squared guide difference is scaled by before it is
+ * turned into a weight
+ * @brief The TapScales struct
+ */
+struct TapScales
+{
+    public:
+        float kernelWeight;
+        float colour, normal, depth, albedo;
+};
+
+/**
+ * @brief addTap Adds one tap to the sums of a row. This is inlined into
+ * a kernel for each instruction set level, like the tonemap kernels.
+ */
+static ALWAYS_INLINE void addTap(const TapRows &rows, const TapScales &scales)
+{
+    const float *cr = rows.centreR, *cg = rows.centreG, *cb = rows.centreB;
+    const float *tr = rows.tapR, *tg = rows.tapG, *tb = rows.tapB;
+    const float *cnx = rows.centreNormalX, *cny = rows.centreNormalY, *cnz = rows.centreNormalZ;
+    const float *tnx = rows.tapNormalX, *tny = rows.tapNormalY, *tnz = rows.tapNormalZ;
+    const float *cz = rows.centreDepth, *tz = rows.tapDepth;
+    const float *ca = rows.centreAlbedo, *ta = rows.tapAlbedo;
+    float *sr = rows.sumR, *sg = rows.sumG, *sb = rows.sumB, *sw = rows.sumWeight;
+    const float kernelWeight = scales.kernelWeight;
+    const float colourScale = scales.colour, normalScale = scales.normal;
+    const float depthScale = scales.depth, albedoScale = scales.albedo;
+
+#pragma omp simd
+    for (int x = 0; x < rows.count; ++x)
+    {
+        float dr = cr[x] - tr[x], dg = cg[x] - tg[x], db = cb[x] - tb[x];
+        float dnx = cnx[x] - tnx[x], dny = cny[x] - tny[x], dnz = cnz[x] - tnz[x];
+        float dz = cz[x] - tz[x];
+        float da = ca[x] - ta[x];
+        float exponent = (dr*dr + dg*dg + db*db) * colourScale +
+                (dnx*dnx + dny*dny + dnz*dnz) * normalScale +
+                (dz < 0 ? -dz : dz) * depthScale +
+                da*da * albedoScale;
+        float weight = kernelWeight * expNegative(exponent);
+        sr[x] += weight * tr[x];
+        sg[x] += weight * tg[x];
+        sb[x] += weight * tb[x];
+        sw[x] += weight;
+    }
+}
+
+typedef void (*AddTapFunction)(const TapRows &rows, const TapScales &scales);
+
+static void addTapBaseline(const TapRows &rows, const TapScales &scales)
+{
+    addTap(rows, scales);
+}
+
+#ifdef RAYTRACER_CPU_DISPATCH
+TARGET_SSE42 static void addTapSse42(const TapRows &rows, const TapScales &scales)
+{
+    addTap(rows, scales);
+}
+
+TARGET_AVX2 static void addTapAvx2(const TapRows &rows, const TapScales &scales)
+{
+    addTap(rows, scales);
+}
+
+TARGET_AVX512 static void addTapAvx512(const TapRows &rows, const TapScales &scales)
+{
+    addTap(rows, scales);
+}
+#endif
+
+static AddTapFunction selectAddTap()
+{
+#ifdef RAYTRACER_CPU_DISPATCH
+    switch (getCpuLevel())
+    {
+        case CPU_LEVEL_AVX512:
+            return addTapAvx512;
+        case CPU_LEVEL_AVX2:
+            return addTapAvx2;
+        case CPU_LEVEL_SSE42:
+            return addTapSse42;
+        default:
+            break;
+    }
+#endif
+    return addTapBaseline;
+}
+
+/**
+ * @brief filterPass Runs one pass of the edge-avoiding a-trous wavelet
+ * filter: a 5x5 B-spline kernel whose taps are step pixels apart, with
+ * each tap weighted down by how much its colour, normal, depth and
+ * albedo differ from the centre pixel
+ */
+static void filterPass(const Planes &in, Planes &out, const Planes &normal, const Planes &guide,
+                       int width, int height, int step, const DenoiseOptions &options, float colourSigma)
+{
+    static const float kernel[] = { 1.0f/16, 1.0f/4, 3.0f/8, 1.0f/4, 1.0f/16 };
+    static const AddTapFunction addTapToRow = selectAddTap();
+
+    TapScales scales;
+    scales.kernelWeight = 0;
+    scales.colour = 1 / (colourSigma * colourSigma);
+    scales.normal = 1 / (options.normalSigma * options.normalSigma);
+    scales.depth = 1 / options.depthSigma;
+    scales.albedo = 1 / (options.albedoSigma * options.albedoSigma);
+
+    //guide holds the normalised depth in r and the albedo luminance in g.
+    //The albedo colour itself is divided out of the radiance, so its
+    //luminance is all that is needed to find material boundaries.
+    const float *depth = guide.r.data();
+    const float *albedo = guide.g.data();
+
+#pragma omp parallel
+    {
+        std::vector<float> sumR(width), sumG(width), sumB(width), sumWeight(width);
+        TapScales tapScales = scales;
+
+#pragma omp for schedule(static)
+        for (int y = 0; y < height; ++y)
+        {
+            std::fill(sumR.begin(), sumR.end(), 0.0f);
+            std::fill(sumG.begin(), sumG.end(), 0.0f);
+            std::fill(sumB.begin(), sumB.end(), 0.0f);
+            std::fill(sumWeight.begin(), sumWeight.end(), 0.0f);
+
+            const size_t centreRow = y * (size_t) width;
+            for (int ky = -2; ky <= 2; ++ky)
+            {
+                int ty = y + ky*step;
+                if (ty < 0 || ty >= height)
+                {
+                    continue;
+                }
+                const size_t tapRow = ty * (size_t) width;
+
+                for (int kx = -2; kx <= 2; ++kx)
+                {
+                    const int dx = kx*step;
+
+                    //Only the columns whose tap lands inside the image, so
+                    //every pointer starts at a column of the image
+                    const int first = std::max(0, -dx);
+                    const int last = std::min(width, width - dx);
+                    if (first >= last)
+                    {
+                        continue;
+                    }
+                    const size_t centre = centreRow + first;
+                    const size_t tap = tapRow + first + dx;
+
+                    TapRows rows;
+                    rows.centreR = &in.r[centre];
+                    rows.centreG = &in.g[centre];
+                    rows.centreB = &in.b[centre];
+                    rows.tapR = &in.r[tap];
+                    rows.tapG = &in.g[tap];
+                    rows.tapB = &in.b[tap];
+                    rows.centreNormalX = &normal.r[centre];
+                    rows.centreNormalY = &normal.g[centre];
+                    rows.centreNormalZ = &normal.b[centre];
+                    rows.tapNormalX = &normal.r[tap];
+                    rows.tapNormalY = &normal.g[tap];
+                    rows.tapNormalZ = &normal.b[tap];
+                    rows.centreDepth = &depth[centre];
+                    rows.tapDepth = &depth[tap];
+                    rows.centreAlbedo = &albedo[centre];
+                    rows.tapAlbedo = &albedo[tap];
+                    rows.sumR = &sumR[first];
+                    rows.sumG = &sumG[first];
+                    rows.sumB = &sumB[first];
+                    rows.sumWeight = &sumWeight[first];
+                    rows.count = last - first;
+
+                    tapScales.kernelWeight = kernel[ky+2] * kernel[kx+2];
+                    addTapToRow(rows, tapScales);
+                }
+            }
+
+            //The centre tap always has full weight, so sumWeight > 0
+            for (int x = 0; x < width; ++x)
+            {
+                out.r[centreRow + x] = sumR[x] / sumWeight[x];
+                out.g[centreRow + x] = sumG[x] / sumWeight[x];
+                out.b[centreRow + x] = sumB[x] / sumWeight[x];
+            }
+        }
+    }
+}
+
+/**
+ * @brief denoise Removes Monte Carlo noise from a render with an
+ * edge-avoiding a-trous wavelet filter guided by the AOVs. The colour
+ * is divided by the albedo first so that texture and material colour
+ * are not blurred, and multiplied back afterwards.
+ * @param framebuffer The render to denoise in place. It must have AOVs.
+ * @param options How strongly to filter
+ * @return Whether the framebuffer could be denoised
+ */
+bool denoise(Framebuffer &framebuffer, const DenoiseOptions &options)
+{
+    if (!framebuffer.hasAovs())
+    {
+        return false;
+    }
+
+    const int width = framebuffer.getWidth(), height = framebuffer.getHeight();
+    const size_t size = width * (size_t) height;
+    Vector3 *colour = framebuffer.getColour();
+    const Vector3 *normals = framebuffer.getNormal();
+    const Vector3 *albedos = framebuffer.getAlbedo();
+    const float *depths = framebuffer.getDepth();
+
+    //Depth differences are judged relative to the depth range of the image
+    float maxDepth = 0;
+    for (size_t k = 0; k < size; ++k)
+    {
+        maxDepth = std::max(maxDepth, depths[k]);
+    }
+    float depthNormaliser = maxDepth > 0 ? 1 / maxDepth : 0;
+
+    Planes current(size), next(size), normal(size), guide(size);
+
+#pragma omp parallel for schedule(static)
+    for (long k = 0; k < (long) size; ++k)
+    {
+        Vector3 a = albedos[k];
+        current.r[k] = a.x > 0.001f ? colour[k].x / a.x : colour[k].x;
+        current.g[k] = a.y > 0.001f ? colour[k].y / a.y : colour[k].y;
+        current.b[k] = a.z > 0.001f ? colour[k].z / a.z : colour[k].z;
+        normal.r[k] = normals[k].x;
+        normal.g[k] = normals[k].y;
+        normal.b[k] = normals[k].z;
+        guide.r[k] = depths[k] * depthNormaliser;
+        guide.g[k] = 0.2126f*a.x + 0.7152f*a.y + 0.0722f*a.z;
+    }
+
+    float colourSigma = options.colourSigma;
+    for (int i = 0; i < options.iterations; ++i)
+    {
+        filterPass(current, next, normal, guide, width, height, 1 << i, options, colourSigma);
+        std::swap(current, next);
+
+        //Later passes average over wider areas that are already smooth,
+        //so they only need to tolerate smaller colour differences
+        colourSigma *= 0.5f;
+    }
+
+#pragma omp parallel for schedule(static)
+    for (long k = 0; k < (long) size; ++k)
+    {
+        Vector3 a = albedos[k];
+        colour[k].x = a.x > 0.001f ? current.r[k] * a.x : current.r[k];
+        colour[k].y = a.y > 0.001f ? current.g[k] * a.y : current.g[k];
+        colour[k].z = a.z > 0.001f ? current.b[k] * a.z : current.b[k];
+    }
+    return true;
+}
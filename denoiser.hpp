@@ -0,0 +1,24 @@
+#ifndef DENOISER_HPP
+#define DENOISER_HPP
+
+#include "framebuffer.hpp"
+
+class DenoiseOptions
+{
+    public:
+        //Number of a-trous passes. Pass i samples every 2^i pixels, so
+        //five passes cover a 125x125 pixel footprint.
+        int iterations;
+
+        //How quickly the filter stops at differences in each guide
+        float colourSigma;
+        float normalSigma;
+        float depthSigma;
+        float albedoSigma;
+
+        DenoiseOptions();
+};
+
+bool denoise(Framebuffer &framebuffer, const DenoiseOptions &options);
+
+#endif // DENOISER_HPP
@@ -0,0 +1,129 @@
+#include "framebuffer.hpp"
+#include <new>
+#include <stddef.h>
+
+//Storage is deliberately left uninitialised so that its pages are
+//first touched (and placed on a NUMA node) by the render thread that
+//writes them
+template <typename T>
+static T * allocatePixels(int width, int height)
+{
+    return static_cast<T *>(::operator new(sizeof(T) * width * (size_t) height));
+}
+
+Framebuffer::Framebuffer(int width, int height)
+    : Framebuffer(width, height, false)
+{
+}
+
+Framebuffer::Framebuffer(int width, int height, bool hasAovs)
+    : Framebuffer(width, height, hasAovs, false)
+{
+}
+
+/**
+ * @brief Framebuffer Allocates storage for width*height pixels
+ * @param width The number of horizontal pixels
+ * @param height The number of vertical pixels
+ * @param hasAovs Whether to allocate the depth, normal, albedo and
+ * sample count buffers as well as the colour buffer
+ * @param hasCost Whether to allocate the buffers recording the time
+ * spent on and rays traced for each pixel
+ */
+Framebuffer::Framebuffer(int width, int height, bool hasAovs, bool hasCost)
+{
+    this->width = width;
+    this->height = height;
+    colour = allocatePixels<Vector3>(width, height);
+    depth = hasAovs ? allocatePixels<float>(width, height) : NULL;
+    normal = hasAovs ? allocatePixels<Vector3>(width, height) : NULL;
+    albedo = hasAovs ? allocatePixels<Vector3>(width, height) : NULL;
+    sampleCount = hasAovs ? allocatePixels<float>(width, height) : NULL;
+    time = hasCost ? allocatePixels<float>(width, height) : NULL;
+    rayCount = hasCost ? allocatePixels<float>(width, height) : NULL;
+}
+
+Framebuffer::~Framebuffer()
+{
+    ::operator delete(colour);
+    ::operator delete(depth);
+    ::operator delete(normal);
+    ::operator delete(albedo);
+    ::operator delete(sampleCount);
+    ::operator delete(time);
+    ::operator delete(rayCount);
+}
+
+int Framebuffer::getWidth() const
+{
+    return width;
+}
+
+int Framebuffer::getHeight() const
+{
+    return height;
+}
+
+bool Framebuffer::hasAovs() const
+{
+    return depth != NULL;
+}
+
+bool Framebuffer::hasCost() const
+{
+    return time != NULL;
+}
+
+FramebufferRow Framebuffer::getRow(int j)
+{
+    size_t offset = j * (size_t) width;
+    FramebufferRow row;
+    row.colour = colour + offset;
+    row.depth = depth ? depth + offset : NULL;
+    row.normal = normal ? normal + offset : NULL;
+    row.albedo = albedo ? albedo + offset : NULL;
+    row.sampleCount = sampleCount ? sampleCount + offset : NULL;
+    row.time = time ? time + offset : NULL;
+    row.rayCount = rayCount ? rayCount + offset : NULL;
+    return row;
+}
+
+Vector3 * Framebuffer::getColour()
+{
+    return colour;
+}
+
+const Vector3 * Framebuffer::getColour() const
+{
+    return colour;
+}
+
+const float * Framebuffer::getDepth() const
+{
+    return depth;
+}
+
+const Vector3 * Framebuffer::getNormal() const
+{
+    return normal;
+}
+
+const Vector3 * Framebuffer::getAlbedo() const
+{
+    return albedo;
+}
+
+const float * Framebuffer::getSampleCount() const
+{
+    return sampleCount;
+}
+
+const float * Framebuffer::getTime() const
+{
+    return time;
+}
+
+const float * Framebuffer::getRayCount() const
+{
+    return rayCount;
+}
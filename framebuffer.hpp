@@ -0,0 +1,69 @@
+#ifndef FRAMEBUFFER_HPP
+#define FRAMEBUFFER_HPP
+
+#include "vector3.hpp"
+
+/**
+ * Pointers to one row of each buffer of a Framebuffer. The AOV
+ * pointers are null when the framebuffer has no AOVs.
+ * @brief The FramebufferRow struct
+ */
+struct FramebufferRow
+{
+    public:
+        Vector3 *colour;
+        float *depth;
+        Vector3 *normal;
+        Vector3 *albedo;
+        float *sampleCount;
+
+        //The cost of each pixel, or null when it is not being recorded
+        float *time;
+        float *rayCount;
+};
+
+/**
+ * Stores the linear radiance of every pixel of a rendered image,
+ * before any tonemapping or quantisation, and optionally arbitrary
+ * output variables (AOVs) describing the first surface seen through
+ * each pixel, and the cost of rendering each pixel
+ * @brief The Framebuffer class
+ */
+class Framebuffer
+{
+    public:
+        Framebuffer(int width, int height);
+        Framebuffer(int width, int height, bool hasAovs);
+        Framebuffer(int width, int height, bool hasAovs, bool hasCost);
+        ~Framebuffer();
+
+        int getWidth() const;
+        int getHeight() const;
+        bool hasAovs() const;
+        bool hasCost() const;
+        FramebufferRow getRow(int j);
+
+        Vector3 * getColour();
+        const Vector3 * getColour() const;
+        const float * getDepth() const;
+        const Vector3 * getNormal() const;
+        const Vector3 * getAlbedo() const;
+        const float * getSampleCount() const;
+        const float * getTime() const;
+        const float * getRayCount() const;
+
+    private:
+        int width, height;
+        Vector3 *colour;
+        float *depth;
+        Vector3 *normal;
+        Vector3 *albedo;
+        float *sampleCount;
+        float *time;
+        float *rayCount;
+
+        Framebuffer(const Framebuffer &) = delete;
+        Framebuffer & operator=(const Framebuffer &) = delete;
+};
+
+#endif // FRAMEBUFFER_HPP
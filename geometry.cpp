@@ -1,23 +1,24 @@
 #include "geometry.hpp"
-#include <random>
+#include <math.h>
 
-Vector3 getRandomPointOnUnitDisc()
+Vector3 getRandomPointOnUnitDisc(Sampler &sampler)
 {
-    float r = rand() / ((float) RAND_MAX);
-    float theta = 2*M_PI*(rand() / ((float) RAND_MAX+1));
+    float r = sampler.getFloat();
+    float theta = 2*M_PI*sampler.getFloat();
     return Vector3(sqrt(r)*cos(theta), sqrt(r)*sin(theta), 0);
 }
 
-Vector3 getRandomPointOnUnitSphere()
+Vector3 getRandomPointOnUnitSphere(Sampler &sampler)
 {
     Vector3 p;
     do
     {
-        p = Vector3(
-                    2 * (rand() / ((float) RAND_MAX+1)) - 1,
-                    2 * (rand() / ((float) RAND_MAX+1)) - 1,
-                    2 * (rand() / ((float) RAND_MAX+1)) - 1
-                );
+        //Separate statements, since the order in which function
+        //arguments are evaluated is unspecified
+        float x = 2 * sampler.getFloat() - 1;
+        float y = 2 * sampler.getFloat() - 1;
+        float z = 2 * sampler.getFloat() - 1;
+        p = Vector3(x, y, z);
 
     } while (p.isZeroVector());
     return p.getUnitVector();
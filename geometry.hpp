@@ -2,8 +2,9 @@
 #define GEOMETRY_HPP
 
 #include "vector3.hpp"
+#include "sampler.hpp"
 
-Vector3 getRandomPointOnUnitDisc();
-Vector3 getRandomPointOnUnitSphere();
+Vector3 getRandomPointOnUnitDisc(Sampler &sampler);
+Vector3 getRandomPointOnUnitSphere(Sampler &sampler);
 
 #endif // GEOMETRY_HPP
@@ -0,0 +1,616 @@
+#include "hdrimage.hpp"
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+
+static bool isLittleEndian()
+{
+    uint16_t value = 1;
+    unsigned char byte;
+    memcpy(&byte, &value, 1);
+    return byte == 1;
+}
+
+/**
+ * @brief getRemainingBytes Measures how much of an open file is left to
+ * read, so that sizes read from a header can be checked before anything
+ * is allocated for them
+ */
+static uint64_t getRemainingBytes(FILE *file)
+{
+    long position = ftell(file);
+    if (position < 0 || fseek(file, 0, SEEK_END) != 0)
+    {
+        return 0;
+    }
+    long end = ftell(file);
+    fseek(file, position, SEEK_SET);
+    return end > position ? (uint64_t) (end - position) : 0;
+}
+
+static uint32_t getUint32(const unsigned char *bytes)
+{
+    return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t) bytes[3] << 24);
+}
+
+static uint64_t getUint64(const unsigned char *bytes)
+{
+    return getUint32(bytes) | ((uint64_t) getUint32(bytes + 4) << 32);
+}
+
+static float getFloat(const unsigned char *bytes)
+{
+    uint32_t bits = getUint32(bytes);
+    float value;
+    memcpy(&value, &bits, 4);
+    return value;
+}
+
+static float getHalf(const unsigned char *bytes)
+{
+    uint32_t half = bytes[0] | (bytes[1] << 8);
+    uint32_t sign = (half & 0x8000) << 16;
+    uint32_t exponent = (half >> 10) & 0x1f;
+    uint32_t mantissa = half & 0x3ff;
+    float value;
+    if (exponent == 0)
+    {
+        //Zero or subnormal: mantissa * 2^-24
+        value = mantissa * 5.9604645e-8f;
+        return sign ? -value : value;
+    }
+    uint32_t bits = sign | (exponent == 31 ? 0x7f800000 | (mantissa << 13) :
+                                             ((exponent + 112) << 23) | (mantissa << 13));
+    memcpy(&value, &bits, 4);
+    return value;
+}
+
+static void putUint32(std::vector<unsigned char> &out, uint32_t value)
+{
+    for (int k = 0; k < 4; ++k)
+    {
+        out.push_back((unsigned char) (value >> (8*k)));
+    }
+}
+
+static void putUint64(std::vector<unsigned char> &out, uint64_t value)
+{
+    for (int k = 0; k < 8; ++k)
+    {
+        out.push_back((unsigned char) (value >> (8*k)));
+    }
+}
+
+static void putFloat(std::vector<unsigned char> &out, float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, 4);
+    putUint32(out, bits);
+}
+
+static void putString(std::vector<unsigned char> &out, const std::string &value)
+{
+    out.insert(out.end(), value.begin(), value.end());
+    out.push_back(0);
+}
+
+static void putAttribute(std::vector<unsigned char> &out, const std::string &name, const std::string &type, const std::vector<unsigned char> &value)
+{
+    putString(out, name);
+    putString(out, type);
+    putUint32(out, (uint32_t) value.size());
+    out.insert(out.end(), value.begin(), value.end());
+}
+
+ExrWriter::ExrWriter()
+{
+    file = NULL;
+    width = height = 0;
+    rowsWritten = 0;
+    failed = false;
+}
+
+ExrWriter::~ExrWriter()
+{
+    if (file)
+    {
+        fclose(file);
+    }
+}
+
+/**
+ * @brief open Creates the file and writes the header and offset table
+ * @param filename The file to write
+ * @param width The number of pixels in each row
+ * @param height The number of rows that will be written
+ * @param channels The names of the channels, in the order they are
+ * interleaved in the rows passed to writeRows
+ * @return Whether the file could be created
+ */
+bool ExrWriter::open(const std::string &filename, int width, int height, const std::vector<std::string> &channels)
+{
+    if (width <= 0 || height <= 0 || channels.empty())
+    {
+        return false;
+    }
+
+    file = fopen(filename.c_str(), "wb");
+    if (!file)
+    {
+        return false;
+    }
+
+    this->width = width;
+    this->height = height;
+    rowsWritten = 0;
+    failed = false;
+
+    //EXR requires the channels to be stored in alphabetical order
+    channelOrder.resize(channels.size());
+    for (size_t c = 0; c < channels.size(); ++c)
+    {
+        channelOrder[c] = (int) c;
+    }
+    std::sort(channelOrder.begin(), channelOrder.end(), [&](int a, int b) { return channels[a] < channels[b]; });
+
+    std::vector<unsigned char> header;
+    putUint32(header, 20000630);
+    putUint32(header, 2);
+
+    std::vector<unsigned char> value;
+    for (int c : channelOrder)
+    {
+        putString(value, channels[c]);
+        putUint32(value, 2); //FLOAT
+        putUint32(value, 0); //pLinear and reserved
+        putUint32(value, 1); //xSampling
+        putUint32(value, 1); //ySampling
+    }
+    value.push_back(0);
+    putAttribute(header, "channels", "chlist", value);
+
+    value.assign(1, 0); //NO_COMPRESSION
+    putAttribute(header, "compression", "compression", value);
+
+    value.clear();
+    putUint32(value, 0);
+    putUint32(value, 0);
+    putUint32(value, width - 1);
+    putUint32(value, height - 1);
+    putAttribute(header, "dataWindow", "box2i", value);
+    putAttribute(header, "displayWindow", "box2i", value);
+
+    value.assign(1, 0); //INCREASING_Y
+    putAttribute(header, "lineOrder", "lineOrder", value);
+
+    value.clear();
+    putFloat(value, 1);
+    putAttribute(header, "pixelAspectRatio", "float", value);
+
+    value.clear();
+    putFloat(value, 0);
+    putFloat(value, 0);
+    putAttribute(header, "screenWindowCenter", "v2f", value);
+
+    value.clear();
+    putFloat(value, 1);
+    putAttribute(header, "screenWindowWidth", "float", value);
+
+    header.push_back(0);
+
+    //Every scanline block is its y coordinate, its size and its data
+    uint64_t lineBytes = (uint64_t) width * channels.size() * 4;
+    uint64_t offset = header.size() + 8 * (uint64_t) height;
+    for (int y = 0; y < height; ++y)
+    {
+        putUint64(header, offset + y * (8 + lineBytes));
+    }
+
+    failed = fwrite(header.data(), 1, header.size(), file) != header.size();
+    return !failed;
+}
+
+/**
+ * @brief writeRows Writes the next rows of the image
+ * @param rows The interleaved channel values of each pixel of each row
+ * @param rowCount The number of rows
+ * @return Whether the rows were written
+ */
+bool ExrWriter::writeRows(const float *rows, int rowCount)
+{
+    if (!file || failed || rowsWritten + rowCount > height)
+    {
+        failed = true;
+        return false;
+    }
+
+    size_t channelCount = channelOrder.size();
+    bool swapBytes = !isLittleEndian();
+    for (int r = 0; r < rowCount; ++r)
+    {
+        const float *row = rows + r * channelCount * width;
+        line.clear();
+        putUint32(line, rowsWritten);
+        putUint32(line, (uint32_t) (width * channelCount * 4));
+
+        //Each scanline stores all the values of one channel, then the next
+        size_t start = line.size();
+        line.resize(start + width * channelCount * 4);
+        float *values = (float *) &line[start];
+        for (size_t c = 0; c < channelCount; ++c)
+        {
+            for (int i = 0; i < width; ++i)
+            {
+                values[c*width + i] = row[i*channelCount + channelOrder[c]];
+            }
+        }
+        if (swapBytes)
+        {
+            for (size_t k = start; k < line.size(); k += 4)
+            {
+                std::swap(line[k], line[k+3]);
+                std::swap(line[k+1], line[k+2]);
+            }
+        }
+
+        if (fwrite(line.data(), 1, line.size(), file) != line.size())
+        {
+            failed = true;
+            return false;
+        }
+        rowsWritten++;
+    }
+    return true;
+}
+
+bool ExrWriter::close()
+{
+    if (!file)
+    {
+        return false;
+    }
+
+    bool complete = !failed && rowsWritten == height;
+    complete = fclose(file) == 0 && complete;
+    file = NULL;
+    return complete;
+}
+
+/**
+ * @brief writeExr Writes a framebuffer as an OpenEXR file. If it has
+ * AOVs they are stored as extra layers in the same file: Z for depth,
+ * N for the normal, albedo, and samples for the sample count.
+ * @param filename The file to write
+ * @param framebuffer The image to write
+ * @return Whether the file was written
+ */
+bool writeExr(const std::string &filename, const Framebuffer &framebuffer)
+{
+    int width = framebuffer.getWidth(), height = framebuffer.getHeight();
+    ExrWriter writer;
+
+    if (!framebuffer.hasAovs())
+    {
+        std::vector<std::string> channels = { "R", "G", "B" };
+        if (!writer.open(filename, width, height, channels))
+        {
+            return false;
+        }
+        writer.writeRows(&framebuffer.getColour()[0].x, height);
+        return writer.close();
+    }
+
+    std::vector<std::string> channels = { "R", "G", "B", "Z", "N.X", "N.Y", "N.Z",
+                                          "albedo.R", "albedo.G", "albedo.B", "samples" };
+    if (!writer.open(filename, width, height, channels))
+    {
+        return false;
+    }
+
+    std::vector<float> row(width * channels.size());
+    for (int j = 0; j < height; ++j)
+    {
+        size_t offset = j * (size_t) width;
+        for (int i = 0; i < width; ++i)
+        {
+            Vector3 colour = framebuffer.getColour()[offset + i];
+            Vector3 normal = framebuffer.getNormal()[offset + i];
+            Vector3 albedo = framebuffer.getAlbedo()[offset + i];
+            float values[] = { colour.x, colour.y, colour.z,
+                               framebuffer.getDepth()[offset + i],
+                               normal.x, normal.y, normal.z,
+                               albedo.x, albedo.y, albedo.z,
+                               framebuffer.getSampleCount()[offset + i] };
+            std::copy(values, values + channels.size(), row.begin() + i * channels.size());
+        }
+        writer.writeRows(row.data(), 1);
+    }
+    return writer.close();
+}
+
+/**
+ * @brief writePfm Writes a Portable Float Map
+ * @param filename The file to write
+ * @param width The number of pixels in each row
+ * @param height The number of rows
+ * @param components 3 for colour or 1 for greyscale
+ * @param data The interleaved values of each pixel, top row first
+ * @return Whether the file was written
+ */
+bool writePfm(const std::string &filename, int width, int height, int components, const float *data)
+{
+    if (components != 1 && components != 3)
+    {
+        return false;
+    }
+
+    FILE *file = fopen(filename.c_str(), "wb");
+    if (!file)
+    {
+        return false;
+    }
+
+    //A negative scale means the floats are little endian
+    fprintf(file, "%s\n%d %d\n%s\n", components == 3 ? "PF" : "Pf", width, height,
+            isLittleEndian() ? "-1.0" : "1.0");
+
+    //PFM stores the bottom row first
+    bool written = true;
+    size_t rowValues = (size_t) width * components;
+    for (int j = height - 1; j >= 0 && written; --j)
+    {
+        written = fwrite(data + j * rowValues, sizeof(float), rowValues, file) == rowValues;
+    }
+
+    return fclose(file) == 0 && written;
+}
+
+bool writePfm(const std::string &filename, const Framebuffer &framebuffer)
+{
+    return writePfm(filename, framebuffer.getWidth(), framebuffer.getHeight(), 3, &framebuffer.getColour()[0].x);
+}
+
+/**
+ * @brief readPfm Reads a colour Portable Float Map, so that a finished
+ * render can be tonemapped again without tracing it again
+ * @param filename The file to read
+ * @return The image, or null if the file could not be read
+ */
+Framebuffer * readPfm(const std::string &filename)
+{
+    FILE *file = fopen(filename.c_str(), "rb");
+    if (!file)
+    {
+        return NULL;
+    }
+
+    char type[3] = { 0 };
+    int width, height;
+    float scale;
+    if (fscanf(file, "%2s %d %d %f", type, &width, &height, &scale) != 4 ||
+            strcmp(type, "PF") != 0 || width <= 0 || height <= 0 || fgetc(file) == EOF)
+    {
+        fclose(file);
+        return NULL;
+    }
+
+    //A corrupt size must not allocate more than the file could hold
+    if ((uint64_t) width * height * sizeof(Vector3) > getRemainingBytes(file))
+    {
+        fclose(file);
+        return NULL;
+    }
+
+    Framebuffer *framebuffer = new Framebuffer(width, height);
+    bool swapBytes = (scale < 0) != isLittleEndian();
+    bool read = true;
+    for (int j = height - 1; j >= 0 && read; --j)
+    {
+        Vector3 *row = framebuffer->getColour() + j * (size_t) width;
+        read = fread(row, sizeof(Vector3), width, file) == (size_t) width;
+        if (swapBytes)
+        {
+            unsigned char *bytes = (unsigned char *) row;
+            for (size_t k = 0; k < width * sizeof(Vector3); k += 4)
+            {
+                std::swap(bytes[k], bytes[k+3]);
+                std::swap(bytes[k+1], bytes[k+2]);
+            }
+        }
+    }
+    fclose(file);
+
+    if (!read)
+    {
+        delete framebuffer;
+        return NULL;
+    }
+    return framebuffer;
+}
+
+/**
+ * @brief readExr Reads the colour of an uncompressed scanline OpenEXR
+ * file, such as writeExr writes, so that a finished render can be
+ * tonemapped again. The R, G and B channels must be half or float; other
+ * channels are skipped.
+ * @param filename The file to read
+ * @return The image, or null if the file could not be read or uses
+ * compression, tiles or parts
+ */
+Framebuffer * readExr(const std::string &filename)
+{
+    FILE *file = fopen(filename.c_str(), "rb");
+    if (!file)
+    {
+        return NULL;
+    }
+    std::vector<unsigned char> bytes(getRemainingBytes(file));
+    bool read = fread(bytes.data(), 1, bytes.size(), file) == bytes.size();
+    fclose(file);
+
+    //Version 2, without the tiled, multipart or deep flags
+    if (!read || bytes.size() < 8 || getUint32(&bytes[0]) != 20000630 ||
+            (getUint32(&bytes[4]) & 0x1aff) != 2)
+    {
+        return NULL;
+    }
+
+    struct Channel
+    {
+        std::string name;
+        uint32_t pixelType;
+        int size;
+    };
+    std::vector<Channel> channels;
+    int compression = -1;
+    int32_t window[4] = { 0, 0, -1, -1 };
+
+    //Attributes are a name, a type, a size and a value, ended by an empty name
+    size_t position = 8;
+    while (true)
+    {
+        size_t nameEnd = position;
+        while (nameEnd < bytes.size() && bytes[nameEnd] != 0)
+        {
+            ++nameEnd;
+        }
+        if (nameEnd >= bytes.size())
+        {
+            return NULL;
+        }
+        std::string name((const char *) &bytes[position], nameEnd - position);
+        position = nameEnd + 1;
+        if (name.empty())
+        {
+            break;
+        }
+
+        size_t typeEnd = position;
+        while (typeEnd < bytes.size() && bytes[typeEnd] != 0)
+        {
+            ++typeEnd;
+        }
+        if (typeEnd + 5 > bytes.size())
+        {
+            return NULL;
+        }
+        uint32_t size = getUint32(&bytes[typeEnd + 1]);
+        position = typeEnd + 5;
+        if (size > bytes.size() - position)
+        {
+            return NULL;
+        }
+        const unsigned char *value = &bytes[position];
+
+        if (name == "channels")
+        {
+            size_t k = 0;
+            while (k < size && value[k] != 0)
+            {
+                Channel channel;
+                while (k < size && value[k] != 0)
+                {
+                    channel.name += (char) value[k++];
+                }
+                if (k + 17 > size)
+                {
+                    return NULL;
+                }
+                uint32_t pixelType = getUint32(value + k + 1);
+                if (pixelType > 2 || getUint32(value + k + 9) != 1 || getUint32(value + k + 13) != 1)
+                {
+                    return NULL;
+                }
+                channel.pixelType = pixelType;
+                channel.size = pixelType == 1 ? 2 : 4;
+                channels.push_back(channel);
+                k += 17;
+            }
+        }
+        else if (name == "compression" && size == 1)
+        {
+            compression = value[0];
+        }
+        else if (name == "dataWindow" && size == 16)
+        {
+            for (int k = 0; k < 4; ++k)
+            {
+                window[k] = (int32_t) getUint32(value + 4*k);
+            }
+        }
+        position += size;
+    }
+
+    //Without compression every block is one scanline
+    int64_t width = (int64_t) window[2] - window[0] + 1;
+    int64_t height = (int64_t) window[3] - window[1] + 1;
+    if (compression != 0 || width <= 0 || height <= 0 || width > INT32_MAX || height > INT32_MAX)
+    {
+        return NULL;
+    }
+
+    int rgb[3] = { -1, -1, -1 };
+    uint64_t pixelBytes = 0;
+    std::vector<uint64_t> channelOffsets;
+    for (size_t c = 0; c < channels.size(); ++c)
+    {
+        const char *names[] = { "R", "G", "B" };
+        for (int k = 0; k < 3; ++k)
+        {
+            if (channels[c].name == names[k] && channels[c].pixelType != 0)
+            {
+                rgb[k] = (int) c;
+            }
+        }
+        channelOffsets.push_back(pixelBytes * width);
+        pixelBytes += channels[c].size;
+    }
+    uint64_t lineBytes = pixelBytes * width;
+
+    //A corrupt size must not allocate more than the file could hold
+    if (rgb[0] < 0 || rgb[1] < 0 || rgb[2] < 0 ||
+            (uint64_t) height * (16 + lineBytes) > bytes.size() - position)
+    {
+        return NULL;
+    }
+
+    Framebuffer *framebuffer = new Framebuffer((int) width, (int) height);
+    std::vector<bool> linesRead(height, false);
+    for (int64_t k = 0; k < height; ++k)
+    {
+        uint64_t offset = getUint64(&bytes[position + 8*k]);
+        if (offset > bytes.size() || bytes.size() - offset < 8 + lineBytes)
+        {
+            delete framebuffer;
+            return NULL;
+        }
+        int64_t y = (int32_t) getUint32(&bytes[offset]) - (int64_t) window[1];
+        if (y < 0 || y >= height || getUint32(&bytes[offset + 4]) != lineBytes)
+        {
+            delete framebuffer;
+            return NULL;
+        }
+        linesRead[y] = true;
+
+        const unsigned char *line = &bytes[offset + 8];
+        Vector3 *row = framebuffer->getColour() + y * width;
+        for (int64_t i = 0; i < width; ++i)
+        {
+            float values[3];
+            for (int c = 0; c < 3; ++c)
+            {
+                const Channel &channel = channels[rgb[c]];
+                const unsigned char *sample = line + channelOffsets[rgb[c]] + i * channel.size;
+                values[c] = channel.size == 2 ? getHalf(sample) : getFloat(sample);
+            }
+            row[i] = Vector3(values[0], values[1], values[2]);
+        }
+    }
+
+    if (std::find(linesRead.begin(), linesRead.end(), false) != linesRead.end())
+    {
+        delete framebuffer;
+        return NULL;
+    }
+    return framebuffer;
+}
@@ -0,0 +1,41 @@
+#ifndef HDRIMAGE_HPP
+#define HDRIMAGE_HPP
+
+#include "framebuffer.hpp"
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+/**
+ * Writes an uncompressed scanline OpenEXR file with 32-bit float
+ * channels a block of rows at a time. Since every scanline has the
+ * same size, the offset table is known up front and nothing has to
+ * be buffered.
+ * @brief The ExrWriter class
+ */
+class ExrWriter
+{
+    public:
+        ExrWriter();
+        ~ExrWriter();
+
+        bool open(const std::string &filename, int width, int height, const std::vector<std::string> &channels);
+        bool writeRows(const float *rows, int rowCount);
+        bool close();
+
+    private:
+        FILE *file;
+        int width, height;
+        std::vector<int> channelOrder;
+        int rowsWritten;
+        bool failed;
+        std::vector<unsigned char> line;
+};
+
+bool writeExr(const std::string &filename, const Framebuffer &framebuffer);
+bool writePfm(const std::string &filename, int width, int height, int components, const float *data);
+bool writePfm(const std::string &filename, const Framebuffer &framebuffer);
+Framebuffer * readPfm(const std::string &filename);
+Framebuffer * readExr(const std::string &filename);
+
+#endif // HDRIMAGE_HPP
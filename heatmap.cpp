@@ -0,0 +1,73 @@
+#include "heatmap.hpp"
+#include "pngwriter.hpp"
+#include <algorithm>
+#include <vector>
+
+//Values at or above this fraction of the pixels are drawn in the
+//hottest colour, so a few very expensive pixels do not leave the rest
+//of the map dark
+static const float SATURATION_PERCENTILE = 0.99;
+
+//Black through purple, red and orange to yellow and then white
+static const Vector3 COLOUR_STOPS[] = {
+    Vector3(0, 0, 0),
+    Vector3(0.3, 0.05, 0.45),
+    Vector3(0.8, 0.15, 0.25),
+    Vector3(1, 0.55, 0),
+    Vector3(1, 0.95, 0.3),
+    Vector3(1, 1, 1)
+};
+static const int COLOUR_STOP_COUNT = sizeof(COLOUR_STOPS) / sizeof(COLOUR_STOPS[0]);
+
+static Vector3 getHeatColour(float heat)
+{
+    float position = std::min(std::max(heat, 0.0f), 1.0f) * (COLOUR_STOP_COUNT - 1);
+    int stop = std::min(int(position), COLOUR_STOP_COUNT - 2);
+    float blend = position - stop;
+    return COLOUR_STOPS[stop]*(1 - blend) + COLOUR_STOPS[stop + 1]*blend;
+}
+
+/**
+ * @brief heatmap Converts a cost per pixel to false colour. The colours
+ * are scaled so that the 99th percentile of the values is the hottest.
+ * @param values The cost of each pixel, e.g. the time spent on it
+ * @param count The number of pixels
+ * @param out Receives the colour of each pixel
+ */
+void heatmap(const float *values, size_t count, RGBAVector *out)
+{
+    if (count < 1)
+    {
+        return;
+    }
+
+    std::vector<float> sorted(values, values + count);
+    std::vector<float>::iterator percentile = sorted.begin() + size_t(double(SATURATION_PERCENTILE) * (count - 1));
+    std::nth_element(sorted.begin(), percentile, sorted.end());
+    float hottest = *percentile;
+    if (hottest <= 0)
+    {
+        hottest = *std::max_element(sorted.begin(), sorted.end());
+    }
+    float scale = hottest > 0 ? 1 / hottest : 0;
+
+    for (size_t k = 0; k < count; ++k)
+    {
+        out[k] = RGBAVector(getHeatColour(values[k] * scale) * 255.99f);
+    }
+}
+
+/**
+ * @brief writeHeatmap Writes a cost per pixel as a false colour PNG
+ * @param filename The file to write
+ * @param width The number of horizontal pixels
+ * @param height The number of vertical pixels
+ * @param values The cost of each pixel
+ * @return Whether the file was written
+ */
+bool writeHeatmap(const std::string &filename, int width, int height, const float *values)
+{
+    std::vector<RGBAVector> pixels(width * (size_t) height);
+    heatmap(values, (size_t) width * height, pixels.data());
+    return writePng(filename, width, height, 4, pixels.data(), width * 4);
+}
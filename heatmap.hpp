@@ -0,0 +1,11 @@
+#ifndef HEATMAP_HPP
+#define HEATMAP_HPP
+
+#include "rgbvector.hpp"
+#include <stddef.h>
+#include <string>
+
+void heatmap(const float *values, size_t count, RGBAVector *out);
+bool writeHeatmap(const std::string &filename, int width, int height, const float *values);
+
+#endif // HEATMAP_HPP
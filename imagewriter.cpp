@@ -0,0 +1,301 @@
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+
+#include "imagewriter.hpp"
+#include "pngwriter.hpp"
+#include "hdrimage.hpp"
+#include "heatmap.hpp"
+#include "stb_image_write.h"
+#include "tracing.hpp"
+#include <chrono>
+#include <vector>
+#include <sys/stat.h>
+
+//Frames waiting to be written each hold a whole framebuffer, so a
+//renderer that outpaces the writer is stalled once this many are queued
+static const size_t MAX_QUEUED_FRAMES = 2;
+
+static double getSecondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * @brief countFileBytes Adds the size of a file that was just written to
+ * a running total
+ * @param bytesWritten The total, or NULL if it is not wanted
+ */
+static void countFileBytes(const std::string &filename, double *bytesWritten)
+{
+    struct stat status;
+    if (bytesWritten && stat(filename.c_str(), &status) == 0)
+    {
+        *bytesWritten += status.st_size;
+    }
+}
+
+static bool hasExtension(const std::string &filename, const std::string &extension)
+{
+    return filename.size() >= extension.size() &&
+            filename.compare(filename.size() - extension.size(), extension.size(), extension) == 0;
+}
+
+/**
+ * @brief writeAovs Writes each AOV of a framebuffer as a PFM next to
+ * the beauty image, e.g. render.png gets render.depth.pfm
+ * @param filename The filename of the beauty image
+ * @param framebuffer The image whose AOVs to write
+ * @param bytesWritten Receives the size of the files, if not NULL
+ * @return Whether every file was written
+ */
+static bool writeAovs(const std::string &filename, const Framebuffer &framebuffer, double *bytesWritten)
+{
+    std::string base = filename.substr(0, filename.rfind('.'));
+    int width = framebuffer.getWidth(), height = framebuffer.getHeight();
+    bool written = writePfm(base + ".depth.pfm", width, height, 1, framebuffer.getDepth());
+    written = writePfm(base + ".normal.pfm", width, height, 3, &framebuffer.getNormal()[0].x) && written;
+    written = writePfm(base + ".albedo.pfm", width, height, 3, &framebuffer.getAlbedo()[0].x) && written;
+    written = writePfm(base + ".samples.pfm", width, height, 1, framebuffer.getSampleCount()) && written;
+    countFileBytes(base + ".depth.pfm", bytesWritten);
+    countFileBytes(base + ".normal.pfm", bytesWritten);
+    countFileBytes(base + ".albedo.pfm", bytesWritten);
+    countFileBytes(base + ".samples.pfm", bytesWritten);
+    return written;
+}
+
+/**
+ * @brief writeCost Writes the time spent on and rays traced for each
+ * pixel of a framebuffer as heatmaps next to the beauty image, e.g.
+ * render.png gets render.time.png and render.rays.png
+ * @param filename The filename of the beauty image
+ * @param framebuffer The image whose cost to write
+ * @param bytesWritten Receives the size of the files, if not NULL
+ * @return Whether every file was written
+ */
+static bool writeCost(const std::string &filename, const Framebuffer &framebuffer, double *bytesWritten)
+{
+    std::string base = filename.substr(0, filename.rfind('.'));
+    int width = framebuffer.getWidth(), height = framebuffer.getHeight();
+    bool written = writeHeatmap(base + ".time.png", width, height, framebuffer.getTime());
+    written = writeHeatmap(base + ".rays.png", width, height, framebuffer.getRayCount()) && written;
+    countFileBytes(base + ".time.png", bytesWritten);
+    countFileBytes(base + ".rays.png", bytesWritten);
+    return written;
+}
+
+/**
+ * @brief writeImage Writes a framebuffer in the format given by the
+ * extension of the filename. ".exr" and ".pfm" keep the linear
+ * radiance; anything else is tonemapped and written as a PNG. AOVs
+ * are stored as layers of an EXR, or as PFMs beside other formats. The
+ * cost of each pixel, if recorded, is written as heatmaps beside it.
+ * The image is always written first, and the files beside it are still
+ * attempted if it fails.
+ * @param filename The file to write
+ * @param framebuffer The image to write
+ * @param toneMapOptions The tonemapping to apply for 8-bit formats
+ * @return Whether the image and every file beside it were written
+ */
+bool writeImage(const std::string &filename, const Framebuffer &framebuffer, const ToneMapOptions &toneMapOptions)
+{
+    return writeImage(filename, framebuffer, toneMapOptions, NULL);
+}
+
+/**
+ * @brief writeImage Writes a framebuffer as the overload above does
+ * @param bytesWritten Receives the total size of the files written, if not NULL
+ */
+bool writeImage(const std::string &filename, const Framebuffer &framebuffer, const ToneMapOptions &toneMapOptions,
+                double *bytesWritten)
+{
+    bool written;
+    if (hasExtension(filename, ".exr"))
+    {
+        written = writeExr(filename, framebuffer);
+    }
+    else if (hasExtension(filename, ".pfm"))
+    {
+        written = writePfm(filename, framebuffer);
+    }
+    else
+    {
+        int width = framebuffer.getWidth(), height = framebuffer.getHeight();
+        std::vector<RGBAVector> pixels(width * (size_t) height);
+        tonemap(framebuffer.getColour(), (size_t) width * height, toneMapOptions, pixels.data());
+        written = writePng(filename, width, height, 4, pixels.data(), width * 4);
+    }
+    countFileBytes(filename, bytesWritten);
+
+    //The files beside the image are written after it, so that failing to
+    //write one of them never costs the render itself
+    if (framebuffer.hasAovs() && !hasExtension(filename, ".exr"))
+    {
+        written = writeAovs(filename, framebuffer, bytesWritten) && written;
+    }
+    if (framebuffer.hasCost())
+    {
+        written = writeCost(filename, framebuffer, bytesWritten) && written;
+    }
+    return written;
+}
+
+AsyncImageWriter::AsyncImageWriter()
+{
+    finishing = false;
+    busy = false;
+    framesWritten = 0;
+    framesFailed = 0;
+    bytesWritten = 0;
+    encodeSeconds = 0;
+    waitSeconds = 0;
+    stallSeconds = 0;
+    worker = std::thread(&AsyncImageWriter::run, this);
+}
+
+AsyncImageWriter::~AsyncImageWriter()
+{
+    finish();
+}
+
+/**
+ * @brief write Queues a frame to be tonemapped, encoded and written to
+ * disk as with writeImage. This returns immediately unless the queue is
+ * full, in which case it waits for the writer to take a frame from it.
+ * The writer takes ownership of the framebuffer and deletes it once it
+ * has been written.
+ * @param filename The file to write the frame to
+ * @param framebuffer The frame, allocated with new
+ * @param toneMapOptions The tonemapping to apply for 8-bit formats
+ */
+void AsyncImageWriter::write(const std::string &filename, Framebuffer *framebuffer, const ToneMapOptions &toneMapOptions)
+{
+    Job job;
+    job.filename = filename;
+    job.framebuffer = framebuffer;
+    job.toneMapOptions = toneMapOptions;
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (jobs.size() >= MAX_QUEUED_FRAMES)
+        {
+            TraceSpan span("wait for image writer");
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            queueSpace.wait(lock, [this] { return jobs.size() < MAX_QUEUED_FRAMES; });
+            double seconds = getSecondsSince(start);
+            stallSeconds += seconds;
+            waitSeconds += seconds;
+        }
+        jobs.push_back(job);
+    }
+    jobAvailable.notify_one();
+}
+
+/**
+ * @brief finish Blocks until every queued frame has been written and
+ * stops the background thread. No frames may be written afterwards.
+ */
+void AsyncImageWriter::finish()
+{
+    if (!worker.joinable())
+    {
+        return;
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        finishing = true;
+        jobAvailable.notify_one();
+        queueDrained.wait(lock, [this] { return jobs.empty() && !busy; });
+    }
+    worker.join();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    waitSeconds += getSecondsSince(start);
+}
+
+/**
+ * @brief printSummary Prints the throughput of the output stage. The
+ * wait time is how long the renderer was stalled on output that could
+ * not be overlapped with rendering, both on a full queue and at the end.
+ */
+void AsyncImageWriter::printSummary(std::ostream &out) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    double megabytes = bytesWritten / (1024*1024);
+    out << "Output: " << framesWritten << " frame(s) written";
+    if (framesFailed > 0)
+    {
+        out << ", " << framesFailed << " failed";
+    }
+    out << ", " << megabytes << " MB written in " << encodeSeconds << " s";
+    if (encodeSeconds > 0)
+    {
+        out << " (" << framesWritten / encodeSeconds << " frames/s, "
+            << megabytes / encodeSeconds << " MB/s)";
+    }
+    out << ", renderer waited " << waitSeconds << " s (" << stallSeconds << " s on a full queue)" << std::endl;
+}
+
+/**
+ * @brief getEncodeSeconds The time spent tonemapping, encoding and
+ * writing frames so far, whether or not it overlapped with rendering
+ */
+double AsyncImageWriter::getEncodeSeconds() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return encodeSeconds;
+}
+
+int AsyncImageWriter::getFramesFailed() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return framesFailed;
+}
+
+void AsyncImageWriter::run()
+{
+    setTraceThreadName("image writer");
+    while (true)
+    {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            busy = false;
+            if (jobs.empty())
+            {
+                queueDrained.notify_all();
+            }
+            jobAvailable.wait(lock, [this] { return finishing || !jobs.empty(); });
+            if (jobs.empty())
+            {
+                return;
+            }
+            job = jobs.front();
+            jobs.pop_front();
+            busy = true;
+        }
+        queueSpace.notify_one();
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        bool written;
+        double bytes = 0;
+        {
+            TraceSpan span("write image");
+            written = writeImage(job.filename, *job.framebuffer, job.toneMapOptions, &bytes);
+        }
+        double seconds = getSecondsSince(start);
+        delete job.framebuffer;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (written)
+        {
+            framesWritten++;
+        }
+        else
+        {
+            framesFailed++;
+        }
+        bytesWritten += bytes;
+        encodeSeconds += seconds;
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef IMAGEWRITER_HPP
+#define IMAGEWRITER_HPP
+
+#include "framebuffer.hpp"
+#include "tonemap.hpp"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+
+bool writeImage(const std::string &filename, const Framebuffer &framebuffer, const ToneMapOptions &toneMapOptions);
+bool writeImage(const std::string &filename, const Framebuffer &framebuffer, const ToneMapOptions &toneMapOptions,
+                double *bytesWritten);
+
+/**
+ * Tonemaps, encodes and writes finished frames on a background thread
+ * so that rendering of the next frame can start immediately. Only a
+ * couple of frames are queued, so rendering stalls rather than holding
+ * every frame in memory when it outpaces the writer.
+ * @brief The AsyncImageWriter class
+ */
+class AsyncImageWriter
+{
+    public:
+        AsyncImageWriter();
+        ~AsyncImageWriter();
+
+        void write(const std::string &filename, Framebuffer *framebuffer, const ToneMapOptions &toneMapOptions);
+        void finish();
+        void printSummary(std::ostream &out) const;
+        double getEncodeSeconds() const;
+        int getFramesFailed() const;
+
+    private:
+        struct Job
+        {
+            std::string filename;
+            Framebuffer *framebuffer;
+            ToneMapOptions toneMapOptions;
+        };
+
+        std::thread worker;
+        mutable std::mutex mutex;
+        std::condition_variable jobAvailable, queueDrained, queueSpace;
+        std::deque<Job> jobs;
+        bool finishing;
+        bool busy;
+
+        int framesWritten, framesFailed;
+        double bytesWritten;
+        double encodeSeconds;
+        double waitSeconds;
+        double stallSeconds;
+
+        void run();
+};
+
+#endif // IMAGEWRITER_HPP
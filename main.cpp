@@ -1,5 +1,3 @@
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-
 #include <iostream>
 #include <fstream>
 #include "ray.hpp"
@@ -7,93 +5,683 @@
 #include "material.hpp"
 #include "camera.hpp"
 #include "scene.hpp"
-#include "stb_image_write.h"
+#include "imagewriter.hpp"
+#include "hdrimage.hpp"
+#include "sceneparser.hpp"
+#include "compiledscene.hpp"
+#include "scenegenerator.hpp"
+#include "tracing.hpp"
+#include "renderscene.hpp"
+#include "cpudispatch.hpp"
+#include "renderserver.hpp"
+#include <chrono>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 using namespace std;
 
-int main()
+//The scene rendered when no scene file is given; scenes/box.scene describes the same one
+static void buildDefaultScene(Scene &scene)
 {
-    const float horizontalPixels = 400, verticalPixels = 200;
-
-    CameraOptions cameraOptions;
-    cameraOptions.cameraPosition = Vector3(0, 0, 0);
-    cameraOptions.lookAt = Vector3(0, 0, -1);
-    cameraOptions.fieldOfView = 90;
-    cameraOptions.lensRadius = 0;
-    cameraOptions.cameraRoll = 0;
-
-    Camera camera = Camera(horizontalPixels, verticalPixels, cameraOptions);
-
-    Scene scene;
     scene.setBackground(Vector3(1,1,1));
 
 
-    scene.addSurface(new Plane(
+    scene.addSurface(scene.create<Plane>(
                          Vector3(0,1.5,0),
                          Vector3(0,1,0),
-                         new Diffuse(Vector3(0.2,0.2,0.2))
+                         scene.create<Diffuse>(Vector3(0.2,0.2,0.2))
                          )
                      );
-    scene.addSurface(new Plane(
+    scene.addSurface(scene.create<Plane>(
                          Vector3(-2,0,0),
                          Vector3(1,0,0),
-                         new Diffuse(Vector3(1,0.3,0.3))
+                         scene.create<Diffuse>(Vector3(1,0.3,0.3))
                          )
                      );
-    scene.addSurface(new Plane(
+    scene.addSurface(scene.create<Plane>(
                          Vector3(0,0,-2.0),
                          Vector3(0,0,1),
-                         new Diffuse(Vector3(0.3,1,0.3))
+                         scene.create<Diffuse>(Vector3(0.3,1,0.3))
                          )
                      );
-    scene.addSurface(new Plane(
+    scene.addSurface(scene.create<Plane>(
                          Vector3(2,0,0),
                          Vector3(1,0,0),
-                         new Diffuse(Vector3(0.3,0.3,1))
+                         scene.create<Diffuse>(Vector3(0.3,0.3,1))
                          )
                      );
-    scene.addSurface(new Plane(
+    scene.addSurface(scene.create<Plane>(
                          Vector3(0,-1.5,0),
                          Vector3(0,1,0),
-                         new Diffuse(Vector3(0.7,0.7,0.7))
+                         scene.create<Diffuse>(Vector3(0.7,0.7,0.7))
                          )
                      );
 
-//    scene.addSurface((new Sphere(
+//    scene.addSurface((scene.create<Sphere>(
 //                          Vector3(0.5,-0.3,-0.65),
 //                          0.4,
-//                          new Metal(Vector3(0.8,0.8,0.8), 0))
+//                          scene.create<Metal>(Vector3(0.8,0.8,0.8), 0))
 //                          ));
 
-//    scene.addSurface((new Sphere(
+//    scene.addSurface((scene.create<Sphere>(
 //                          Vector3(-0.5,-0.3,-0.8),
 //                          0.4,
-//                          new Dielectric(1.5))
+//                          scene.create<Dielectric>(1.5))
 //                          ));
 
-//    scene.addSurface((new Rectangle(Vector3(0,0,0),
+//    scene.addSurface((scene.create<Rectangle>(Vector3(0,0,0),
 //                                   Vector3(0,0,1),
 //                                   1, 1.5,
-//                                   new Light(Vector3(1,0.8,0))))
-//                     ->translate(Vector3(0,0,-1.999))
+//                                   scene.create<Light>(Vector3(1,0.8,0))))
+//                     ->translate(scene, Vector3(0,0,-1.999))
 //                     );
     
-        scene.addSurface((new Triangle(
+        scene.addSurface((scene.create<Triangle>(
                                 Vector3(-2,0,-1.999),
                                 Vector3(2, 0, -1.999),
                                 Vector3(2,2,-1.999),
-                                new Light(Vector3(1,0.8,0))))
-//                     ->translate(Vector3(0,0,0.001))
+                                scene.create<Light>(Vector3(1,0.8,0))))
+//                     ->translate(scene, Vector3(0,0,0.001))
                      );
+}
+
+/**
+ * Everything that can be set from the command line
+ * @brief The Settings class
+ */
+class Settings
+{
+    public:
+        string sceneFile;
+        string outputFile;
+        string compiledSceneFile;
+        string generatedKind;
+        string traceFile;
+        string serveSocket;
+        string tonemapFile;
+        long long generatedCount;
+        unsigned int seed;
+        int width, height;
+        int threads;
+        int frames;
+        bool stream;
+        bool printStatistics;
+        CpuLevel cpuLevelLimit;
+        RenderOptions renderOptions;
+        ToneMapOptions toneMapOptions;
+
+        Settings();
+};
+
+Settings::Settings()
+{
+    outputFile = "render.png";
+    generatedCount = 1000;
+    seed = 1;
+    width = 400;
+    height = 200;
+    threads = 0;
+    frames = 1;
+    stream = false;
+    printStatistics = false;
+    cpuLevelLimit = CPU_LEVEL_AVX512;
+}
+
+/**
+ * Times how long the sink it wraps spends writing, so that encoding can
+ * be told apart from rendering when the two are interleaved
+ * @brief The TimedScanlineSink class
+ */
+class TimedScanlineSink : public ScanlineSink
+{
+    public:
+        TimedScanlineSink(ScanlineSink &sink) : sink(sink), seconds(0) {}
+
+        virtual bool writeRows(const Vector3 *rows, int firstRow, int rowCount)
+        {
+            TraceSpan span("write rows", "first row", firstRow);
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            bool written = sink.writeRows(rows, firstRow, rowCount);
+            seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            return written;
+        }
+
+        ScanlineSink &sink;
+        double seconds;
+};
+
+static double getSecondsSince(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+static bool hasExtension(const string &filename, const string &extension)
+{
+    return filename.size() >= extension.size() &&
+            filename.compare(filename.size() - extension.size(), extension.size(), extension) == 0;
+}
+
+static void printUsage(ostream &out)
+{
+    out << "Usage: rayTracer [options] [scene]\n"
+           "\n"
+           "Renders a text or compiled scene file, or a built-in scene if none is given.\n"
+           "\n"
+           "  -o, --output FILE      Image to write: .png, .exr or .pfm (default render.png)\n"
+           "  --width N              Image width in pixels (default 400)\n"
+           "  --height N             Image height in pixels (default 200)\n"
+           "  --spp N                Samples per pixel (default 100)\n"
+           "  --threads N            Render threads (default one per cpu)\n"
+           "  --tile-height N        Rows rendered before they are written when streaming\n"
+           "                         (default 64)\n"
+           "  --stream               Write .png or .exr output while rendering instead of\n"
+           "                         keeping the whole image in memory\n"
+           "  --frames N             Render N frames, numbered before the extension\n"
+           "  --aovs                 Also write depth, normal, albedo and sample count\n"
+           "  --heatmap              Also write the time and rays spent on each pixel as\n"
+           "                         false colour images\n"
+           "  --denoise              Denoise the image, guided by the AOVs\n"
+           "  --pin-threads          Pin render threads to cpus, one NUMA node at a time,\n"
+           "                         and give each node its own copy of the scene\n"
+           "  --isa LEVEL            Use kernels for at most LEVEL of instructions:\n"
+           "                         baseline, sse4.2, avx2 or avx512 (default the best\n"
+           "                         the cpu supports)\n"
+           "  --tonemap FILE         Tonemap an existing .pfm or .exr render to the output\n"
+           "                         instead of rendering a scene\n"
+           "  --exposure X           Exposure for 8-bit output (default 1)\n"
+           "  --gamma X              Gamma for 8-bit output (default 2)\n"
+           "  --generate KIND[:N]    Render a generated scene of N primitives instead of a\n"
+           "                         scene file (default 1000). KIND is spheres, triangles,\n"
+           "                         instances, lights or particles.\n"
+           "  --seed N               Seed for --generate (default 1)\n"
+           "  --compile FILE         Write the scene as a compiled scene and exit\n"
+           "  --trace FILE           Write a Chrome trace of the render phases and rows\n"
+           "  --serve SOCKET         Keep the scene loaded and render the jobs sent to a\n"
+           "                         Unix domain socket, with the other options as the\n"
+           "                         defaults of each job\n"
+           "  --stats                Print ray, intersection and scatter counts (needs a\n"
+           "                         build with RAYTRACER_STATS)\n"
+           "  --help                 Show this message\n";
+}
+
+static bool parseInt(const char *text, int &value)
+{
+    char *end;
+    long number = strtol(text, &end, 10);
+    if (end == text || *end != '\0' || number < 1 || number > 1000000000)
+    {
+        return false;
+    }
+    value = (int) number;
+    return true;
+}
+
+static bool parseFloat(const char *text, float &value)
+{
+    char *end;
+    value = strtof(text, &end);
+    return end != text && *end == '\0';
+}
+
+/**
+ * @brief parseArguments Reads the settings from the command line
+ * @return Whether the command line was valid. Problems are reported on
+ * stderr.
+ */
+static bool parseArguments(int argc, char **argv, Settings &settings)
+{
+    for (int k = 1; k < argc; ++k)
+    {
+        string argument = argv[k];
+        const char *value = k + 1 < argc ? argv[k + 1] : NULL;
+        bool valid = true;
+        bool takesValue = true;
+
+        if (argument == "-o" || argument == "--output")
+        {
+            valid = value != NULL;
+            settings.outputFile = value ? value : "";
+        }
+        else if (argument == "--width")
+        {
+            valid = value && parseInt(value, settings.width);
+        }
+        else if (argument == "--height")
+        {
+            valid = value && parseInt(value, settings.height);
+        }
+        else if (argument == "--spp")
+        {
+            valid = value && parseInt(value, settings.renderOptions.samplesPerPixel);
+        }
+        else if (argument == "--threads")
+        {
+            valid = value && parseInt(value, settings.threads);
+        }
+        else if (argument == "--tile-height")
+        {
+            valid = value && parseInt(value, settings.renderOptions.tileHeight);
+        }
+        else if (argument == "--frames")
+        {
+            valid = value && parseInt(value, settings.frames);
+        }
+        else if (argument == "--exposure")
+        {
+            valid = value && parseFloat(value, settings.toneMapOptions.exposure);
+        }
+        else if (argument == "--gamma")
+        {
+            valid = value && parseFloat(value, settings.toneMapOptions.gamma) && settings.toneMapOptions.gamma > 0;
+        }
+        else if (argument == "--generate")
+        {
+            string kind = value ? value : "";
+            size_t colon = kind.find(':');
+            if (colon != string::npos)
+            {
+                char *end;
+                settings.generatedCount = strtoll(kind.c_str() + colon + 1, &end, 10);
+                valid = *end == '\0' && settings.generatedCount > 0;
+                kind = kind.substr(0, colon);
+            }
+            valid = valid && isGeneratedSceneKind(kind);
+            settings.generatedKind = kind;
+        }
+        else if (argument == "--seed")
+        {
+            char *end;
+            settings.seed = value ? (unsigned int) strtoul(value, &end, 10) : 0;
+            valid = value && end != value && *end == '\0';
+        }
+        else if (argument == "--isa")
+        {
+            valid = value && parseCpuLevel(value, settings.cpuLevelLimit);
+        }
+        else if (argument == "--compile")
+        {
+            valid = value != NULL;
+            settings.compiledSceneFile = value ? value : "";
+        }
+        else if (argument == "--tonemap")
+        {
+            valid = value && (hasExtension(value, ".pfm") || hasExtension(value, ".exr"));
+            settings.tonemapFile = value ? value : "";
+        }
+        else if (argument == "--serve")
+        {
+            valid = value != NULL;
+            settings.serveSocket = value ? value : "";
+        }
+        else if (argument == "--trace")
+        {
+            valid = value != NULL;
+            settings.traceFile = value ? value : "";
+        }
+        else
+        {
+            takesValue = false;
+            if (argument == "--stream")
+            {
+                settings.stream = true;
+            }
+            else if (argument == "--stats")
+            {
+                settings.printStatistics = true;
+            }
+            else if (argument == "--aovs")
+            {
+                settings.renderOptions.outputAovs = true;
+            }
+            else if (argument == "--heatmap")
+            {
+                settings.renderOptions.outputCost = true;
+            }
+            else if (argument == "--denoise")
+            {
+                settings.renderOptions.denoise = true;
+            }
+            else if (argument == "--pin-threads")
+            {
+                settings.renderOptions.pinThreads = true;
+            }
+            else if (argument[0] != '-' && settings.sceneFile.empty())
+            {
+                settings.sceneFile = argument;
+            }
+            else
+            {
+                cerr << "Unknown argument " << argument << endl;
+                return false;
+            }
+        }
+
+        if (!valid)
+        {
+            cerr << "Invalid or missing value for " << argument << endl;
+            return false;
+        }
+        if (takesValue)
+        {
+            ++k;
+        }
+    }
+
+    if (settings.stream && !hasExtension(settings.outputFile, ".png") && !hasExtension(settings.outputFile, ".exr"))
+    {
+        cerr << "--stream can only write .png or .exr images" << endl;
+        return false;
+    }
+    if (!settings.tonemapFile.empty() && (!settings.sceneFile.empty() || !settings.generatedKind.empty() ||
+                                          settings.stream || !settings.serveSocket.empty()))
+    {
+        cerr << "--tonemap reads a rendered image, so it cannot be used with a scene, --generate, --stream or --serve" << endl;
+        return false;
+    }
+    if (settings.stream && !settings.serveSocket.empty())
+    {
+        cerr << "--serve sends whole images, so it cannot be used with --stream" << endl;
+        return false;
+    }
+    if (!settings.serveSocket.empty() && (settings.renderOptions.outputAovs || settings.renderOptions.denoise ||
+                                          settings.renderOptions.outputCost || !settings.traceFile.empty()))
+    {
+        cerr << "--serve sends only the tonemapped image and never finishes a trace, so it cannot be used with "
+                "--aovs, --denoise, --heatmap or --trace" << endl;
+        return false;
+    }
+    if (settings.stream && (settings.renderOptions.outputAovs || settings.renderOptions.denoise ||
+                            settings.renderOptions.outputCost))
+    {
+        cerr << "--aovs, --denoise and --heatmap need the whole image, so they cannot be used with --stream" << endl;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief getFrameFilename Numbers the output file of a frame when more
+ * than one frame is rendered, e.g. render.png becomes render.0003.png
+ */
+static string getFrameFilename(const Settings &settings, int frame)
+{
+    if (settings.frames == 1)
+    {
+        return settings.outputFile;
+    }
+
+    char number[16];
+    snprintf(number, sizeof(number), ".%04d", frame);
+    size_t dot = settings.outputFile.rfind('.');
+    if (dot == string::npos || settings.outputFile.find('/', dot) != string::npos)
+    {
+        return settings.outputFile + number;
+    }
+    return settings.outputFile.substr(0, dot) + number + settings.outputFile.substr(dot);
+}
+
+/**
+ * @brief streamFrame Renders a frame straight into its output file
+ * @param encodeSeconds Incremented by the time spent writing rows
+ * @return Whether the file was written
+ */
+static bool streamFrame(const Camera &camera, const RenderScene &scene, const Settings &settings,
+                        const string &filename, double &encodeSeconds)
+{
+    bool written;
+    if (hasExtension(filename, ".exr"))
+    {
+        ExrScanlineSink sink(filename, settings.width, settings.height);
+        TimedScanlineSink timedSink(sink);
+        written = camera.captureScene(scene, settings.renderOptions, timedSink);
+        written = sink.close() && written;
+        encodeSeconds += timedSink.seconds;
+    }
+    else
+    {
+        PngScanlineSink sink(filename, settings.width, settings.height, settings.toneMapOptions);
+        TimedScanlineSink timedSink(sink);
+        written = camera.captureScene(scene, settings.renderOptions, timedSink);
+        written = sink.close() && written;
+        encodeSeconds += timedSink.seconds;
+    }
+    return written;
+}
+
+/**
+ * @brief serve Compiles a scene once and renders jobs sent to the socket
+ * of --serve until a client shuts the server down
+ * @return Whether the server could be started
+ */
+static bool serve(const Scene &scene, const CameraOptions &cameraOptions, const Settings &settings)
+{
+    RenderScene *renderScene = scene.compile();
+
+    RenderJob defaults;
+    defaults.width = settings.width;
+    defaults.height = settings.height;
+    defaults.cameraOptions = cameraOptions;
+    defaults.renderOptions = settings.renderOptions;
+    defaults.renderOptions.statistics = NULL;
+    defaults.toneMapOptions = settings.toneMapOptions;
+
+    RenderServer server(*renderScene, defaults);
+    string error;
+    bool listening = server.listen(settings.serveSocket, error);
+    if (listening)
+    {
+        cout << "Serving " << renderScene->getPrimitiveCount() << " primitives on " << settings.serveSocket << endl;
+        server.run();
+    }
+    else
+    {
+        cerr << error << endl;
+    }
+
+    delete renderScene;
+    return listening;
+}
+
+/**
+ * @brief retonemap Writes an HDR render again, with the exposure and
+ * gamma of the command line, without tracing it again
+ * @return Whether the image was read and written
+ */
+static bool retonemap(const Settings &settings)
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    Framebuffer *framebuffer = hasExtension(settings.tonemapFile, ".exr") ?
+                readExr(settings.tonemapFile) : readPfm(settings.tonemapFile);
+    if (!framebuffer)
+    {
+        cerr << "Could not read " << settings.tonemapFile << endl;
+        return false;
+    }
+    double readSeconds = getSecondsSince(start);
+
+    start = chrono::steady_clock::now();
+    bool written = writeImage(settings.outputFile, *framebuffer, settings.toneMapOptions);
+    double writeSeconds = getSecondsSince(start);
+    delete framebuffer;
+    if (!written)
+    {
+        cerr << "Could not write " << settings.outputFile << endl;
+        return false;
+    }
+
+    cout << "Timing: read " << readSeconds << " s, tonemap and write " << writeSeconds << " s" << endl;
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    for (int k = 1; k < argc; ++k)
+    {
+        if (strcmp(argv[k], "--help") == 0)
+        {
+            printUsage(cout);
+            return 0;
+        }
+    }
+
+    Settings settings;
+    if (!parseArguments(argc, argv, settings))
+    {
+        printUsage(cerr);
+        return 1;
+    }
+
+#ifdef _OPENMP
+    if (settings.threads > 0)
+    {
+        omp_set_num_threads(settings.threads);
+    }
+#endif
+    setCpuLevelLimit(settings.cpuLevelLimit);
+
+    if (!settings.tonemapFile.empty())
+    {
+        return retonemap(settings) ? 0 : 1;
+    }
+
+    if (!settings.traceFile.empty())
+    {
+        startTracing();
+        setTraceThreadName("main");
+    }
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    //Compiled scenes are mapped rather than parsed and must stay open
+    //for as long as the scene is rendered
+    CameraOptions cameraOptions;
+    Scene scene;
+    CompiledScene compiledScene;
+    {
+        TraceSpan span("load scene");
+        if (!settings.generatedKind.empty())
+        {
+            generateScene(settings.generatedKind, settings.generatedCount, settings.seed, scene, cameraOptions);
+        }
+        else if (!settings.sceneFile.empty())
+        {
+            string error;
+            bool loaded = isCompiledScene(settings.sceneFile) ?
+                        compiledScene.open(settings.sceneFile, error) :
+                        loadScene(settings.sceneFile, scene, cameraOptions, error);
+            if (!loaded)
+            {
+                cerr << error << endl;
+                return 1;
+            }
+            compiledScene.addToScene(scene, cameraOptions);
+        }
+        else
+        {
+            buildDefaultScene(scene);
+        }
+    }
+    double parseSeconds = getSecondsSince(start);
+
+    if (!settings.compiledSceneFile.empty())
+    {
+        if (!writeCompiledScene(settings.compiledSceneFile, scene, cameraOptions))
+        {
+            cerr << "Could not write " << settings.compiledSceneFile << endl;
+            return 1;
+        }
+        cout << "Compiled " << (settings.generatedKind.empty() ? settings.sceneFile : settings.generatedKind) << " to " << settings.compiledSceneFile
+             << " in " << getSecondsSince(start) << " s" << endl;
+        return 0;
+    }
+
+    if (!settings.serveSocket.empty())
+    {
+        return serve(scene, cameraOptions, settings) ? 0 : 1;
+    }
+
+    start = chrono::steady_clock::now();
+    Camera camera = Camera(settings.width, settings.height, cameraOptions);
+    RenderScene *renderScene = scene.compile();
+    RenderStatistics statistics;
+    settings.renderOptions.statistics = &statistics;
+    double buildSeconds = getSecondsSince(start);
 
+    //Tonemapping, encoding and writing happen on a background thread,
+    //so the next frame is rendered while the last one is being written
+    AsyncImageWriter writer;
+    double renderSeconds = 0, encodeSeconds = 0;
+    bool written = true;
+    for (int frame = 0; frame < settings.frames; ++frame)
+    {
+        TraceSpan span("frame", "frame", frame);
+        string filename = getFrameFilename(settings, frame);
+        start = chrono::steady_clock::now();
+        if (settings.stream)
+        {
+            double frameEncodeSeconds = 0;
+            written = streamFrame(camera, *renderScene, settings, filename, frameEncodeSeconds) && written;
+            renderSeconds += getSecondsSince(start) - frameEncodeSeconds;
+            encodeSeconds += frameEncodeSeconds;
+        }
+        else
+        {
+            Framebuffer *framebuffer = camera.captureScene(*renderScene, settings.renderOptions);
+            renderSeconds += getSecondsSince(start);
+            writer.write(filename, framebuffer, settings.toneMapOptions);
+        }
+    }
 
-    RGBAVector *pixels = camera.captureScene(scene, 100);
+    start = chrono::steady_clock::now();
+    writer.finish();
+    double waitSeconds = getSecondsSince(start);
+    if (!settings.traceFile.empty() && !writeTrace(settings.traceFile))
+    {
+        cerr << "Could not write " << settings.traceFile << endl;
+    }
+    if (!settings.stream)
+    {
+        encodeSeconds = writer.getEncodeSeconds();
+        written = writer.getFramesFailed() == 0;
+        writer.printSummary(cout);
+    }
 
-//    stbi_write_png("/Users/lscholte/Desktop/test.png", horizontalPixels, verticalPixels, 4, pixels, horizontalPixels * 4);
-//    system("open /Users/lscholte/Desktop/test.png");
+    cout << "Scene: " << renderScene->getPrimitiveCount() << " primitives, "
+         << renderScene->getLightCount() << " lights" << endl;
+    cout << "Kernels: " << getCpuLevelName(getCpuLevel()) << endl;
+    delete renderScene;
 
-    stbi_write_png("test.png", horizontalPixels, verticalPixels, 4, pixels, horizontalPixels * 4);
-    system("open test.png");
+    cout << "Timing: parse " << parseSeconds << " s, build " << buildSeconds
+         << " s, render " << renderSeconds << " s, encode " << encodeSeconds << " s";
+    if (!settings.stream)
+    {
+        cout << " (" << waitSeconds << " s not overlapped with rendering)";
+    }
+    cout << endl;
+    cout << "Rays: " << statistics.primaryRays << " primary, " << statistics.totalRays << " total, "
+         << statistics.totalRays / renderSeconds / 1e6 << " Mrays/s" << endl;
+    if (settings.printStatistics)
+    {
+#ifdef RAYTRACER_STATS
+        printRenderCounters(cout, statistics.counters);
+#else
+        cout << "Detailed statistics are only counted when built with RAYTRACER_STATS" << endl;
+#endif
+    }
 
+    if (!written)
+    {
+        cerr << "Could not write " << settings.outputFile;
+        if (settings.renderOptions.outputAovs || settings.renderOptions.outputCost)
+        {
+            cerr << " or the AOVs and heatmaps beside it";
+        }
+        cerr << endl;
+        return 1;
+    }
     return 0;
 }
@@ -1,8 +1,10 @@
 #include "material.hpp"
 #include "geometry.hpp"
-#include <random>
+#include "compiledscene.hpp"
+#include "renderstats.hpp"
+#include <math.h>
 
-Vector3 Material::emitted()
+Vector3 Material::emitted() const
 {
     //By default materials do not emit light
     //unless this method is overridden
@@ -14,14 +16,36 @@ Diffuse::Diffuse(const Vector3 &albedo)
     this->albedo = albedo;
 }
 
+//The scattering of each kind of material is written once, here, and
+//shared by its Material class and by scatterFlatMaterial
+static bool scatterDiffuse(const Vector3 &albedo, const HitRecord &rec,
+                           Vector3 &attenuation, Ray &scatteredRay, Sampler &sampler)
+{
+    scatteredRay = Ray(rec.hitLocation, rec.normal + getRandomPointOnUnitSphere(sampler));
+    attenuation = albedo;
+    COUNT_STAT(scattered[STATS_DIFFUSE]);
+    return true;
+}
+
 bool Diffuse::scatter(const Ray &incomingRay,
                      const HitRecord &rec,
                      Vector3 &attenuation,
-                     Ray &scatteredRay) const
+                     Ray &scatteredRay,
+                     Sampler &sampler) const
 {
-    scatteredRay = Ray(rec.hitLocation, rec.normal + getRandomPointOnUnitSphere());
-    attenuation = albedo;
-    return true;
+    return scatterDiffuse(albedo, rec, attenuation, scatteredRay, sampler);
+}
+
+Vector3 Diffuse::getAlbedo() const
+{
+    return albedo;
+}
+
+void Diffuse::flatten(FlatMaterial &flat) const
+{
+    flat.type = FLAT_DIFFUSE;
+    flat.colour = albedo;
+    flat.parameter = 0;
 }
 
 
@@ -43,15 +67,43 @@ Metal::Metal(const Vector3 &albedo, float fuzz)
     }
 }
 
+static bool scatterMetal(const Vector3 &albedo, float fuzz, const Ray &incomingRay, const HitRecord &rec,
+                         Vector3 &attenuation, Ray &scatteredRay, Sampler &sampler)
+{
+    Vector3 reflected = reflect(incomingRay.getDirection().getUnitVector(), rec.normal);
+    scatteredRay = Ray(rec.hitLocation, reflected + getRandomPointOnUnitSphere(sampler)*fuzz);
+    attenuation = albedo;
+    bool scattered = scatteredRay.getDirection().dot(rec.normal) > 0;
+    if (scattered)
+    {
+        COUNT_STAT(scattered[STATS_METAL]);
+    }
+    else
+    {
+        COUNT_STAT(absorbed[STATS_METAL]);
+    }
+    return scattered;
+}
+
 bool Metal::scatter(const Ray &incomingRay,
                      const HitRecord &rec,
                      Vector3 &attenuation,
-                     Ray &scatteredRay) const
+                     Ray &scatteredRay,
+                     Sampler &sampler) const
 {
-    Vector3 reflected = reflect(incomingRay.getDirection().getUnitVector(), rec.normal);
-    scatteredRay = Ray(rec.hitLocation, reflected + getRandomPointOnUnitSphere()*fuzz);
-    attenuation = albedo;
-    return scatteredRay.getDirection().dot(rec.normal) > 0;
+    return scatterMetal(albedo, fuzz, incomingRay, rec, attenuation, scatteredRay, sampler);
+}
+
+Vector3 Metal::getAlbedo() const
+{
+    return albedo;
+}
+
+void Metal::flatten(FlatMaterial &flat) const
+{
+    flat.type = FLAT_METAL;
+    flat.colour = albedo;
+    flat.parameter = fuzz;
 }
 
 Dielectric::Dielectric(float refractiveIndex)
@@ -59,7 +111,8 @@ Dielectric::Dielectric(float refractiveIndex)
     this->refractiveIndex = refractiveIndex;
 }
 
-bool Dielectric::scatter(const Ray &incomingRay, const HitRecord &rec, Vector3 &attenuation, Ray &scatteredRay) const
+static bool scatterDielectric(float refractiveIndex, const Ray &incomingRay, const HitRecord &rec,
+                              Vector3 &attenuation, Ray &scatteredRay, Sampler &sampler)
 {
     Vector3 normal;
     Vector3 reflected = reflect(incomingRay.getDirection(), rec.normal);
@@ -98,7 +151,7 @@ bool Dielectric::scatter(const Ray &incomingRay, const HitRecord &rec, Vector3 &
 
     //The ray has a chance of being reflected instead of refracted
     //based on the probability of reflection produced by
-    if (rand() / ((float) RAND_MAX+1) < reflectProbability)
+    if (sampler.getFloat() < reflectProbability)
     {
         scatteredRay = Ray(rec.hitLocation, reflected);
     }
@@ -106,9 +159,28 @@ bool Dielectric::scatter(const Ray &incomingRay, const HitRecord &rec, Vector3 &
     {
         scatteredRay = Ray(rec.hitLocation, refracted);
     }
+    COUNT_STAT(scattered[STATS_DIELECTRIC]);
     return true;
 }
 
+bool Dielectric::scatter(const Ray &incomingRay, const HitRecord &rec, Vector3 &attenuation, Ray &scatteredRay, Sampler &sampler) const
+{
+    return scatterDielectric(refractiveIndex, incomingRay, rec, attenuation, scatteredRay, sampler);
+}
+
+Vector3 Dielectric::getAlbedo() const
+{
+    //Dielectrics do not absorb any light
+    return Vector3(1, 1, 1);
+}
+
+void Dielectric::flatten(FlatMaterial &flat) const
+{
+    flat.type = FLAT_DIELECTRIC;
+    flat.colour = Vector3(1, 1, 1);
+    flat.parameter = refractiveIndex;
+}
+
 Light::Light()
 {
 }
@@ -121,16 +193,60 @@ Light::Light(const Vector3 &colour)
 bool Light::scatter(const Ray &incomingRay,
                      const HitRecord &rec,
                      Vector3 &attenuation,
-                     Ray &scatteredRay) const
+                     Ray &scatteredRay,
+                     Sampler &sampler) const
 {
+    COUNT_STAT(absorbed[STATS_LIGHT]);
     return false;
 }
 
-Vector3 Light::emitted()
+Vector3 Light::emitted() const
+{
+    return colour;
+}
+
+Vector3 Light::getAlbedo() const
 {
     return colour;
 }
 
+void Light::flatten(FlatMaterial &flat) const
+{
+    flat.type = FLAT_LIGHT;
+    flat.colour = colour;
+    flat.parameter = 0;
+}
+
+bool scatterFlatMaterial(const FlatMaterial &material,
+                         const Ray &incomingRay,
+                         const HitRecord &rec,
+                         Vector3 &attenuation,
+                         Ray &scatteredRay,
+                         Sampler &sampler)
+{
+    switch (material.type)
+    {
+        case FLAT_DIFFUSE:
+            return scatterDiffuse(material.colour, rec, attenuation, scatteredRay, sampler);
+        case FLAT_METAL:
+            return scatterMetal(material.colour, material.parameter, incomingRay, rec, attenuation, scatteredRay, sampler);
+        case FLAT_DIELECTRIC:
+            return scatterDielectric(material.parameter, incomingRay, rec, attenuation, scatteredRay, sampler);
+        default:
+            COUNT_STAT(absorbed[STATS_LIGHT]);
+            return false;
+    }
+}
+
+Vector3 getFlatEmitted(const FlatMaterial &material)
+{
+    if (material.type == FLAT_LIGHT)
+    {
+        return material.colour;
+    }
+    return Vector3(0, 0, 0);
+}
+
 Vector3 reflect(const Vector3 &v, const Vector3 &n)
 {
     return v - n*2*v.dot(n);
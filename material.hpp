@@ -2,14 +2,37 @@
 #define MATERIAL_HPP
 
 #include "surface.hpp"
+#include "sampler.hpp"
+
+struct FlatMaterial;
 
 Vector3 reflect(const Vector3 &v, const Vector3 &n);
 bool refract(Vector3 v, Vector3 n, float refractiveIndexFrom, float refractiveIndexTo, Vector3 &refracted, float &outgoingCosTheta);
 float getSchlickApproximation(float cosine, float refractiveIndexFrom, float refractiveIndexTo);
 
+/**
+ * @brief scatterFlatMaterial Scatters a ray off a flattened material,
+ * switching on its type rather than calling through a Material. This
+ * gives the same results as the scatter of the Material it came from.
+ * @return Whether the ray was scattered
+ */
+bool scatterFlatMaterial(const FlatMaterial &material,
+                         const Ray &incomingRay,
+                         const HitRecord &rec,
+                         Vector3 &attenuation,
+                         Ray &scatteredRay,
+                         Sampler &sampler);
+
+/**
+ * @brief getFlatEmitted The light emitted by a flattened material
+ */
+Vector3 getFlatEmitted(const FlatMaterial &material);
+
 class Material
 {
     public:
+        virtual ~Material() {}
+
         /**
          * @brief scatter Determines if an incoming ray should be scattered
          * upon hitting the Material
@@ -17,14 +40,28 @@ class Material
          * @param rec The HitRecord containing information about the ray hit
          * @param attenuation
          * @param scatteredRay The scattered ray
+         * @param sampler The random numbers of the sample being traced
          * @return
          */
         virtual bool scatter(const Ray &incomingRay,
                              const HitRecord &rec,
                              Vector3 &attenuation,
-                             Ray &scatteredRay) const = 0;
+                             Ray &scatteredRay,
+                             Sampler &sampler) const = 0;
 
-        virtual Vector3 emitted();
+        virtual Vector3 emitted() const;
+
+        /**
+         * @brief getAlbedo The colour of the Material as seen by the
+         * albedo AOV, independent of lighting
+         */
+        virtual Vector3 getAlbedo() const = 0;
+
+        /**
+         * @brief flatten Describes the Material as a plain record for a
+         * compiled scene
+         */
+        virtual void flatten(FlatMaterial &flat) const = 0;
 };
 
 class Diffuse : public Material
@@ -37,7 +74,10 @@ class Diffuse : public Material
         virtual bool scatter(const Ray &incomingRay,
                              const HitRecord &rec,
                              Vector3 &attenuation,
-                             Ray &scatteredRay) const;
+                             Ray &scatteredRay,
+                             Sampler &sampler) const;
+        virtual Vector3 getAlbedo() const;
+        virtual void flatten(FlatMaterial &flat) const;
 
     private:
         Vector3 albedo;
@@ -52,7 +92,10 @@ class Metal : public Material
         virtual bool scatter(const Ray &incomingRay,
                              const HitRecord &rec,
                              Vector3 &attenuation,
-                             Ray &scatteredRay) const;
+                             Ray &scatteredRay,
+                             Sampler &sampler) const;
+        virtual Vector3 getAlbedo() const;
+        virtual void flatten(FlatMaterial &flat) const;
 
     private:
         Vector3 albedo;
@@ -67,7 +110,10 @@ class Dielectric : public Material
         virtual bool scatter(const Ray &incomingRay,
                              const HitRecord &rec,
                              Vector3 &attenuation,
-                             Ray &scatteredRay) const;
+                             Ray &scatteredRay,
+                             Sampler &sampler) const;
+        virtual Vector3 getAlbedo() const;
+        virtual void flatten(FlatMaterial &flat) const;
 
     private:
         float refractiveIndex;
@@ -82,8 +128,11 @@ class Light : public Material
         virtual bool scatter(const Ray &incomingRay,
                              const HitRecord &rec,
                              Vector3 &attenuation,
-                             Ray &scatteredRay) const;
-        virtual Vector3 emitted();
+                             Ray &scatteredRay,
+                             Sampler &sampler) const;
+        virtual Vector3 emitted() const;
+        virtual Vector3 getAlbedo() const;
+        virtual void flatten(FlatMaterial &flat) const;
 
     private:
         Vector3 colour;
@@ -0,0 +1,605 @@
+#include "pngwriter.hpp"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+//Size of the sliding window that deflate back references may reach into
+static const int WINDOW_SIZE = 32768;
+static const int HASH_BITS = 15;
+static const int MAX_CHAIN_LENGTH = 32;
+static const int MIN_MATCH = 3;
+static const int MAX_MATCH = 258;
+
+//Rows are grouped into chunks of roughly this many bytes before being
+//deflated, which keeps every thread busy without hurting compression much
+static const int TARGET_CHUNK_BYTES = 1 << 18;
+
+static const unsigned short LENGTH_BASE[] = { 3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258, 259 };
+static const unsigned char LENGTH_EXTRA[] = { 0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0 };
+static const unsigned short DISTANCE_BASE[] = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577, 32769 };
+static const unsigned char DISTANCE_EXTRA[] = { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13 };
+
+/**
+ * Packs variable length codes into bytes, least significant bit first,
+ * as required by deflate
+ * @brief The BitWriter class
+ */
+class BitWriter
+{
+    public:
+        BitWriter(std::vector<unsigned char> &out)
+            : out(out)
+        {
+            bits = 0;
+            count = 0;
+        }
+
+        void add(unsigned int code, int length)
+        {
+            bits |= (uint64_t) code << count;
+            count += length;
+            while (count >= 8)
+            {
+                out.push_back((unsigned char) bits);
+                bits >>= 8;
+                count -= 8;
+            }
+        }
+
+        //Pads with zero bits up to the next byte boundary
+        void align()
+        {
+            if (count > 0)
+            {
+                add(0, 8 - count);
+            }
+        }
+
+    private:
+        std::vector<unsigned char> &out;
+        uint64_t bits;
+        int count;
+};
+
+static unsigned int reverseBits(unsigned int code, int length)
+{
+    unsigned int reversed = 0;
+    while (length--)
+    {
+        reversed = (reversed << 1) | (code & 1);
+        code >>= 1;
+    }
+    return reversed;
+}
+
+//Writes a literal/length symbol using the fixed Huffman code of deflate
+static void addFixedSymbol(BitWriter &writer, int symbol)
+{
+    if (symbol <= 143)
+    {
+        writer.add(reverseBits(0x30 + symbol, 8), 8);
+    }
+    else if (symbol <= 255)
+    {
+        writer.add(reverseBits(0x190 + symbol - 144, 9), 9);
+    }
+    else if (symbol <= 279)
+    {
+        writer.add(reverseBits(symbol - 256, 7), 7);
+    }
+    else
+    {
+        writer.add(reverseBits(0xc0 + symbol - 280, 8), 8);
+    }
+}
+
+static void addMatch(BitWriter &writer, int length, int distance)
+{
+    int code = 0;
+    while (length >= LENGTH_BASE[code+1])
+    {
+        ++code;
+    }
+    addFixedSymbol(writer, 257 + code);
+    if (LENGTH_EXTRA[code])
+    {
+        writer.add(length - LENGTH_BASE[code], LENGTH_EXTRA[code]);
+    }
+
+    code = 0;
+    while (distance >= DISTANCE_BASE[code+1])
+    {
+        ++code;
+    }
+    writer.add(reverseBits(code, 5), 5);
+    if (DISTANCE_EXTRA[code])
+    {
+        writer.add(distance - DISTANCE_BASE[code], DISTANCE_EXTRA[code]);
+    }
+}
+
+static unsigned int hashBytes(const unsigned char *data)
+{
+    uint32_t value = data[0] | (data[1] << 8) | (data[2] << 16);
+    return (value * 2654435761u) >> (32 - HASH_BITS);
+}
+
+/**
+ * @brief deflateBlock Compresses data into a fixed Huffman deflate block
+ * that does not reference anything outside of the data. The output always
+ * ends on a byte boundary: a final block is padded, while any other block
+ * is followed by an empty stored block, so blocks compressed separately
+ * can be concatenated into one valid deflate stream.
+ * @param data The data to compress
+ * @param length The number of bytes of data
+ * @param isFinal Whether this is the last block of the stream
+ * @param out The compressed bytes are appended to out
+ */
+void deflateBlock(const unsigned char *data, size_t length, bool isFinal, std::vector<unsigned char> &out)
+{
+    BitWriter writer(out);
+    writer.add(isFinal ? 1 : 0, 1);
+    writer.add(1, 2);
+
+    std::vector<int> head(1 << HASH_BITS, -1);
+    std::vector<int> previous(length);
+
+    size_t i = 0;
+    while (i + MIN_MATCH <= length)
+    {
+        unsigned int hash = hashBytes(data + i);
+        int bestLength = 0, bestDistance = 0;
+        int maxLength = (int) std::min<size_t>(MAX_MATCH, length - i);
+
+        //Walk the chain of earlier positions with the same hash
+        int candidate = head[hash];
+        for (int chain = 0; chain < MAX_CHAIN_LENGTH && candidate >= 0 && i - candidate <= (size_t) WINDOW_SIZE; ++chain)
+        {
+            const unsigned char *a = data + candidate;
+            const unsigned char *b = data + i;
+            int matchLength = 0;
+            while (matchLength < maxLength && a[matchLength] == b[matchLength])
+            {
+                ++matchLength;
+            }
+            if (matchLength > bestLength)
+            {
+                bestLength = matchLength;
+                bestDistance = (int) (i - candidate);
+                if (matchLength == maxLength)
+                {
+                    break;
+                }
+            }
+            candidate = previous[candidate];
+        }
+
+        previous[i] = head[hash];
+        head[hash] = (int) i;
+
+        if (bestLength >= MIN_MATCH)
+        {
+            addMatch(writer, bestLength, bestDistance);
+            for (size_t k = i + 1; k < i + bestLength && k + MIN_MATCH <= length; ++k)
+            {
+                unsigned int h = hashBytes(data + k);
+                previous[k] = head[h];
+                head[h] = (int) k;
+            }
+            i += bestLength;
+        }
+        else
+        {
+            addFixedSymbol(writer, data[i]);
+            ++i;
+        }
+    }
+    for (; i < length; ++i)
+    {
+        addFixedSymbol(writer, data[i]);
+    }
+
+    //End of block
+    addFixedSymbol(writer, 256);
+
+    if (!isFinal)
+    {
+        //Empty stored block, which realigns the stream to a byte boundary
+        writer.add(0, 3);
+        writer.align();
+        out.push_back(0x00);
+        out.push_back(0x00);
+        out.push_back(0xff);
+        out.push_back(0xff);
+    }
+    else
+    {
+        writer.align();
+    }
+}
+
+unsigned int getAdler32(unsigned int adler, const unsigned char *data, size_t length)
+{
+    unsigned int s1 = adler & 0xffff, s2 = adler >> 16;
+    while (length > 0)
+    {
+        //5552 is the most bytes that can be summed before s2 may overflow
+        size_t block = std::min<size_t>(length, 5552);
+        for (size_t k = 0; k < block; ++k)
+        {
+            s1 += data[k];
+            s2 += s1;
+        }
+        s1 %= 65521;
+        s2 %= 65521;
+        data += block;
+        length -= block;
+    }
+    return (s2 << 16) | s1;
+}
+
+/**
+ * @brief combineAdler32 Computes the Adler-32 checksum of two pieces of
+ * data joined together from the checksums of the pieces
+ * @param adler1 The checksum of the first piece
+ * @param adler2 The checksum of the second piece
+ * @param length2 The length of the second piece
+ * @return The checksum of the joined data
+ */
+unsigned int combineAdler32(unsigned int adler1, unsigned int adler2, size_t length2)
+{
+    const unsigned int base = 65521;
+    unsigned int remainder = (unsigned int) (length2 % base);
+    unsigned int sum1 = adler1 & 0xffff;
+    unsigned int sum2 = (unsigned int) (((uint64_t) remainder * sum1) % base);
+    sum1 += (adler2 & 0xffff) + base - 1;
+    sum2 += (adler1 >> 16) + (adler2 >> 16) + base - remainder;
+    if (sum1 >= base) sum1 -= base;
+    if (sum1 >= base) sum1 -= base;
+    if (sum2 >= (base << 1)) sum2 -= (base << 1);
+    if (sum2 >= base) sum2 -= base;
+    return (sum2 << 16) | sum1;
+}
+
+static std::vector<unsigned int> makeCrcTable()
+{
+    std::vector<unsigned int> table(256);
+    for (unsigned int n = 0; n < 256; ++n)
+    {
+        unsigned int c = n;
+        for (int k = 0; k < 8; ++k)
+        {
+            c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        }
+        table[n] = c;
+    }
+    return table;
+}
+
+unsigned int getCrc32(unsigned int crc, const unsigned char *data, size_t length)
+{
+    static const std::vector<unsigned int> table = makeCrcTable();
+    crc = ~crc;
+    for (size_t k = 0; k < length; ++k)
+    {
+        crc = table[(crc ^ data[k]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static unsigned char getPaethPredictor(int a, int b, int c)
+{
+    int p = a + b - c, pa = abs(p-a), pb = abs(p-b), pc = abs(p-c);
+    if (pa <= pb && pa <= pc) return (unsigned char) a;
+    if (pb <= pc) return (unsigned char) b;
+    return (unsigned char) c;
+}
+
+/**
+ * @brief filterRow Applies whichever PNG filter makes the row smallest,
+ * estimated as the sum of the absolute filtered values
+ * @param row The row to filter
+ * @param prior The row above, or a row of zeros for the first row of the image
+ * @param rowBytes The number of bytes in a row
+ * @param bpp The number of bytes per pixel
+ * @param out Receives the filter type followed by the filtered row
+ * @param candidate Scratch storage of at least rowBytes bytes
+ */
+static void filterRow(const unsigned char *row, const unsigned char *prior, int rowBytes, int bpp,
+                      unsigned char *out, unsigned char *candidate)
+{
+    int bestSum = -1;
+    for (int type = 0; type < 5; ++type)
+    {
+        //The first pixel has no left neighbour
+        for (int k = 0; k < bpp; ++k)
+        {
+            switch (type)
+            {
+                case 0: candidate[k] = row[k]; break;
+                case 1: candidate[k] = row[k]; break;
+                case 2: candidate[k] = row[k] - prior[k]; break;
+                case 3: candidate[k] = row[k] - (prior[k] >> 1); break;
+                case 4: candidate[k] = row[k] - prior[k]; break;
+            }
+        }
+
+        switch (type)
+        {
+            case 0:
+                memcpy(candidate + bpp, row + bpp, rowBytes - bpp);
+                break;
+            case 1:
+                for (int k = bpp; k < rowBytes; ++k)
+                {
+                    candidate[k] = row[k] - row[k-bpp];
+                }
+                break;
+            case 2:
+                for (int k = bpp; k < rowBytes; ++k)
+                {
+                    candidate[k] = row[k] - prior[k];
+                }
+                break;
+            case 3:
+                for (int k = bpp; k < rowBytes; ++k)
+                {
+                    candidate[k] = row[k] - ((row[k-bpp] + prior[k]) >> 1);
+                }
+                break;
+            case 4:
+                for (int k = bpp; k < rowBytes; ++k)
+                {
+                    candidate[k] = row[k] - getPaethPredictor(row[k-bpp], prior[k], prior[k-bpp]);
+                }
+                break;
+        }
+
+        int sum = 0;
+        for (int k = 0; k < rowBytes; ++k)
+        {
+            sum += abs((signed char) candidate[k]);
+        }
+        if (bestSum < 0 || sum < bestSum)
+        {
+            bestSum = sum;
+            out[0] = (unsigned char) type;
+            memcpy(out + 1, candidate, rowBytes);
+        }
+    }
+}
+
+PngWriter::PngWriter()
+{
+    file = NULL;
+    width = height = components = 0;
+    rowsWritten = 0;
+    rowsPerChunk = 0;
+    failed = false;
+    adler = 1;
+}
+
+PngWriter::~PngWriter()
+{
+    if (file)
+    {
+        fclose(file);
+    }
+}
+
+/**
+ * @brief setRowsPerChunk Sets how many rows are deflated together by one
+ * thread. By default this is chosen from the row size.
+ */
+void PngWriter::setRowsPerChunk(int rowsPerChunk)
+{
+    this->rowsPerChunk = rowsPerChunk;
+}
+
+/**
+ * @brief open Creates the file and writes the PNG header
+ * @param filename The file to write
+ * @param width The number of pixels in each row
+ * @param height The number of rows that will be written
+ * @param components The number of 8-bit channels per pixel, from 1 to 4
+ * @return Whether the file could be created
+ */
+bool PngWriter::open(const std::string &filename, int width, int height, int components)
+{
+    if (components < 1 || components > 4 || width <= 0 || height <= 0)
+    {
+        return false;
+    }
+
+    FILE *file = fopen(filename.c_str(), "wb");
+    if (!file)
+    {
+        return false;
+    }
+    return open(file, width, height, components);
+}
+
+/**
+ * @brief open Writes the PNG header to a stream that is already open,
+ * such as one from open_memstream. The writer takes ownership of the
+ * stream and closes it in close().
+ * @param file The stream to write
+ * @param width The number of pixels in each row
+ * @param height The number of rows that will be written
+ * @param components The number of 8-bit channels per pixel, from 1 to 4
+ * @return Whether the header was written
+ */
+bool PngWriter::open(FILE *file, int width, int height, int components)
+{
+    static const int colourTypes[] = { -1, 0, 4, 2, 6 };
+    static const unsigned char signature[] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+
+    this->file = file;
+    if (!file || components < 1 || components > 4 || width <= 0 || height <= 0)
+    {
+        failed = true;
+        return false;
+    }
+
+    this->width = width;
+    this->height = height;
+    this->components = components;
+    rowsWritten = 0;
+    failed = false;
+    adler = 1;
+    previousRow.clear();
+
+    unsigned char header[13] = {
+        (unsigned char) (width >> 24), (unsigned char) (width >> 16), (unsigned char) (width >> 8), (unsigned char) width,
+        (unsigned char) (height >> 24), (unsigned char) (height >> 16), (unsigned char) (height >> 8), (unsigned char) height,
+        8, (unsigned char) colourTypes[components], 0, 0, 0
+    };
+
+    failed = fwrite(signature, 1, sizeof(signature), file) != sizeof(signature) ||
+            !writeChunk("IHDR", header, sizeof(header));
+    return !failed;
+}
+
+/**
+ * @brief writeRows Filters, compresses and writes the next rows of the
+ * image. The caller may release the rows as soon as this returns.
+ * @param rows The first byte of the first row
+ * @param rowCount The number of rows to write
+ * @param stride The number of bytes between the starts of consecutive rows
+ * @return Whether the rows were written
+ */
+bool PngWriter::writeRows(const unsigned char *rows, int rowCount, int stride)
+{
+    if (!file || failed || rowCount <= 0 || rowsWritten + rowCount > height)
+    {
+        failed = true;
+        return false;
+    }
+
+    int rowBytes = width * components;
+    int chunkRows = rowsPerChunk > 0 ? rowsPerChunk : std::max(1, TARGET_CHUNK_BYTES / (rowBytes + 1));
+    int chunkCount = (rowCount + chunkRows - 1) / chunkRows;
+    bool containsLastRow = rowsWritten + rowCount == height;
+
+    std::vector<std::vector<unsigned char> > compressed(chunkCount);
+    std::vector<unsigned int> checksums(chunkCount);
+    std::vector<size_t> lengths(chunkCount);
+
+#pragma omp parallel for schedule(dynamic)
+    for (int chunk = 0; chunk < chunkCount; ++chunk)
+    {
+        int firstRow = chunk * chunkRows;
+        int chunkRowCount = std::min(chunkRows, rowCount - firstRow);
+        std::vector<unsigned char> filtered(chunkRowCount * (rowBytes + 1));
+        std::vector<unsigned char> candidate(rowBytes);
+        std::vector<unsigned char> zeros(rowBytes, 0);
+
+        for (int r = 0; r < chunkRowCount; ++r)
+        {
+            int row = firstRow + r;
+            const unsigned char *prior = zeros.data();
+            if (row > 0)
+            {
+                prior = rows + (row-1) * (size_t) stride;
+            }
+            else if (!previousRow.empty())
+            {
+                prior = previousRow.data();
+            }
+            filterRow(rows + row * (size_t) stride, prior, rowBytes, components,
+                      filtered.data() + r * (rowBytes + 1), candidate.data());
+        }
+
+        checksums[chunk] = getAdler32(1, filtered.data(), filtered.size());
+        lengths[chunk] = filtered.size();
+        deflateBlock(filtered.data(), filtered.size(),
+                     containsLastRow && chunk == chunkCount - 1, compressed[chunk]);
+    }
+
+    for (int chunk = 0; chunk < chunkCount; ++chunk)
+    {
+        std::vector<unsigned char> &data = compressed[chunk];
+        if (rowsWritten == 0 && chunk == 0)
+        {
+            //zlib header: deflate with a 32K window
+            data.insert(data.begin(), 0x5e);
+            data.insert(data.begin(), 0x78);
+        }
+
+        adler = combineAdler32(adler, checksums[chunk], lengths[chunk]);
+        if (containsLastRow && chunk == chunkCount - 1)
+        {
+            data.push_back((unsigned char) (adler >> 24));
+            data.push_back((unsigned char) (adler >> 16));
+            data.push_back((unsigned char) (adler >> 8));
+            data.push_back((unsigned char) adler);
+        }
+
+        if (!writeChunk("IDAT", data.data(), data.size()))
+        {
+            failed = true;
+            return false;
+        }
+    }
+
+    const unsigned char *lastRow = rows + (rowCount-1) * (size_t) stride;
+    previousRow.assign(lastRow, lastRow + rowBytes);
+    rowsWritten += rowCount;
+    return true;
+}
+
+/**
+ * @brief close Finishes the PNG and closes the file
+ * @return Whether every row of the image was written successfully
+ */
+bool PngWriter::close()
+{
+    if (!file)
+    {
+        return false;
+    }
+
+    bool complete = !failed && rowsWritten == height && writeChunk("IEND", NULL, 0);
+    complete = fclose(file) == 0 && complete;
+    file = NULL;
+    return complete;
+}
+
+bool PngWriter::writeChunk(const char *type, const unsigned char *data, size_t length)
+{
+    unsigned char header[8] = {
+        (unsigned char) (length >> 24), (unsigned char) (length >> 16), (unsigned char) (length >> 8), (unsigned char) length,
+        (unsigned char) type[0], (unsigned char) type[1], (unsigned char) type[2], (unsigned char) type[3]
+    };
+    unsigned int crc = getCrc32(0, header + 4, 4);
+    crc = getCrc32(crc, data, length);
+    unsigned char footer[4] = {
+        (unsigned char) (crc >> 24), (unsigned char) (crc >> 16), (unsigned char) (crc >> 8), (unsigned char) crc
+    };
+
+    return fwrite(header, 1, 8, file) == 8 &&
+            (length == 0 || fwrite(data, 1, length, file) == length) &&
+            fwrite(footer, 1, 4, file) == 4;
+}
+
+/**
+ * @brief writePng Writes a whole image as a PNG using every thread
+ * @param filename The file to write
+ * @param width The number of pixels in each row
+ * @param height The number of rows
+ * @param components The number of 8-bit channels per pixel, from 1 to 4
+ * @param pixels The first byte of the first row
+ * @param stride The number of bytes between the starts of consecutive rows
+ * @return Whether the file was written
+ */
+bool writePng(const std::string &filename, int width, int height, int components, const void *pixels, int stride)
+{
+    PngWriter writer;
+    if (!writer.open(filename, width, height, components))
+    {
+        return false;
+    }
+    writer.writeRows((const unsigned char *) pixels, height, stride);
+    return writer.close();
+}
@@ -0,0 +1,46 @@
+#ifndef PNGWRITER_HPP
+#define PNGWRITER_HPP
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+/**
+ * Writes a PNG file a block of rows at a time. The rows of each block
+ * are split into chunks that are filtered and deflated independently
+ * on multiple threads, then joined into one zlib stream.
+ * @brief The PngWriter class
+ */
+class PngWriter
+{
+    public:
+        PngWriter();
+        ~PngWriter();
+
+        bool open(const std::string &filename, int width, int height, int components);
+        bool open(FILE *file, int width, int height, int components);
+        bool writeRows(const unsigned char *rows, int rowCount, int stride);
+        bool close();
+
+        void setRowsPerChunk(int rowsPerChunk);
+
+    private:
+        FILE *file;
+        int width, height, components;
+        int rowsWritten;
+        int rowsPerChunk;
+        bool failed;
+        unsigned int adler;
+        std::vector<unsigned char> previousRow;
+
+        bool writeChunk(const char *type, const unsigned char *data, size_t length);
+};
+
+bool writePng(const std::string &filename, int width, int height, int components, const void *pixels, int stride);
+
+unsigned int getAdler32(unsigned int adler, const unsigned char *data, size_t length);
+unsigned int combineAdler32(unsigned int adler1, unsigned int adler2, size_t length2);
+unsigned int getCrc32(unsigned int crc, const unsigned char *data, size_t length);
+void deflateBlock(const unsigned char *data, size_t length, bool isFinal, std::vector<unsigned char> &out);
+
+#endif // PNGWRITER_HPP
@@ -0,0 +1,112 @@
+#include "raybatch.hpp"
+#include <algorithm>
+#include <float.h>
+
+//Number of bits used to quantise each axis of a ray origin
+static const int CELL_BITS = 9;
+static const uint32_t CELL_COUNT = 1 << CELL_BITS;
+
+/**
+ * @brief spreadBits Inserts two zero bits between each of the
+ * lowest CELL_BITS bits of x so that three of them can be interleaved
+ */
+static uint32_t spreadBits(uint32_t x)
+{
+    x &= 0x3ff;
+    x = (x | (x << 16)) & 0x030000ff;
+    x = (x | (x << 8)) & 0x0300f00f;
+    x = (x | (x << 4)) & 0x030c30c3;
+    x = (x | (x << 2)) & 0x09249249;
+    return x;
+}
+
+static uint32_t quantise(float value, float minValue, float scale)
+{
+    float cell = (value - minValue) * scale;
+    if (cell <= 0)
+    {
+        return 0;
+    }
+    if (cell >= CELL_COUNT - 1)
+    {
+        return CELL_COUNT - 1;
+    }
+    return (uint32_t) cell;
+}
+
+/**
+ * @brief getCoherenceKey Computes a sort key for a ray so that rays
+ * travelling in the same direction octant from nearby origins end up
+ * next to each other. The octant occupies the top bits and the Morton
+ * code of the quantised origin occupies the rest.
+ * @param ray The ray to compute the key for
+ * @param minCorner The minimum corner of the box bounding all origins
+ * @param cellScale The number of cells per unit length along each axis
+ * @return The sort key
+ */
+uint32_t getCoherenceKey(const Ray &ray, const Vector3 &minCorner, const Vector3 &cellScale)
+{
+    Vector3 origin = ray.getOrigin();
+    Vector3 direction = ray.getDirection();
+
+    uint32_t octant = (direction.x < 0 ? 1 : 0) |
+            (direction.y < 0 ? 2 : 0) |
+            (direction.z < 0 ? 4 : 0);
+
+    uint32_t cell = spreadBits(quantise(origin.x, minCorner.x, cellScale.x)) |
+            (spreadBits(quantise(origin.y, minCorner.y, cellScale.y)) << 1) |
+            (spreadBits(quantise(origin.z, minCorner.z, cellScale.z)) << 2);
+
+    return (octant << (3*CELL_BITS)) | cell;
+}
+
+/**
+ * @brief sortPathsByCoherence Reorders a batch of paths by origin cell
+ * and direction octant so that consecutive rays touch the same
+ * surfaces. The grid is fitted to the bounds of the batch itself,
+ * which keeps it meaningful for scenes containing unbounded Planes.
+ * @param paths The paths to reorder
+ * @param scratch Storage reused between calls to avoid reallocating
+ */
+void sortPathsByCoherence(std::vector<PathState> &paths, std::vector<PathState> &scratch)
+{
+    if (paths.size() < 2)
+    {
+        return;
+    }
+
+    Vector3 minCorner(FLT_MAX, FLT_MAX, FLT_MAX);
+    Vector3 maxCorner(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    for (const PathState &path : paths)
+    {
+        Vector3 origin = path.ray.getOrigin();
+        minCorner = Vector3(std::min(minCorner.x, origin.x),
+                            std::min(minCorner.y, origin.y),
+                            std::min(minCorner.z, origin.z));
+        maxCorner = Vector3(std::max(maxCorner.x, origin.x),
+                            std::max(maxCorner.y, origin.y),
+                            std::max(maxCorner.z, origin.z));
+    }
+
+    Vector3 extent = maxCorner - minCorner;
+    Vector3 cellScale(extent.x > 0 ? CELL_COUNT / extent.x : 0,
+                      extent.y > 0 ? CELL_COUNT / extent.y : 0,
+                      extent.z > 0 ? CELL_COUNT / extent.z : 0);
+
+    //Pack the key and the original index together so a plain
+    //integer sort orders by key while remaining stable
+    std::vector<uint64_t> keys(paths.size());
+    for (size_t k = 0; k < paths.size(); ++k)
+    {
+        uint64_t key = getCoherenceKey(paths[k].ray, minCorner, cellScale);
+        keys[k] = (key << 32) | k;
+    }
+    std::sort(keys.begin(), keys.end());
+
+    scratch.resize(paths.size());
+    for (size_t k = 0; k < keys.size(); ++k)
+    {
+        scratch[k] = paths[keys[k] & 0xffffffff];
+    }
+    paths.swap(scratch);
+}
@@ -0,0 +1,26 @@
+#ifndef RAYBATCH_HPP
+#define RAYBATCH_HPP
+
+#include "ray.hpp"
+#include "sampler.hpp"
+#include <vector>
+#include <stdint.h>
+
+/**
+ * The state of a single path that is being traced as part of a batch
+ * @brief The PathState struct
+ */
+struct PathState
+{
+    public:
+        Ray ray;
+        Vector3 throughput;
+        int pixel;
+        int depth;
+        Sampler sampler;
+};
+
+uint32_t getCoherenceKey(const Ray &ray, const Vector3 &minCorner, const Vector3 &cellScale);
+void sortPathsByCoherence(std::vector<PathState> &paths, std::vector<PathState> &scratch);
+
+#endif // RAYBATCH_HPP
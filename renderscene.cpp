@@ -0,0 +1,149 @@
+#include "renderscene.hpp"
+
+/**
+ * @brief RenderScene Flattens the surfaces and materials of a scene. If
+ * the scene is just a compiled scene, its sections are used where they
+ * are mapped and nothing is flattened, so the compiled scene must
+ * outlive the RenderScene. Otherwise the only pointers kept into the
+ * scene are to the spheres of its SphereClouds, which must not change
+ * while the RenderScene is in use.
+ * @param scene The scene to flatten
+ */
+RenderScene::RenderScene(const Scene &scene)
+{
+    background = scene.getBackground();
+
+    std::vector<Surface *> surfaces = scene.getSurfaces();
+    const FlatSceneSurface *compiled = NULL;
+    if (surfaces.size() == 1)
+    {
+        compiled = dynamic_cast<const FlatSceneSurface *>(surfaces[0]);
+    }
+
+    if (compiled)
+    {
+        primitives = compiled->getPrimitives();
+        materials = compiled->getFlatMaterials();
+        materialCount = compiled->getMaterialCount();
+        lightCount = compiled->getLights().size();
+        return;
+    }
+
+    SceneCompiler compiler;
+    for (Surface *surface : surfaces)
+    {
+        surface->flatten(compiler);
+    }
+    compiler.takeScene(storage);
+
+    primitives = storage.getPrimitives();
+    materials = storage.materials.data();
+    materialCount = storage.materials.size();
+    lightCount = storage.lights.size();
+}
+
+RenderScene::RenderScene()
+{
+}
+
+template <typename T>
+static void appendRecords(std::vector<T> &target, const T *records, size_t count)
+{
+    target.insert(target.end(), records, records + count);
+}
+
+/**
+ * @brief replicate Copies every array the scene renders from into arrays
+ * of the copy's own, including the spheres of clouds and the sections of
+ * a compiled scene. Pages are placed on the NUMA node of the thread that
+ * first writes them, so a copy made by a thread pinned to a node is local
+ * to that node. The copy renders the same image as the scene.
+ * @return The copy, which the caller must delete
+ */
+RenderScene * RenderScene::replicate() const
+{
+    RenderScene *copy = new RenderScene();
+    FlatScene &target = copy->storage;
+    appendRecords(target.materials, materials, materialCount);
+    appendRecords(target.planes, primitives.planes, primitives.planeCount);
+    appendRecords(target.rectangles, primitives.rectangles, primitives.rectangleCount);
+    appendRecords(target.triangles, primitives.triangles, primitives.triangleCount);
+
+    //Clouds are tested after the other spheres and only take closer hits,
+    //so appending them to the sphere arrays finds the same hits
+    size_t sphereCount = getPrimitiveCount() - primitives.planeCount - primitives.rectangleCount - primitives.triangleCount;
+    target.sphereX.reserve(sphereCount);
+    target.sphereY.reserve(sphereCount);
+    target.sphereZ.reserve(sphereCount);
+    target.sphereRadius.reserve(sphereCount);
+    target.sphereMaterials.reserve(sphereCount);
+    appendRecords(target.sphereX, primitives.spheres.x, primitives.spheres.count);
+    appendRecords(target.sphereY, primitives.spheres.y, primitives.spheres.count);
+    appendRecords(target.sphereZ, primitives.spheres.z, primitives.spheres.count);
+    appendRecords(target.sphereRadius, primitives.spheres.radius, primitives.spheres.count);
+    appendRecords(target.sphereMaterials, primitives.sphereMaterials, primitives.spheres.count);
+    for (const FlatSphereCloud &cloud : storage.clouds)
+    {
+        appendRecords(target.sphereX, cloud.spheres.x, cloud.spheres.count);
+        appendRecords(target.sphereY, cloud.spheres.y, cloud.spheres.count);
+        appendRecords(target.sphereZ, cloud.spheres.z, cloud.spheres.count);
+        appendRecords(target.sphereRadius, cloud.spheres.radius, cloud.spheres.count);
+        for (size_t k = 0; k < cloud.spheres.count; ++k)
+        {
+            target.sphereMaterials.push_back(cloud.materials[cloud.materialIndices[k]]);
+        }
+    }
+
+    copy->background = background;
+    copy->primitives = target.getPrimitives();
+    copy->materials = target.materials.data();
+    copy->materialCount = target.materials.size();
+    copy->lightCount = lightCount;
+    return copy;
+}
+
+/**
+ * @brief hitWithRay Finds the closest primitive hit by a ray
+ * @return Whether any primitive was hit
+ */
+bool RenderScene::hitWithRay(const Ray &r, float minT, float maxT, HitRecord &rec) const
+{
+    bool surfaceHit = hitFlatPrimitives(primitives, NULL, r, minT, maxT, rec);
+
+    for (const FlatSphereCloud &cloud : storage.clouds)
+    {
+        float t;
+        size_t index;
+        if (hitSphereArrays(cloud.spheres, r, minT, surfaceHit ? rec.t : maxT, t, index))
+        {
+            fillSphereHit(cloud.spheres, index, r, t, rec);
+            rec.material = NULL;
+            rec.materialIndex = cloud.materials[cloud.materialIndices[index]];
+            surfaceHit = true;
+        }
+    }
+    return surfaceHit;
+}
+
+Vector3 RenderScene::getBackground() const
+{
+    return background;
+}
+
+size_t RenderScene::getPrimitiveCount() const
+{
+    size_t count = primitives.planeCount + primitives.spheres.count + primitives.rectangleCount + primitives.triangleCount;
+    for (const FlatSphereCloud &cloud : storage.clouds)
+    {
+        count += cloud.spheres.count;
+    }
+    return count;
+}
+
+/**
+ * @brief getLightCount The number of primitives that emit light
+ */
+size_t RenderScene::getLightCount() const
+{
+    return lightCount;
+}
@@ -0,0 +1,66 @@
+#ifndef RENDERSCENE_HPP
+#define RENDERSCENE_HPP
+
+#include "compiledscene.hpp"
+#include "spherecloud.hpp"
+#include <vector>
+
+/**
+ * The read-only form of a Scene that is rendered. Every Surface is
+ * flattened into arrays of primitives in world space, as for a compiled
+ * scene, and every Material into a compact table of FlatMaterials that
+ * is shaded by switching on their type, so tracing a ray needs no
+ * virtual calls, transforms or allocation. Spheres are kept as
+ * SphereArrays so that they can be tested several at a time. A scene
+ * that is just a compiled scene is rendered from the sections of the
+ * compiled file where they are mapped. Nothing can be changed once it
+ * has been built, so any number of threads can trace rays through it;
+ * replicate() gives each NUMA node a copy in its own memory.
+ * @brief The RenderScene class
+ */
+class RenderScene
+{
+    public:
+        RenderScene(const Scene &scene);
+
+        RenderScene * replicate() const;
+
+        /**
+         * @brief hitWithRay Finds the closest primitive hit by a ray
+         * @return Whether any primitive was hit
+         */
+        bool hitWithRay(const Ray &r, float minT, float maxT, HitRecord &rec) const;
+
+        /**
+         * @brief getMaterial The material of a hit, which is shaded with
+         * scatterFlatMaterial and getFlatEmitted
+         * @param index The HitRecord::materialIndex of the hit
+         */
+        const FlatMaterial & getMaterial(uint32_t index) const
+        {
+            return materials[index];
+        }
+
+        Vector3 getBackground() const;
+        size_t getPrimitiveCount() const;
+        size_t getLightCount() const;
+
+    private:
+        Vector3 background;
+
+        //Holds the flattened scene, unless it is rendered in place from
+        //a compiled scene. Its clouds are tested after primitives.
+        FlatScene storage;
+
+        //Point into storage or into the sections of a compiled scene
+        FlatPrimitives primitives;
+        const FlatMaterial *materials;
+        size_t materialCount;
+        size_t lightCount;
+
+        RenderScene();
+        RenderScene(const RenderScene &) = delete;
+        RenderScene & operator=(const RenderScene &) = delete;
+};
+
+#endif // RENDERSCENE_HPP
@@ -0,0 +1,415 @@
+#include "renderserver.hpp"
+#include "renderscene.hpp"
+#include "pngwriter.hpp"
+#include "tracing.hpp"
+#include <chrono>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define RENDER_SERVER_SUPPORTED
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+//Requests are single lines, so anything longer is not a request
+static const size_t MAX_REQUEST_LENGTH = 4096;
+
+//The largest image a request may ask for, in pixels
+static const long long MAX_PIXELS = 64LL * 1024 * 1024;
+
+//The most samples a request may ask for over the whole image, so that no
+//request can keep the server busy for more than a few minutes
+static const long long MAX_SAMPLES = 1LL << 30;
+
+static bool parseVector(const std::string &text, Vector3 &vector)
+{
+    char comma1, comma2;
+    std::istringstream stream(text);
+    return (stream >> vector.x >> comma1 >> vector.y >> comma2 >> vector.z) &&
+            comma1 == ',' && comma2 == ',' && stream.peek() == EOF;
+}
+
+template <typename T>
+static bool parseNumber(const std::string &text, T &value)
+{
+    std::istringstream stream(text);
+    return (stream >> value) && stream.peek() == EOF;
+}
+
+/**
+ * @brief parseRenderJob Applies the settings of a render request to a job
+ * @param request The arguments of the request, as key=value words
+ * @param job Holds the defaults, and receives the settings of the request
+ * @param error Receives the reason the request is invalid
+ * @return Whether the request was valid
+ */
+bool parseRenderJob(const std::string &request, RenderJob &job, std::string &error)
+{
+    std::istringstream words(request);
+    std::string word;
+    bool cameraMoved = false;
+    while (words >> word)
+    {
+        size_t equals = word.find('=');
+        std::string key = word.substr(0, equals);
+        std::string value = equals == std::string::npos ? "" : word.substr(equals + 1);
+        bool valid;
+        if (key == "width")
+        {
+            valid = parseNumber(value, job.width) && job.width > 0;
+        }
+        else if (key == "height")
+        {
+            valid = parseNumber(value, job.height) && job.height > 0;
+        }
+        else if (key == "spp")
+        {
+            valid = parseNumber(value, job.renderOptions.samplesPerPixel) && job.renderOptions.samplesPerPixel > 0;
+        }
+        else if (key == "seed")
+        {
+            valid = parseNumber(value, job.renderOptions.seed);
+        }
+        else if (key == "camera")
+        {
+            valid = parseVector(value, job.cameraOptions.cameraPosition);
+            cameraMoved = true;
+        }
+        else if (key == "lookat")
+        {
+            valid = parseVector(value, job.cameraOptions.lookAt);
+            cameraMoved = true;
+        }
+        else if (key == "fov")
+        {
+            valid = parseNumber(value, job.cameraOptions.fieldOfView) &&
+                    job.cameraOptions.fieldOfView > 0 && job.cameraOptions.fieldOfView < 180;
+        }
+        else if (key == "exposure")
+        {
+            valid = parseNumber(value, job.toneMapOptions.exposure);
+        }
+        else if (key == "gamma")
+        {
+            valid = parseNumber(value, job.toneMapOptions.gamma) && job.toneMapOptions.gamma > 0;
+        }
+        else
+        {
+            error = "unknown setting " + key;
+            return false;
+        }
+
+        if (!valid)
+        {
+            error = "invalid value for " + key;
+            return false;
+        }
+    }
+
+    long long pixels = (long long) job.width * job.height;
+    if (pixels > MAX_PIXELS)
+    {
+        error = "image is too large";
+        return false;
+    }
+    if (job.renderOptions.samplesPerPixel > MAX_SAMPLES / pixels)
+    {
+        error = "too many samples for the image size";
+        return false;
+    }
+
+    //Keep whatever was in focus in focus when the camera moves
+    if (cameraMoved)
+    {
+        if ((job.cameraOptions.cameraPosition - job.cameraOptions.lookAt).getLength() <= 0)
+        {
+            error = "camera and lookat are the same point";
+            return false;
+        }
+        job.cameraOptions.focusDistance = (job.cameraOptions.cameraPosition - job.cameraOptions.lookAt).getLength();
+    }
+    return true;
+}
+
+/**
+ * @brief RenderServer Prepares to serve renders of a scene
+ * @param scene The scene to render, which must outlive the server
+ * @param defaults The settings of a render request that sets nothing
+ */
+RenderServer::RenderServer(const RenderScene &scene, const RenderJob &defaults)
+    : scene(scene), defaults(defaults)
+{
+    listener = -1;
+}
+
+RenderServer::~RenderServer()
+{
+#ifdef RENDER_SERVER_SUPPORTED
+    if (listener >= 0)
+    {
+        close(listener);
+        unlink(socketPath.c_str());
+    }
+#endif
+}
+
+/**
+ * @brief listen Creates the socket clients connect to. An existing
+ * socket file at the path is replaced, but anything else there is left
+ * alone and the socket is not created.
+ * @param socketPath The path of the socket
+ * @param error Receives the reason the socket could not be created
+ * @return Whether the socket was created
+ */
+bool RenderServer::listen(const std::string &socketPath, std::string &error)
+{
+#ifdef RENDER_SERVER_SUPPORTED
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path))
+    {
+        error = "socket path is too long: " + socketPath;
+        return false;
+    }
+    strcpy(address.sun_path, socketPath.c_str());
+
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server < 0)
+    {
+        error = std::string("could not create socket: ") + strerror(errno);
+        return false;
+    }
+
+    //Only a socket left behind by an earlier server is replaced, so a
+    //mistyped path cannot delete a file
+    struct stat status;
+    if (lstat(socketPath.c_str(), &status) == 0)
+    {
+        if (!S_ISSOCK(status.st_mode))
+        {
+            error = "path exists and is not a socket: " + socketPath;
+            close(server);
+            return false;
+        }
+        unlink(socketPath.c_str());
+    }
+    else if (errno != ENOENT)
+    {
+        error = "could not check " + socketPath + ": " + strerror(errno);
+        close(server);
+        return false;
+    }
+
+    if (bind(server, (sockaddr *) &address, sizeof(address)) != 0 || ::listen(server, 8) != 0)
+    {
+        error = "could not listen on " + socketPath + ": " + strerror(errno);
+        close(server);
+        return false;
+    }
+
+    listener = server;
+    this->socketPath = socketPath;
+    return true;
+#else
+    error = "the render server needs Unix domain sockets";
+    return false;
+#endif
+}
+
+/**
+ * @brief run Serves connections until a client asks the server to shut down
+ */
+void RenderServer::run()
+{
+#ifdef RENDER_SERVER_SUPPORTED
+    bool running = listener >= 0;
+    while (running)
+    {
+        int connection = accept(listener, NULL, NULL);
+        if (connection < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+        running = serveConnection(connection);
+        close(connection);
+    }
+#endif
+}
+
+#ifdef RENDER_SERVER_SUPPORTED
+static bool sendAll(int connection, const void *data, size_t length)
+{
+    const char *bytes = (const char *) data;
+    while (length > 0)
+    {
+#ifdef MSG_NOSIGNAL
+        ssize_t sent = send(connection, bytes, length, MSG_NOSIGNAL);
+#else
+        ssize_t sent = send(connection, bytes, length, 0);
+#endif
+        if (sent < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (sent <= 0)
+        {
+            return false;
+        }
+        bytes += sent;
+        length -= sent;
+    }
+    return true;
+}
+
+/**
+ * @brief readLine Reads the next request from a connection
+ * @param buffered Bytes read past the end of the last line
+ * @return False if the connection was closed or the line was too long
+ */
+static bool readLine(int connection, std::string &buffered, std::string &line)
+{
+    size_t end;
+    while ((end = buffered.find('\n')) == std::string::npos)
+    {
+        if (buffered.size() > MAX_REQUEST_LENGTH)
+        {
+            return false;
+        }
+
+        char bytes[1024];
+        ssize_t received = recv(connection, bytes, sizeof(bytes), 0);
+        if (received < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (received <= 0)
+        {
+            return false;
+        }
+        buffered.append(bytes, received);
+    }
+
+    line = buffered.substr(0, end);
+    buffered.erase(0, end + 1);
+    if (!line.empty() && line[line.size() - 1] == '\r')
+    {
+        line.erase(line.size() - 1);
+    }
+    return true;
+}
+#endif
+
+/**
+ * @brief serveConnection Answers the requests of one client until it
+ * disconnects or quits
+ * @return False if the client asked the server to shut down
+ */
+bool RenderServer::serveConnection(int connection)
+{
+#ifdef RENDER_SERVER_SUPPORTED
+    std::string buffered, line;
+    while (readLine(connection, buffered, line))
+    {
+        std::istringstream words(line);
+        std::string command;
+        words >> command;
+        std::string arguments;
+        std::getline(words, arguments);
+
+        if (command == "quit")
+        {
+            return true;
+        }
+        if (command == "shutdown")
+        {
+            return false;
+        }
+        if (command.empty())
+        {
+            continue;
+        }
+
+        std::string error;
+        RenderJob job = defaults;
+        std::vector<unsigned char> png;
+        double renderSeconds = 0, encodeSeconds = 0;
+        if (command != "render")
+        {
+            error = "unknown command " + command;
+        }
+        else if (parseRenderJob(arguments, job, error) && !render(job, png, renderSeconds, encodeSeconds))
+        {
+            error = "could not encode the image";
+        }
+
+        std::ostringstream reply;
+        if (error.empty())
+        {
+            reply << "OK " << png.size() << " " << renderSeconds << " " << encodeSeconds << "\n";
+        }
+        else
+        {
+            reply << "ERROR " << error << "\n";
+        }
+
+        std::string header = reply.str();
+        if (!sendAll(connection, header.data(), header.size()) ||
+                !sendAll(connection, png.data(), png.size()))
+        {
+            return true;
+        }
+    }
+#endif
+    return true;
+}
+
+/**
+ * @brief render Renders a job and encodes it as a PNG
+ * @param png Receives the encoded image
+ * @param renderSeconds Receives the time spent tracing
+ * @param encodeSeconds Receives the time spent tonemapping and encoding
+ * @return Whether the image was encoded
+ */
+bool RenderServer::render(const RenderJob &job, std::vector<unsigned char> &png,
+                          double &renderSeconds, double &encodeSeconds) const
+{
+    TraceSpan span("render job");
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    Camera camera(job.width, job.height, job.cameraOptions);
+    Framebuffer *framebuffer = camera.captureScene(scene, job.renderOptions);
+    std::chrono::steady_clock::time_point rendered = std::chrono::steady_clock::now();
+
+    std::vector<RGBAVector> pixels((size_t) job.width * job.height);
+    tonemap(framebuffer->getColour(), (size_t) job.width * job.height, job.toneMapOptions, pixels.data());
+    delete framebuffer;
+
+    bool encoded = false;
+#ifdef RENDER_SERVER_SUPPORTED
+    char *buffer = NULL;
+    size_t size = 0;
+    PngWriter writer;
+    encoded = writer.open(open_memstream(&buffer, &size), job.width, job.height, 4) &&
+            writer.writeRows(&pixels[0].r, job.height, job.width * 4);
+    encoded = writer.close() && encoded;
+    if (encoded)
+    {
+        png.assign(buffer, buffer + size);
+    }
+    free(buffer);
+#endif
+
+    renderSeconds = std::chrono::duration<double>(rendered - start).count();
+    encodeSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - rendered).count();
+    return encoded;
+}
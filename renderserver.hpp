@@ -0,0 +1,73 @@
+#ifndef RENDERSERVER_HPP
+#define RENDERSERVER_HPP
+
+#include "camera.hpp"
+#include "tonemap.hpp"
+#include <string>
+#include <vector>
+
+class RenderScene;
+
+/**
+ * The settings of one render requested from a RenderServer. Anything a
+ * request leaves out keeps the value the server was started with.
+ * @brief The RenderJob class
+ */
+class RenderJob
+{
+    public:
+        int width, height;
+        CameraOptions cameraOptions;
+        RenderOptions renderOptions;
+        ToneMapOptions toneMapOptions;
+};
+
+bool parseRenderJob(const std::string &request, RenderJob &job, std::string &error);
+
+/**
+ * Renders jobs sent over a Unix domain socket from a scene that was
+ * loaded and compiled once, so that a small render costs only the time
+ * to trace and encode it. The render threads are kept between jobs.
+ *
+ * Clients send one request per line:
+ *
+ *   render [width=N] [height=N] [spp=N] [seed=N] [camera=X,Y,Z]
+ *          [lookat=X,Y,Z] [fov=DEGREES] [exposure=X] [gamma=X]
+ *     Replies "OK <bytes> <render seconds> <encode seconds>" and a line
+ *     break, followed by that many bytes of PNG
+ *   quit
+ *     Closes the connection
+ *   shutdown
+ *     Closes the connection and stops the server
+ *
+ * A request that cannot be rendered is answered with "ERROR <message>".
+ * Requests are limited to 64 megapixels and 2^30 samples in all, and the
+ * camera must not be at the point it looks at.
+ * Connections are served one at a time, since each render already uses
+ * every thread.
+ * @brief The RenderServer class
+ */
+class RenderServer
+{
+    public:
+        RenderServer(const RenderScene &scene, const RenderJob &defaults);
+        ~RenderServer();
+
+        bool listen(const std::string &socketPath, std::string &error);
+        void run();
+
+    private:
+        const RenderScene &scene;
+        RenderJob defaults;
+        int listener;
+        std::string socketPath;
+
+        bool serveConnection(int connection);
+        bool render(const RenderJob &job, std::vector<unsigned char> &png,
+                    double &renderSeconds, double &encodeSeconds) const;
+
+        RenderServer(const RenderServer &) = delete;
+        RenderServer & operator=(const RenderServer &) = delete;
+};
+
+#endif // RENDERSERVER_HPP
@@ -0,0 +1,105 @@
+#include "renderstats.hpp"
+#include <string.h>
+
+#ifdef RAYTRACER_STATS
+thread_local RenderCounters threadRenderCounters;
+#endif
+
+static const char *MATERIAL_NAMES[STATS_MATERIAL_COUNT] = {"diffuse", "metal", "dielectric", "light"};
+
+void RenderCounters::clear()
+{
+    memset(this, 0, sizeof(*this));
+}
+
+void RenderCounters::add(const RenderCounters &counters)
+{
+    primaryRays += counters.primaryRays;
+    secondaryRays += counters.secondaryRays;
+    planeTests += counters.planeTests;
+    sphereTests += counters.sphereTests;
+    rectangleTests += counters.rectangleTests;
+    triangleTests += counters.triangleTests;
+    instanceTests += counters.instanceTests;
+    for (int m = 0; m < STATS_MATERIAL_COUNT; ++m)
+    {
+        scattered[m] += counters.scattered[m];
+        absorbed[m] += counters.absorbed[m];
+    }
+    for (int d = 0; d < PATH_LENGTH_BINS; ++d)
+    {
+        pathLengths[d] += counters.pathLengths[d];
+    }
+    depthLimited += counters.depthLimited;
+}
+
+/**
+ * @brief printRenderCounters Prints the counters as a readable summary
+ */
+void printRenderCounters(std::ostream &out, const RenderCounters &counters)
+{
+    long long paths = 0, bounces = 0;
+    int longestPath = 0;
+    for (int d = 0; d < PATH_LENGTH_BINS; ++d)
+    {
+        paths += counters.pathLengths[d];
+        bounces += counters.pathLengths[d] * d;
+        if (counters.pathLengths[d] > 0)
+        {
+            longestPath = d;
+        }
+    }
+
+    out << "Rays: " << counters.primaryRays << " primary, " << counters.secondaryRays << " secondary" << std::endl;
+    out << "Intersection tests: " << counters.planeTests << " plane, " << counters.sphereTests << " sphere, "
+        << counters.rectangleTests << " rectangle, " << counters.triangleTests << " triangle, "
+        << counters.instanceTests << " instance" << std::endl;
+
+    out << "Scatter:";
+    for (int m = 0; m < STATS_MATERIAL_COUNT; ++m)
+    {
+        out << (m > 0 ? "," : "") << " " << MATERIAL_NAMES[m] << " "
+            << counters.scattered[m] << " scattered/" << counters.absorbed[m] << " absorbed";
+    }
+    out << std::endl;
+
+    out << "Paths: " << paths << ", mean " << (paths > 0 ? bounces / (double) paths : 0)
+        << " bounces, " << counters.depthLimited << " cut off by the bounce limit" << std::endl;
+    out << "Path length histogram:" << std::endl;
+    for (int d = 0; d <= longestPath; ++d)
+    {
+        out << "  " << d << ": " << counters.pathLengths[d] << std::endl;
+    }
+}
+
+static void writeArray(std::ostream &out, const long long *values, int count)
+{
+    out << "[";
+    for (int k = 0; k < count; ++k)
+    {
+        out << (k > 0 ? ", " : "") << values[k];
+    }
+    out << "]";
+}
+
+/**
+ * @brief writeRenderCountersJson Writes the counters as a JSON object
+ */
+void writeRenderCountersJson(std::ostream &out, const RenderCounters &counters)
+{
+    out << "{\"primary_rays\": " << counters.primaryRays
+        << ", \"secondary_rays\": " << counters.secondaryRays
+        << ", \"plane_tests\": " << counters.planeTests
+        << ", \"sphere_tests\": " << counters.sphereTests
+        << ", \"rectangle_tests\": " << counters.rectangleTests
+        << ", \"triangle_tests\": " << counters.triangleTests
+        << ", \"instance_tests\": " << counters.instanceTests;
+    for (int m = 0; m < STATS_MATERIAL_COUNT; ++m)
+    {
+        out << ", \"" << MATERIAL_NAMES[m] << "_scattered\": " << counters.scattered[m]
+            << ", \"" << MATERIAL_NAMES[m] << "_absorbed\": " << counters.absorbed[m];
+    }
+    out << ", \"depth_limited\": " << counters.depthLimited << ", \"path_lengths\": ";
+    writeArray(out, counters.pathLengths, PATH_LENGTH_BINS);
+    out << "}";
+}
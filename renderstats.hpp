@@ -0,0 +1,59 @@
+#ifndef RENDERSTATS_HPP
+#define RENDERSTATS_HPP
+
+#include <ostream>
+
+//Paths are cut off after 50 bounces, so they are 0 to 50 bounces long
+static const int PATH_LENGTH_BINS = 51;
+
+enum StatisticsMaterial
+{
+    STATS_DIFFUSE,
+    STATS_METAL,
+    STATS_DIELECTRIC,
+    STATS_LIGHT,
+    STATS_MATERIAL_COUNT
+};
+
+/**
+ * Counts the work done while tracing. Each render thread counts into its
+ * own copy, which is added to the RenderStatistics of the render when
+ * the thread finishes, so counting needs no synchronisation. This is
+ * kept a plain struct so that the per-thread copies need no constructor
+ * to run before they are used.
+ * @brief The RenderCounters struct
+ */
+struct RenderCounters
+{
+    long long primaryRays;
+    long long secondaryRays;
+
+    //Calls to the intersection test of each primitive, and of the
+    //rotated and translated instances wrapping them
+    long long planeTests, sphereTests, rectangleTests, triangleTests;
+    long long instanceTests;
+
+    long long scattered[STATS_MATERIAL_COUNT];
+    long long absorbed[STATS_MATERIAL_COUNT];
+
+    //The number of paths that ended after each number of bounces, and how
+    //many of those were ended by the bounce limit rather than a miss or
+    //an absorbing material
+    long long pathLengths[PATH_LENGTH_BINS];
+    long long depthLimited;
+
+    void clear();
+    void add(const RenderCounters &counters);
+};
+
+void printRenderCounters(std::ostream &out, const RenderCounters &counters);
+void writeRenderCountersJson(std::ostream &out, const RenderCounters &counters);
+
+#ifdef RAYTRACER_STATS
+extern thread_local RenderCounters threadRenderCounters;
+#define COUNT_STAT(counter) (++threadRenderCounters.counter)
+#else
+#define COUNT_STAT(counter) ((void) 0)
+#endif
+
+#endif // RENDERSTATS_HPP
@@ -1,10 +1,5 @@
 #include "rgbvector.hpp"
 
-RGBAVector::RGBAVector()
-    : RGBAVector(Vector3(0, 0, 0))
-{
-}
-
 RGBAVector::RGBAVector(Vector3 v)
 {
     this->r = (unsigned char) v.x;
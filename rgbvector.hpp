@@ -8,7 +8,8 @@ class RGBAVector
     public:
         unsigned char r, g, b, a;
 
-        RGBAVector();
+        //Left uninitialised so that allocating a framebuffer does not touch its pages
+        RGBAVector() = default;
         RGBAVector(Vector3 v);
 };
 
@@ -0,0 +1,22 @@
+#include "sampler.hpp"
+
+Sampler::Sampler()
+    : Sampler(0, 0, 0)
+{
+}
+
+/**
+ * @brief Sampler Starts the random numbers of a pixel sample
+ * @param pixel The index of the pixel in the whole image
+ * @param sample The index of the sample within the pixel
+ * @param seed Selects a different set of numbers for every sample
+ */
+Sampler::Sampler(uint64_t pixel, uint32_t sample, uint32_t seed)
+{
+    //The high half of the pixel index is hashed in separately so that
+    //images of more than 2^32 pixels do not repeat their random numbers.
+    //mix(0) is 0, so smaller images get the same numbers as before.
+    uint64_t high = mix((pixel >> 32) * 0xd1b54a32d192ed03ull);
+    key = mix((pixel << 32 | sample) ^ mix(seed + 0x9e3779b97f4a7c15ull) ^ high);
+    dimension = 0;
+}
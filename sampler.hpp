@@ -0,0 +1,42 @@
+#ifndef SAMPLER_HPP
+#define SAMPLER_HPP
+
+#include <stdint.h>
+
+/**
+ * Generates the random numbers of one pixel sample. Each number is a
+ * hash of the pixel, the sample index, a seed and how many numbers the
+ * sample has used so far, so the numbers do not depend on which thread
+ * renders the sample or in what order. Rendering the same samples
+ * therefore always gives the same image, and renders of separate sample
+ * ranges can be merged.
+ * @brief The Sampler class
+ */
+class Sampler
+{
+    public:
+        Sampler();
+        Sampler(uint64_t pixel, uint32_t sample, uint32_t seed);
+
+        //Returns a float in [0, 1)
+        float getFloat()
+        {
+            dimension++;
+            uint64_t bits = mix(key + dimension * 0x9e3779b97f4a7c15ull);
+            return (bits >> 40) * (1.0f / 16777216.0f);
+        }
+
+    private:
+        uint64_t key;
+        uint64_t dimension;
+
+        //The SplitMix64 finaliser, a bijection that scrambles every bit
+        static uint64_t mix(uint64_t x)
+        {
+            x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+            x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+            return x ^ (x >> 31);
+        }
+};
+
+#endif // SAMPLER_HPP
@@ -0,0 +1,52 @@
+#include "scanlinesink.hpp"
+
+PngScanlineSink::PngScanlineSink(const std::string &filename, int width, int height)
+    : PngScanlineSink(filename, width, height, ToneMapOptions())
+{
+}
+
+PngScanlineSink::PngScanlineSink(const std::string &filename, int width, int height, const ToneMapOptions &toneMapOptions)
+{
+    this->width = width;
+    this->toneMapOptions = toneMapOptions;
+    opened = writer.open(filename, width, height, 4);
+}
+
+bool PngScanlineSink::writeRows(const Vector3 *rows, int firstRow, int rowCount)
+{
+    (void) firstRow;
+    if (!opened)
+    {
+        return false;
+    }
+
+    pixels.resize(width * (size_t) rowCount);
+    tonemap(rows, (size_t) width * rowCount, toneMapOptions, pixels.data());
+    return writer.writeRows(&pixels[0].r, rowCount, width * 4);
+}
+
+/**
+ * @brief close Finishes the file once every row has been written
+ * @return Whether the whole image was written successfully
+ */
+bool PngScanlineSink::close()
+{
+    return opened && writer.close();
+}
+
+ExrScanlineSink::ExrScanlineSink(const std::string &filename, int width, int height)
+{
+    std::vector<std::string> channels = { "R", "G", "B" };
+    opened = writer.open(filename, width, height, channels);
+}
+
+bool ExrScanlineSink::writeRows(const Vector3 *rows, int firstRow, int rowCount)
+{
+    (void) firstRow;
+    return opened && writer.writeRows(&rows[0].x, rowCount);
+}
+
+bool ExrScanlineSink::close()
+{
+    return opened && writer.close();
+}
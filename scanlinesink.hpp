@@ -0,0 +1,63 @@
+#ifndef SCANLINESINK_HPP
+#define SCANLINESINK_HPP
+
+#include "vector3.hpp"
+#include "rgbvector.hpp"
+#include "tonemap.hpp"
+#include "pngwriter.hpp"
+#include "hdrimage.hpp"
+#include <string>
+#include <vector>
+
+/**
+ * Receives finished rows of an image in order, top to bottom, while
+ * the rest of the image is still being rendered
+ * @brief The ScanlineSink class
+ */
+class ScanlineSink
+{
+    public:
+        virtual ~ScanlineSink() {}
+
+        /**
+         * @brief writeRows Consumes the next rows of the image. The rows
+         * are only valid until this returns.
+         * @param rows The linear radiance of the rows, one row after another
+         * @param firstRow The index of the first row within the image
+         * @param rowCount The number of rows
+         * @return Whether the rows were consumed successfully
+         */
+        virtual bool writeRows(const Vector3 *rows, int firstRow, int rowCount) = 0;
+};
+
+class PngScanlineSink : public ScanlineSink
+{
+    public:
+        PngScanlineSink(const std::string &filename, int width, int height);
+        PngScanlineSink(const std::string &filename, int width, int height, const ToneMapOptions &toneMapOptions);
+
+        virtual bool writeRows(const Vector3 *rows, int firstRow, int rowCount);
+        bool close();
+
+    private:
+        PngWriter writer;
+        ToneMapOptions toneMapOptions;
+        std::vector<RGBAVector> pixels;
+        int width;
+        bool opened;
+};
+
+class ExrScanlineSink : public ScanlineSink
+{
+    public:
+        ExrScanlineSink(const std::string &filename, int width, int height);
+
+        virtual bool writeRows(const Vector3 *rows, int firstRow, int rowCount);
+        bool close();
+
+    private:
+        ExrWriter writer;
+        bool opened;
+};
+
+#endif // SCANLINESINK_HPP
@@ -1,15 +1,34 @@
 #include "scene.hpp"
+#include "renderscene.hpp"
 
 Scene::Scene()
 {
     background = Vector3(0, 0, 0);
 }
 
+Scene::~Scene()
+{
+    //Destroy objects in the reverse order of their creation, as if they
+    //had been members of the Scene
+    for (size_t k = destructors.size(); k > 0; --k)
+    {
+        destructors[k-1].second(destructors[k-1].first);
+    }
+    for (size_t k = 0; k < arenas.size(); ++k)
+    {
+        delete arenas[k].second;
+    }
+}
+
 std::vector<Surface *> Scene::getSurfaces() const
 {
     return surfaces;
 }
 
+/**
+ * @brief addSurface Adds a surface to be rendered. The Scene only takes
+ * ownership of surfaces made with create().
+ */
 void Scene::addSurface(Surface *surface)
 {
     surfaces.push_back(surface);
@@ -25,3 +44,35 @@ void Scene::setBackground(Vector3 background)
     this->background = background;
 }
 
+/**
+ * @brief compile Builds the read-only form of the scene that is
+ * rendered. The primitives and materials are copied out of the scene,
+ * apart from the spheres of SphereClouds, which are used where the
+ * clouds keep them, and a scene made of just a compiled scene, which is
+ * rendered where it is mapped. While the result is in use, those clouds
+ * must not be changed or destroyed and the CompiledScene must stay open;
+ * anything else in the scene may be.
+ * @return The compiled scene, which the caller must delete
+ */
+RenderScene * Scene::compile() const
+{
+    return new RenderScene(*this);
+}
+
+/**
+ * @brief getArena Finds the arena holding the objects of a type,
+ * creating it for the first object of that type
+ */
+Arena & Scene::getArena(const std::type_info &type)
+{
+    //Scenes hold only a handful of types, so a linear search is enough
+    for (size_t k = 0; k < arenas.size(); ++k)
+    {
+        if (*arenas[k].first == type)
+        {
+            return *arenas[k].second;
+        }
+    }
+    arenas.push_back(std::make_pair(&type, new Arena()));
+    return *arenas.back().second;
+}
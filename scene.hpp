@@ -2,25 +2,68 @@
 #define SCENE_HPP
 
 #include "surface.hpp"
+#include "arena.hpp"
+#include <new>
+#include <typeinfo>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
+class RenderScene;
+
 /**
- * Stores a bunch of surfaces
+ * Stores a bunch of surfaces. The surfaces and materials of a scene are
+ * created with create(), which places each type of object in its own
+ * arena so that objects of the same type are contiguous in memory. They
+ * are all freed together when the Scene is destroyed.
  * @brief The Scene class
  */
 class Scene
 {
     public:
         Scene();
+        ~Scene();
 
         std::vector<Surface *> getSurfaces() const;
         void addSurface(Surface *surface);
         Vector3 getBackground() const;
         void setBackground(Vector3 background);
+        RenderScene * compile() const;
+
+        /**
+         * @brief create Constructs an object owned by the Scene. It lives
+         * until the Scene is destroyed and must not be deleted.
+         * @param args The arguments of the object's constructor
+         */
+        template <typename T, typename... Args>
+        T * create(Args&&... args)
+        {
+            void *memory = getArena(typeid(T)).allocate(sizeof(T), alignof(T));
+            T *object = new (memory) T(std::forward<Args>(args)...);
+            if (!std::is_trivially_destructible<T>::value)
+            {
+                destructors.push_back(std::make_pair((void *) object, &destroy<T>));
+            }
+            return object;
+        }
 
     private:
         std::vector<Surface *> surfaces;
         Vector3 background;
+
+        std::vector<std::pair<const std::type_info *, Arena *> > arenas;
+        std::vector<std::pair<void *, void (*)(void *)> > destructors;
+
+        Arena & getArena(const std::type_info &type);
+
+        template <typename T>
+        static void destroy(void *object)
+        {
+            static_cast<T *>(object)->~T();
+        }
+
+        Scene(const Scene &) = delete;
+        Scene & operator=(const Scene &) = delete;
 };
 
 #endif // SCENE_HPP
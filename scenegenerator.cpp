@@ -0,0 +1,315 @@
+#include "scenegenerator.hpp"
+#include "material.hpp"
+#include "spherecloud.hpp"
+#include <math.h>
+#include <algorithm>
+#include <random>
+#include <vector>
+
+//Generated scenes share a fixed set of materials so that the memory
+//used by materials does not grow with the number of primitives
+static const int PALETTE_SIZE = 64;
+
+//The number of rotated and translated instances wrapped around each
+//primitive of an instances scene
+static const int INSTANCE_DEPTH = 8;
+
+/**
+ * A seeded random number generator that gives the same numbers on every
+ * platform. std::mt19937 is fully specified by the standard, but the
+ * standard distributions are not, so they are not used.
+ * @brief The SceneRandom class
+ */
+class SceneRandom
+{
+    public:
+        SceneRandom(unsigned int seed) : engine(seed) {}
+
+        //Returns a float in [0, 1)
+        float getFloat()
+        {
+            return (engine() >> 8) * (1.0f / 16777216.0f);
+        }
+
+        float getFloat(float min, float max)
+        {
+            return min + (max - min)*getFloat();
+        }
+
+        int getInt(int count)
+        {
+            return std::min(int(getFloat()*count), count - 1);
+        }
+
+        Vector3 getVector(float min, float max)
+        {
+            //Separate statements, since the order in which function
+            //arguments are evaluated is unspecified
+            float x = getFloat(min, max);
+            float y = getFloat(min, max);
+            float z = getFloat(min, max);
+            return Vector3(x, y, z);
+        }
+
+        Vector3 getColour()
+        {
+            return getVector(0.1, 0.95);
+        }
+
+    private:
+        std::mt19937 engine;
+};
+
+/**
+ * @brief makePalette Creates the materials shared by the primitives of a
+ * scene: mostly diffuse, with some metal and dielectric
+ */
+static std::vector<Material *> makePalette(SceneRandom &random, Scene &scene)
+{
+    std::vector<Material *> palette;
+    for (int k = 0; k < PALETTE_SIZE; ++k)
+    {
+        float choice = random.getFloat();
+        if (choice < 0.6)
+        {
+            palette.push_back(scene.create<Diffuse>(random.getColour()));
+        }
+        else if (choice < 0.85)
+        {
+            Vector3 albedo = random.getVector(0.5, 1);
+            palette.push_back(scene.create<Metal>(albedo, random.getFloat(0, 0.5)));
+        }
+        else
+        {
+            palette.push_back(scene.create<Dielectric>(random.getFloat(1.3, 1.8)));
+        }
+    }
+    return palette;
+}
+
+/**
+ * @brief getRegionSize The side of the cube that count primitives are
+ * spread over, so that each has about spacing^3 of space to itself
+ */
+static float getRegionSize(long long count, float spacing)
+{
+    return std::max(2.0f, spacing * (float) cbrt((double) count));
+}
+
+/**
+ * @brief lookAtRegion Points the camera at the middle of a cube of
+ * primitives from slightly above and in front of it
+ */
+static void lookAtRegion(float size, CameraOptions &cameraOptions)
+{
+    cameraOptions.cameraPosition = Vector3(0, 0.4*size, 1.2*size);
+    cameraOptions.lookAt = Vector3(0, 0, 0);
+    cameraOptions.fieldOfView = 60;
+    cameraOptions.lensRadius = 0;
+    cameraOptions.cameraRoll = 0;
+    cameraOptions.focusDistance = (cameraOptions.cameraPosition - cameraOptions.lookAt).getLength();
+}
+
+static void generateSpheres(long long count, SceneRandom &random, Scene &scene, CameraOptions &cameraOptions)
+{
+    std::vector<Material *> palette = makePalette(random, scene);
+    float size = getRegionSize(count, 1.5);
+
+    scene.setBackground(Vector3(0.7, 0.8, 1));
+    Material *floor = scene.create<Diffuse>(Vector3(0.5, 0.5, 0.5));
+    scene.addSurface(scene.create<Plane>(Vector3(0, -size/2 - 0.5, 0), Vector3(0, 1, 0), floor));
+    scene.addSurface(scene.create<Sphere>(Vector3(0, 2*size, 0), size/2, scene.create<Light>(Vector3(4, 4, 4))));
+
+    for (long long k = 0; k < count; ++k)
+    {
+        Vector3 centre = random.getVector(-size/2, size/2);
+        float radius = random.getFloat(0.2, 0.5);
+        scene.addSurface(scene.create<Sphere>(centre, radius, palette[random.getInt(PALETTE_SIZE)]));
+    }
+
+    lookAtRegion(size, cameraOptions);
+}
+
+static void generateTriangles(long long count, SceneRandom &random, Scene &scene, CameraOptions &cameraOptions)
+{
+    std::vector<Material *> palette = makePalette(random, scene);
+    float size = getRegionSize(count, 1);
+
+    scene.setBackground(Vector3(0.7, 0.8, 1));
+    for (long long k = 0; k < count; ++k)
+    {
+        Vector3 centre = random.getVector(-size/2, size/2);
+        Vector3 a = centre + random.getVector(-0.5, 0.5);
+        Vector3 b = centre + random.getVector(-0.5, 0.5);
+        Vector3 c = centre + random.getVector(-0.5, 0.5);
+        scene.addSurface(scene.create<Triangle>(a, b, c, palette[random.getInt(PALETTE_SIZE)]));
+    }
+
+    lookAtRegion(size, cameraOptions);
+}
+
+static void generateInstances(long long count, SceneRandom &random, Scene &scene, CameraOptions &cameraOptions)
+{
+    std::vector<Material *> palette = makePalette(random, scene);
+    float size = getRegionSize(count, 1.5);
+
+    scene.setBackground(Vector3(0.7, 0.8, 1));
+    Material *floor = scene.create<Diffuse>(Vector3(0.5, 0.5, 0.5));
+    scene.addSurface(scene.create<Plane>(Vector3(0, -size/2 - 0.5, 0), Vector3(0, 1, 0), floor));
+
+    for (long long k = 0; k < count; ++k)
+    {
+        Material *material = palette[random.getInt(PALETTE_SIZE)];
+        Surface *surface;
+        if (random.getFloat() < 0.5)
+        {
+            surface = scene.create<Sphere>(Vector3(0.1, 0, 0), random.getFloat(0.2, 0.4), material);
+        }
+        else
+        {
+            surface = scene.create<Triangle>(Vector3(-0.4, 0, 0), Vector3(0.4, 0, 0), Vector3(0, 0.5, 0), material);
+        }
+
+        //Small offsets keep each chain of instances near its origin
+        for (int level = 0; level < INSTANCE_DEPTH; ++level)
+        {
+            float degrees = random.getFloat(-180, 180);
+            int axis = random.getInt(3);
+            surface = axis == 0 ? surface->rotateAroundX(scene, degrees) :
+                      axis == 1 ? surface->rotateAroundY(scene, degrees) :
+                                  surface->rotateAroundZ(scene, degrees);
+            surface = surface->translate(scene, random.getVector(-0.05, 0.05));
+        }
+        scene.addSurface(surface->translate(scene, random.getVector(-size/2, size/2)));
+    }
+
+    lookAtRegion(size, cameraOptions);
+}
+
+static void generateParticles(long long count, SceneRandom &random, Scene &scene, CameraOptions &cameraOptions)
+{
+    std::vector<Material *> palette = makePalette(random, scene);
+    float size = getRegionSize(count, 0.5);
+
+    scene.setBackground(Vector3(0.7, 0.8, 1));
+    Material *floor = scene.create<Diffuse>(Vector3(0.5, 0.5, 0.5));
+    scene.addSurface(scene.create<Plane>(Vector3(0, -size/2 - 0.5, 0), Vector3(0, 1, 0), floor));
+    scene.addSurface(scene.create<Sphere>(Vector3(0, 2*size, 0), size/2, scene.create<Light>(Vector3(4, 4, 4))));
+
+    //Every particle is in one SphereCloud rather than being a Surface
+    SphereCloud *cloud = scene.create<SphereCloud>();
+    cloud->reserve(count);
+    for (long long k = 0; k < count; ++k)
+    {
+        Vector3 centre = random.getVector(-size/2, size/2);
+        float radius = random.getFloat(0.1, 0.25);
+        cloud->addSphere(centre, radius, palette[random.getInt(PALETTE_SIZE)]);
+    }
+    scene.addSurface(cloud);
+
+    lookAtRegion(size, cameraOptions);
+}
+
+static void generateLights(long long count, SceneRandom &random, Scene &scene, CameraOptions &cameraOptions)
+{
+    int grid = std::max(1, (int) ceil(sqrt((double) count)));
+    float width = std::max(4.0f, 0.5f*grid);
+    float height = 3;
+    float spacing = width / grid;
+
+    //The room is closed, so the lights are the only source of light
+    scene.setBackground(Vector3(0, 0, 0));
+    Material *walls = scene.create<Diffuse>(Vector3(0.7, 0.7, 0.7));
+    scene.addSurface(scene.create<Plane>(Vector3(0, 0, 0), Vector3(0, 1, 0), walls));
+    scene.addSurface(scene.create<Plane>(Vector3(0, height, 0), Vector3(0, -1, 0), walls));
+    Material *red = scene.create<Diffuse>(Vector3(0.8, 0.3, 0.3));
+    Material *blue = scene.create<Diffuse>(Vector3(0.3, 0.3, 0.8));
+    scene.addSurface(scene.create<Plane>(Vector3(-width/2, 0, 0), Vector3(1, 0, 0), red));
+    scene.addSurface(scene.create<Plane>(Vector3(width/2, 0, 0), Vector3(-1, 0, 0), blue));
+    scene.addSurface(scene.create<Plane>(Vector3(0, 0, -width/2), Vector3(0, 0, 1), walls));
+    scene.addSurface(scene.create<Plane>(Vector3(0, 0, width/2), Vector3(0, 0, -1), walls));
+
+    //Each light covers the same fraction of its cell of the ceiling, so
+    //the room is about as bright whatever the number of lights
+    std::vector<Material *> lights;
+    for (int k = 0; k < PALETTE_SIZE; ++k)
+    {
+        float warmth = random.getFloat();
+        lights.push_back(scene.create<Light>(Vector3(6, 5 + warmth, 6 - 2*warmth)));
+    }
+    for (long long k = 0; k < count; ++k)
+    {
+        float x = -width/2 + spacing*((k % grid) + 0.5);
+        float z = -width/2 + spacing*((k / grid) + 0.5);
+        scene.addSurface(scene.create<Rectangle>(Vector3(x, height - 0.001, z), Vector3(0, -1, 0),
+                                       spacing/4, spacing/4, lights[random.getInt(PALETTE_SIZE)]));
+    }
+
+    std::vector<Material *> palette = makePalette(random, scene);
+    for (int k = 0; k < 8; ++k)
+    {
+        float radius = random.getFloat(0.3, 0.6);
+        float x = random.getFloat(-1.5, 1.5);
+        float z = random.getFloat(-1.5, 1.5);
+        scene.addSurface(scene.create<Sphere>(Vector3(x, radius, z), radius, palette[random.getInt(PALETTE_SIZE)]));
+    }
+
+    cameraOptions.cameraPosition = Vector3(0, 1.5, std::min(width/2 - 0.1f, 5.0f));
+    cameraOptions.lookAt = Vector3(0, 0.8, 0);
+    cameraOptions.fieldOfView = 75;
+    cameraOptions.lensRadius = 0;
+    cameraOptions.cameraRoll = 0;
+    cameraOptions.focusDistance = (cameraOptions.cameraPosition - cameraOptions.lookAt).getLength();
+}
+
+bool isGeneratedSceneKind(const std::string &kind)
+{
+    return kind == "spheres" || kind == "triangles" || kind == "instances" || kind == "lights" ||
+           kind == "particles";
+}
+
+/**
+ * @brief generateScene Builds a synthetic scene
+ * @param kind The kind of scene: spheres, triangles, instances, lights or
+ * particles
+ * @param count The number of primitives (or lights) to generate
+ * @param seed The seed of the random numbers placing the primitives
+ * @param scene Receives the surfaces and background of the scene
+ * @param cameraOptions Receives a camera looking at the scene
+ * @return Whether the kind was known and the count was positive
+ */
+bool generateScene(const std::string &kind, long long count, unsigned int seed,
+                   Scene &scene, CameraOptions &cameraOptions)
+{
+    if (count < 1)
+    {
+        return false;
+    }
+
+    SceneRandom random(seed);
+    if (kind == "spheres")
+    {
+        generateSpheres(count, random, scene, cameraOptions);
+    }
+    else if (kind == "triangles")
+    {
+        generateTriangles(count, random, scene, cameraOptions);
+    }
+    else if (kind == "instances")
+    {
+        generateInstances(count, random, scene, cameraOptions);
+    }
+    else if (kind == "lights")
+    {
+        generateLights(count, random, scene, cameraOptions);
+    }
+    else if (kind == "particles")
+    {
+        generateParticles(count, random, scene, cameraOptions);
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
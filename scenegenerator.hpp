@@ -0,0 +1,29 @@
+#ifndef SCENEGENERATOR_HPP
+#define SCENEGENERATOR_HPP
+
+#include "camera.hpp"
+#include <string>
+
+/*
+ * Generates synthetic scenes of any size for benchmarking. The same kind,
+ * count and seed always give the same scene, on every platform, so runs
+ * can be compared across builds and machines.
+ *
+ *   spheres    count spheres with a mix of diffuse, metal and dielectric
+ *              materials on a ground plane under a light
+ *   triangles  a soup of count small randomly oriented triangles
+ *   instances  count spheres and triangles, each nested inside a chain of
+ *              rotated and translated instances
+ *   lights     a closed room lit by count small lights in the ceiling
+ *   particles  count small spheres stored in a single SphereCloud, on a
+ *              ground plane under a light
+ *
+ * Primitives are spread over a volume that grows with count, so the
+ * density of each scene stays about the same from 10 to 10M primitives.
+ */
+
+bool generateScene(const std::string &kind, long long count, unsigned int seed,
+                   Scene &scene, CameraOptions &cameraOptions);
+bool isGeneratedSceneKind(const std::string &kind);
+
+#endif // SCENEGENERATOR_HPP
@@ -0,0 +1,569 @@
+#include "sceneparser.hpp"
+#include "material.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unordered_map>
+#include <vector>
+
+//Files are read in blocks of this size so that large scenes are never
+//held in memory all at once
+static const size_t READ_BLOCK_SIZE = 1 << 20;
+
+/**
+ * Builds a Scene one line at a time. Lines are tokenised in place
+ * without allocating, since scenes may contain millions of surfaces.
+ * @brief The SceneParser class
+ */
+class SceneParser
+{
+    public:
+        SceneParser(Scene &scene, CameraOptions &cameraOptions);
+
+        bool parseLine(char *line, int lineNumber);
+        bool finish();
+        const std::string & getError() const;
+
+    private:
+        Scene &scene;
+        CameraOptions &cameraOptions;
+        bool focusGiven;
+        std::unordered_map<std::string, Material *> materials;
+
+        char *cursor;
+        const char *word;
+        size_t wordLength;
+        std::string error;
+        int lineNumber;
+
+        bool nextWord();
+        bool isWord(const char *keyword) const;
+        bool readFloat(float &value);
+        bool readVector(Vector3 &value);
+        bool readMaterial(Material *&material);
+        bool fail(const std::string &message);
+
+        bool parseCamera();
+        bool parseMaterial();
+        bool parseSurface();
+};
+
+SceneParser::SceneParser(Scene &scene, CameraOptions &cameraOptions)
+    : scene(scene), cameraOptions(cameraOptions)
+{
+    focusGiven = false;
+    cursor = NULL;
+    word = NULL;
+    wordLength = 0;
+    lineNumber = 0;
+}
+
+const std::string & SceneParser::getError() const
+{
+    return error;
+}
+
+bool SceneParser::fail(const std::string &message)
+{
+    error = "line " + std::to_string(lineNumber) + ": " + message;
+    return false;
+}
+
+/**
+ * @brief nextWord Advances to the next whitespace separated word of the
+ * current line, stopping at comments
+ * @return Whether there was another word
+ */
+bool SceneParser::nextWord()
+{
+    while (*cursor == ' ' || *cursor == '\t' || *cursor == '\r')
+    {
+        ++cursor;
+    }
+    if (*cursor == '\0' || *cursor == '#')
+    {
+        word = NULL;
+        wordLength = 0;
+        return false;
+    }
+
+    word = cursor;
+    while (*cursor != '\0' && *cursor != ' ' && *cursor != '\t' && *cursor != '\r' && *cursor != '#')
+    {
+        ++cursor;
+    }
+    wordLength = cursor - word;
+    return true;
+}
+
+bool SceneParser::isWord(const char *keyword) const
+{
+    return word && strlen(keyword) == wordLength && strncmp(word, keyword, wordLength) == 0;
+}
+
+/**
+ * @brief parseDecimal Parses a plain decimal number such as "-12.375"
+ * without going through the locale-aware strtof, which dominates the load
+ * time of large scenes. Numbers with exponents or more digits than a
+ * double holds exactly are left to strtof.
+ * @param text The text to parse
+ * @param value Receives the number
+ * @return The end of the number, or NULL if it was not a plain decimal
+ */
+static const char * parseDecimal(const char *text, float &value)
+{
+    static const double powersOfTen[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15
+    };
+
+    const char *p = text;
+    bool negative = *p == '-';
+    if (*p == '-' || *p == '+')
+    {
+        ++p;
+    }
+
+    unsigned long long mantissa = 0;
+    int digits = 0, fractionDigits = 0;
+    while (*p >= '0' && *p <= '9')
+    {
+        mantissa = mantissa*10 + (*p++ - '0');
+        ++digits;
+    }
+    if (*p == '.')
+    {
+        ++p;
+        while (*p >= '0' && *p <= '9')
+        {
+            mantissa = mantissa*10 + (*p++ - '0');
+            ++digits;
+            ++fractionDigits;
+        }
+    }
+
+    if (digits == 0 || digits > 15 || *p == 'e' || *p == 'E')
+    {
+        return NULL;
+    }
+
+    double number = mantissa / powersOfTen[fractionDigits];
+    value = (float) (negative ? -number : number);
+    return p;
+}
+
+bool SceneParser::readFloat(float &value)
+{
+    while (*cursor == ' ' || *cursor == '\t')
+    {
+        ++cursor;
+    }
+
+    const char *end = parseDecimal(cursor, value);
+    if (!end)
+    {
+        char *strtofEnd;
+        value = strtof(cursor, &strtofEnd);
+        end = strtofEnd;
+    }
+    if (end == cursor)
+    {
+        return fail("expected a number");
+    }
+    cursor = (char *) end;
+    return true;
+}
+
+bool SceneParser::readVector(Vector3 &value)
+{
+    return readFloat(value.x) && readFloat(value.y) && readFloat(value.z);
+}
+
+bool SceneParser::readMaterial(Material *&material)
+{
+    if (!nextWord())
+    {
+        return fail("expected a material name");
+    }
+    std::unordered_map<std::string, Material *>::const_iterator it = materials.find(std::string(word, wordLength));
+    if (it == materials.end())
+    {
+        return fail("unknown material '" + std::string(word, wordLength) + "'");
+    }
+    material = it->second;
+    return true;
+}
+
+/**
+ * @brief parseLine Parses one line of a scene file
+ * @param line The line, without its newline. It is modified while parsing.
+ * @param lineNumber The line number, for error messages
+ * @return Whether the line was valid
+ */
+bool SceneParser::parseLine(char *line, int lineNumber)
+{
+    this->lineNumber = lineNumber;
+    cursor = line;
+    if (!nextWord())
+    {
+        return true;
+    }
+
+    if (isWord("camera"))
+    {
+        return parseCamera();
+    }
+    if (isWord("background"))
+    {
+        Vector3 background;
+        if (!readVector(background))
+        {
+            return false;
+        }
+        scene.setBackground(background);
+        return !nextWord() || fail("unexpected '" + std::string(word, wordLength) + "'");
+    }
+    if (isWord("material"))
+    {
+        return parseMaterial();
+    }
+    return parseSurface();
+}
+
+bool SceneParser::parseCamera()
+{
+    while (nextWord())
+    {
+        if (isWord("position"))
+        {
+            if (!readVector(cameraOptions.cameraPosition))
+            {
+                return false;
+            }
+        }
+        else if (isWord("lookat"))
+        {
+            if (!readVector(cameraOptions.lookAt))
+            {
+                return false;
+            }
+        }
+        else if (isWord("fov"))
+        {
+            if (!readFloat(cameraOptions.fieldOfView))
+            {
+                return false;
+            }
+        }
+        else if (isWord("roll"))
+        {
+            if (!readFloat(cameraOptions.cameraRoll))
+            {
+                return false;
+            }
+        }
+        else if (isWord("aperture"))
+        {
+            if (!readFloat(cameraOptions.lensRadius))
+            {
+                return false;
+            }
+        }
+        else if (isWord("focus"))
+        {
+            if (!readFloat(cameraOptions.focusDistance))
+            {
+                return false;
+            }
+            focusGiven = true;
+        }
+        else
+        {
+            return fail("unknown camera setting '" + std::string(word, wordLength) + "'");
+        }
+    }
+    return true;
+}
+
+bool SceneParser::parseMaterial()
+{
+    if (!nextWord())
+    {
+        return fail("expected a material name");
+    }
+    std::string name(word, wordLength);
+
+    if (!nextWord())
+    {
+        return fail("expected a material type");
+    }
+
+    Material *material = NULL;
+    Vector3 colour;
+    if (isWord("diffuse"))
+    {
+        if (!readVector(colour))
+        {
+            return false;
+        }
+        material = scene.create<Diffuse>(colour);
+    }
+    else if (isWord("metal"))
+    {
+        float fuzz = 0;
+        if (!readVector(colour))
+        {
+            return false;
+        }
+        char *start = cursor;
+        if (nextWord())
+        {
+            cursor = start;
+            if (!readFloat(fuzz))
+            {
+                return false;
+            }
+        }
+        material = scene.create<Metal>(colour, fuzz);
+    }
+    else if (isWord("dielectric"))
+    {
+        float refractiveIndex;
+        if (!readFloat(refractiveIndex))
+        {
+            return false;
+        }
+        material = scene.create<Dielectric>(refractiveIndex);
+    }
+    else if (isWord("light"))
+    {
+        if (!readVector(colour))
+        {
+            return false;
+        }
+        material = scene.create<Light>(colour);
+    }
+    else
+    {
+        return fail("unknown material type '" + std::string(word, wordLength) + "'");
+    }
+
+    materials[name] = material;
+    return !nextWord() || fail("unexpected '" + std::string(word, wordLength) + "'");
+}
+
+bool SceneParser::parseSurface()
+{
+    Surface *surface = NULL;
+    Material *material = NULL;
+
+    if (isWord("plane"))
+    {
+        Vector3 point, normal;
+        if (!readVector(point) || !readVector(normal) || !readMaterial(material))
+        {
+            return false;
+        }
+        surface = scene.create<Plane>(point, normal, material);
+    }
+    else if (isWord("sphere"))
+    {
+        Vector3 centre;
+        float radius;
+        if (!readVector(centre) || !readFloat(radius) || !readMaterial(material))
+        {
+            return false;
+        }
+        surface = scene.create<Sphere>(centre, radius, material);
+    }
+    else if (isWord("rectangle"))
+    {
+        Vector3 centre, normal;
+        float length, width;
+        if (!readVector(centre) || !readVector(normal) || !readFloat(length) || !readFloat(width) || !readMaterial(material))
+        {
+            return false;
+        }
+        surface = scene.create<Rectangle>(centre, normal, length, width, material);
+    }
+    else if (isWord("triangle"))
+    {
+        Vector3 a, b, c;
+        if (!readVector(a) || !readVector(b) || !readVector(c) || !readMaterial(material))
+        {
+            return false;
+        }
+        surface = scene.create<Triangle>(a, b, c, material);
+    }
+    else
+    {
+        return fail("unknown statement '" + std::string(word, wordLength) + "'");
+    }
+
+    //Any transforms follow the surface on the same line
+    while (nextWord())
+    {
+        float degrees;
+        Vector3 offset;
+        if (isWord("rotatex"))
+        {
+            if (!readFloat(degrees))
+            {
+                return false;
+            }
+            surface = surface->rotateAroundX(scene, degrees);
+        }
+        else if (isWord("rotatey"))
+        {
+            if (!readFloat(degrees))
+            {
+                return false;
+            }
+            surface = surface->rotateAroundY(scene, degrees);
+        }
+        else if (isWord("rotatez"))
+        {
+            if (!readFloat(degrees))
+            {
+                return false;
+            }
+            surface = surface->rotateAroundZ(scene, degrees);
+        }
+        else if (isWord("translate"))
+        {
+            if (!readVector(offset))
+            {
+                return false;
+            }
+            surface = surface->translate(scene, offset);
+        }
+        else
+        {
+            return fail("unknown transform '" + std::string(word, wordLength) + "'");
+        }
+    }
+
+    scene.addSurface(surface);
+    return true;
+}
+
+bool SceneParser::finish()
+{
+    if (!focusGiven)
+    {
+        cameraOptions.focusDistance = (cameraOptions.cameraPosition - cameraOptions.lookAt).getLength();
+    }
+    return true;
+}
+
+/**
+ * @brief parseScene Builds a scene from the text of a scene file
+ * @param text The scene description
+ * @param scene Receives the background and surfaces of the scene
+ * @param cameraOptions Receives the camera settings of the scene
+ * @param error Receives a description of the problem if parsing fails
+ * @return Whether the scene was parsed successfully
+ */
+bool parseScene(const std::string &text, Scene &scene, CameraOptions &cameraOptions, std::string &error)
+{
+    SceneParser parser(scene, cameraOptions);
+    std::vector<char> line;
+    int lineNumber = 0;
+    size_t start = 0;
+    while (start <= text.size())
+    {
+        size_t end = text.find('\n', start);
+        if (end == std::string::npos)
+        {
+            end = text.size();
+        }
+        line.assign(text.begin() + start, text.begin() + end);
+        line.push_back('\0');
+        if (!parser.parseLine(line.data(), ++lineNumber))
+        {
+            error = parser.getError();
+            return false;
+        }
+        start = end + 1;
+    }
+    return parser.finish();
+}
+
+/**
+ * @brief loadScene Builds a scene from a scene file. The file is read
+ * and parsed a block at a time.
+ * @param filename The scene file to read
+ * @param scene Receives the background and surfaces of the scene
+ * @param cameraOptions Receives the camera settings of the scene
+ * @param error Receives a description of the problem if loading fails
+ * @return Whether the scene was loaded successfully
+ */
+bool loadScene(const std::string &filename, Scene &scene, CameraOptions &cameraOptions, std::string &error)
+{
+    FILE *file = fopen(filename.c_str(), "rb");
+    if (!file)
+    {
+        error = "could not open " + filename;
+        return false;
+    }
+
+    SceneParser parser(scene, cameraOptions);
+    std::vector<char> buffer(READ_BLOCK_SIZE + 1);
+    size_t buffered = 0;
+    int lineNumber = 0;
+    bool parsed = true;
+
+    while (parsed)
+    {
+        size_t read = fread(buffer.data() + buffered, 1, buffer.size() - 1 - buffered, file);
+        buffered += read;
+        bool endOfFile = read == 0;
+
+        //Parse every complete line in the buffer
+        char *lineStart = buffer.data();
+        char *bufferEnd = buffer.data() + buffered;
+        while (parsed)
+        {
+            char *lineEnd = (char *) memchr(lineStart, '\n', bufferEnd - lineStart);
+            if (!lineEnd)
+            {
+                if (!endOfFile || lineStart == bufferEnd)
+                {
+                    break;
+                }
+                lineEnd = bufferEnd;
+            }
+            *lineEnd = '\0';
+            parsed = parser.parseLine(lineStart, ++lineNumber);
+            lineStart = lineEnd + 1;
+            if (lineEnd == bufferEnd)
+            {
+                break;
+            }
+        }
+
+        if (endOfFile)
+        {
+            break;
+        }
+
+        //Keep the incomplete last line for the next block
+        size_t remaining = lineStart < bufferEnd ? bufferEnd - lineStart : 0;
+        if (remaining == buffer.size() - 1)
+        {
+            //A single line is longer than the buffer
+            buffer.resize(buffer.size() * 2);
+            lineStart = buffer.data();
+        }
+        memmove(buffer.data(), lineStart, remaining);
+        buffered = remaining;
+    }
+
+    fclose(file);
+    if (!parsed)
+    {
+        error = filename + ", " + parser.getError();
+        return false;
+    }
+    return parser.finish();
+}
@@ -0,0 +1,32 @@
+#ifndef SCENEPARSER_HPP
+#define SCENEPARSER_HPP
+
+#include "camera.hpp"
+#include <string>
+
+/*
+ * Scene files are plain text with one statement per line. Anything after
+ * a '#' is a comment. Materials are named and must be defined before the
+ * surfaces that use them. Any surface may be followed by transforms,
+ * which are applied in the order they are written.
+ *
+ *   camera position 0 0 0 lookat 0 0 -1 fov 90 roll 0 aperture 0 focus 1
+ *   background 1 1 1
+ *   material <name> diffuse <r> <g> <b>
+ *   material <name> metal <r> <g> <b> [fuzz]
+ *   material <name> dielectric <refractive index>
+ *   material <name> light <r> <g> <b>
+ *   plane <point> <normal> <material>
+ *   sphere <centre> <radius> <material>
+ *   rectangle <centre> <normal> <length> <width> <material>
+ *   triangle <a> <b> <c> <material>
+ *   ... rotatex <degrees> rotatey <degrees> rotatez <degrees> translate <offset>
+ *
+ * Every camera setting is optional; aperture is the lens radius and focus
+ * defaults to the distance between position and lookat.
+ */
+
+bool loadScene(const std::string &filename, Scene &scene, CameraOptions &cameraOptions, std::string &error);
+bool parseScene(const std::string &text, Scene &scene, CameraOptions &cameraOptions, std::string &error);
+
+#endif // SCENEPARSER_HPP
@@ -0,0 +1,395 @@
+#include "spherecloud.hpp"
+#include "compiledscene.hpp"
+#include "cpudispatch.hpp"
+#include "renderstats.hpp"
+#include <math.h>
+#include <algorithm>
+
+#ifdef RAYTRACER_CPU_DISPATCH
+#include <immintrin.h>
+#endif
+
+//The vector kernels keep sphere indices in 32-bit lanes, so they are
+//given at most this many spheres at a time. It is a multiple of every
+//vector width, so only the last run has spheres left for the scalar loop.
+static const size_t MAX_KERNEL_SPHERES = (size_t) 1 << 30;
+
+/**
+ * @brief hitOneSphere The test of hitSphere, for one sphere of the arrays
+ * @param closest The furthest distance to accept a hit, which is lowered
+ * to the distance of the hit if there is one
+ * @return Whether the sphere was hit closer than closest
+ */
+static inline bool hitOneSphere(const SphereArrays &spheres, size_t k, const Vector3 &origin, const Vector3 &direction,
+                                float a, float minT, float &closest)
+{
+    Vector3 oc = origin - Vector3(spheres.x[k], spheres.y[k], spheres.z[k]);
+    float b = direction.dot(oc);
+    float c = oc.dot(oc) - spheres.radius[k]*spheres.radius[k];
+
+    if (b*b <= a*c)
+    {
+        return false;
+    }
+
+    float temp = (-b-sqrt(b*b-a*c))/a;
+    if (temp > minT && temp < closest)
+    {
+        closest = temp;
+        return true;
+    }
+
+    temp = (-b+sqrt(b*b-a*c))/a;
+    if (temp > minT && temp < closest)
+    {
+        closest = temp;
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * @brief mergeSphereLanes Merges the closest hit of each lane of a
+ * vector kernel, preferring the lowest index on a tie as testing the
+ * spheres in order would
+ * @param laneIndex The sphere hit by each lane, or -1 if it hit none
+ */
+static void mergeSphereLanes(const float *laneT, const int *laneIndex, size_t lanes,
+                             float &closest, size_t &index, bool &hit)
+{
+    for (size_t l = 0; l < lanes; ++l)
+    {
+        if (laneIndex[l] < 0)
+        {
+            continue;
+        }
+        if (!hit || laneT[l] < closest || (laneT[l] == closest && (size_t) laneIndex[l] < index))
+        {
+            closest = laneT[l];
+            index = laneIndex[l];
+            hit = true;
+        }
+    }
+}
+
+/**
+ * Tests every whole block of spheres that fits the vector width of a
+ * kernel, with the same arithmetic as hitOneSphere so that the same hit
+ * is found. Each lane keeps its own closest hit, and so only has to beat
+ * the hits of its own spheres until the lanes are merged at the end.
+ * There must be at most MAX_KERNEL_SPHERES spheres. Returns the number
+ * of spheres tested.
+ */
+typedef size_t (*HitSphereBlocksFunction)(const SphereArrays &spheres, const Vector3 &origin, const Vector3 &direction,
+                                          float a, float minT, float &closest, size_t &index, bool &hit);
+
+#ifdef RAYTRACER_CPU_DISPATCH
+TARGET_AVX2 static size_t hitSphereBlocksAvx2(const SphereArrays &spheres, const Vector3 &origin, const Vector3 &direction,
+                                              float a, float minT, float &closest, size_t &index, bool &hit)
+{
+    const size_t lanes = 8;
+    size_t blockEnd = spheres.count - spheres.count % lanes;
+    if (blockEnd == 0)
+    {
+        return 0;
+    }
+
+    const __m256 ox = _mm256_set1_ps(origin.x), oy = _mm256_set1_ps(origin.y), oz = _mm256_set1_ps(origin.z);
+    const __m256 dx = _mm256_set1_ps(direction.x), dy = _mm256_set1_ps(direction.y), dz = _mm256_set1_ps(direction.z);
+    const __m256 va = _mm256_set1_ps(a), vMinT = _mm256_set1_ps(minT);
+    const __m256 signBit = _mm256_set1_ps(-0.0f);
+    const __m256i laneOffsets = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+    __m256 best = _mm256_set1_ps(closest);
+    __m256i bestIndex = _mm256_set1_epi32(-1);
+
+    for (size_t k = 0; k < blockEnd; k += lanes)
+    {
+        __m256 ocx = _mm256_sub_ps(ox, _mm256_loadu_ps(spheres.x + k));
+        __m256 ocy = _mm256_sub_ps(oy, _mm256_loadu_ps(spheres.y + k));
+        __m256 ocz = _mm256_sub_ps(oz, _mm256_loadu_ps(spheres.z + k));
+        __m256 radius = _mm256_loadu_ps(spheres.radius + k);
+
+        __m256 b = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, ocx), _mm256_mul_ps(dy, ocy)), _mm256_mul_ps(dz, ocz));
+        __m256 ocLength = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, ocx), _mm256_mul_ps(ocy, ocy)), _mm256_mul_ps(ocz, ocz));
+        __m256 c = _mm256_sub_ps(ocLength, _mm256_mul_ps(radius, radius));
+
+        __m256 bb = _mm256_mul_ps(b, b);
+        __m256 ac = _mm256_mul_ps(va, c);
+        __m256 crosses = _mm256_cmp_ps(bb, ac, _CMP_GT_OQ);
+        if (_mm256_movemask_ps(crosses) == 0)
+        {
+            continue;
+        }
+
+        __m256 root = _mm256_sqrt_ps(_mm256_sub_ps(bb, ac));
+        __m256 negativeB = _mm256_xor_ps(b, signBit);
+        __m256 nearT = _mm256_div_ps(_mm256_sub_ps(negativeB, root), va);
+        __m256 farT = _mm256_div_ps(_mm256_add_ps(negativeB, root), va);
+
+        __m256 nearHit = _mm256_and_ps(crosses, _mm256_and_ps(_mm256_cmp_ps(nearT, vMinT, _CMP_GT_OQ),
+                                                               _mm256_cmp_ps(nearT, best, _CMP_LT_OQ)));
+        __m256 farHit = _mm256_andnot_ps(nearHit, _mm256_and_ps(crosses, _mm256_and_ps(_mm256_cmp_ps(farT, vMinT, _CMP_GT_OQ),
+                                                                                          _mm256_cmp_ps(farT, best, _CMP_LT_OQ))));
+        __m256 anyHit = _mm256_or_ps(nearHit, farHit);
+        if (_mm256_movemask_ps(anyHit) == 0)
+        {
+            continue;
+        }
+
+        __m256 t = _mm256_blendv_ps(farT, nearT, nearHit);
+        __m256i sphereIndex = _mm256_add_epi32(_mm256_set1_epi32((int) k), laneOffsets);
+        best = _mm256_blendv_ps(best, t, anyHit);
+        bestIndex = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(bestIndex),
+                                                         _mm256_castsi256_ps(sphereIndex), anyHit));
+    }
+
+    float laneT[lanes];
+    int laneIndex[lanes];
+    _mm256_storeu_ps(laneT, best);
+    _mm256_storeu_si256((__m256i *) laneIndex, bestIndex);
+    mergeSphereLanes(laneT, laneIndex, lanes, closest, index, hit);
+    return blockEnd;
+}
+
+TARGET_AVX512 static size_t hitSphereBlocksAvx512(const SphereArrays &spheres, const Vector3 &origin, const Vector3 &direction,
+                                                  float a, float minT, float &closest, size_t &index, bool &hit)
+{
+    const size_t lanes = 16;
+    size_t blockEnd = spheres.count - spheres.count % lanes;
+    if (blockEnd == 0)
+    {
+        return 0;
+    }
+
+    const __m512 ox = _mm512_set1_ps(origin.x), oy = _mm512_set1_ps(origin.y), oz = _mm512_set1_ps(origin.z);
+    const __m512 dx = _mm512_set1_ps(direction.x), dy = _mm512_set1_ps(direction.y), dz = _mm512_set1_ps(direction.z);
+    const __m512 va = _mm512_set1_ps(a), vMinT = _mm512_set1_ps(minT);
+    const __m512i signBit = _mm512_castps_si512(_mm512_set1_ps(-0.0f));
+    const __m512i laneOffsets = _mm512_set_epi32(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+
+    __m512 best = _mm512_set1_ps(closest);
+    __m512i bestIndex = _mm512_set1_epi32(-1);
+
+    for (size_t k = 0; k < blockEnd; k += lanes)
+    {
+        __m512 ocx = _mm512_sub_ps(ox, _mm512_loadu_ps(spheres.x + k));
+        __m512 ocy = _mm512_sub_ps(oy, _mm512_loadu_ps(spheres.y + k));
+        __m512 ocz = _mm512_sub_ps(oz, _mm512_loadu_ps(spheres.z + k));
+        __m512 radius = _mm512_loadu_ps(spheres.radius + k);
+
+        __m512 b = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(dx, ocx), _mm512_mul_ps(dy, ocy)), _mm512_mul_ps(dz, ocz));
+        __m512 ocLength = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(ocx, ocx), _mm512_mul_ps(ocy, ocy)), _mm512_mul_ps(ocz, ocz));
+        __m512 c = _mm512_sub_ps(ocLength, _mm512_mul_ps(radius, radius));
+
+        __m512 bb = _mm512_mul_ps(b, b);
+        __m512 ac = _mm512_mul_ps(va, c);
+        __mmask16 crosses = _mm512_cmp_ps_mask(bb, ac, _CMP_GT_OQ);
+        if (crosses == 0)
+        {
+            continue;
+        }
+
+        //Only the lanes that cross need a root. The zero-masked form
+        //also avoids the undefined source of _mm512_sqrt_ps, which GCC
+        //12 warns about under -Wall.
+        __m512 root = _mm512_maskz_sqrt_ps(crosses, _mm512_sub_ps(bb, ac));
+        __m512 negativeB = _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(b), signBit));
+        __m512 nearT = _mm512_div_ps(_mm512_sub_ps(negativeB, root), va);
+        __m512 farT = _mm512_div_ps(_mm512_add_ps(negativeB, root), va);
+
+        __mmask16 nearHit = crosses & _mm512_cmp_ps_mask(nearT, vMinT, _CMP_GT_OQ) & _mm512_cmp_ps_mask(nearT, best, _CMP_LT_OQ);
+        __mmask16 farHit = ~nearHit & crosses & _mm512_cmp_ps_mask(farT, vMinT, _CMP_GT_OQ) & _mm512_cmp_ps_mask(farT, best, _CMP_LT_OQ);
+        __mmask16 anyHit = nearHit | farHit;
+        if (anyHit == 0)
+        {
+            continue;
+        }
+
+        __m512 t = _mm512_mask_blend_ps(nearHit, farT, nearT);
+        __m512i sphereIndex = _mm512_add_epi32(_mm512_set1_epi32((int) k), laneOffsets);
+        best = _mm512_mask_blend_ps(anyHit, best, t);
+        bestIndex = _mm512_mask_blend_epi32(anyHit, bestIndex, sphereIndex);
+    }
+
+    float laneT[lanes];
+    int laneIndex[lanes];
+    _mm512_storeu_ps(laneT, best);
+    _mm512_storeu_si512(laneIndex, bestIndex);
+    mergeSphereLanes(laneT, laneIndex, lanes, closest, index, hit);
+    return blockEnd;
+}
+#endif
+
+/**
+ * @brief selectHitSphereBlocks Picks the widest kernel the cpu supports
+ * @return The kernel, or null if only the scalar loop can be used
+ */
+static HitSphereBlocksFunction selectHitSphereBlocks()
+{
+#ifdef RAYTRACER_CPU_DISPATCH
+    switch (getCpuLevel())
+    {
+        case CPU_LEVEL_AVX512:
+            return hitSphereBlocksAvx512;
+        case CPU_LEVEL_AVX2:
+            return hitSphereBlocksAvx2;
+        default:
+            break;
+    }
+#endif
+    return NULL;
+}
+
+bool hitSphereArrays(const SphereArrays &spheres, const Ray &r, float minT, float maxT, float &t, size_t &index)
+{
+    static const HitSphereBlocksFunction hitSphereBlocks = selectHitSphereBlocks();
+
+    const Vector3 origin = r.getOrigin();
+    const Vector3 direction = r.getDirection();
+    float a = direction.dot(direction);
+    float closest = maxT;
+    bool hit = false;
+    size_t k = 0;
+
+#ifdef RAYTRACER_STATS
+    threadRenderCounters.sphereTests += spheres.count;
+#endif
+
+    while (hitSphereBlocks && k < spheres.count)
+    {
+        SphereArrays run;
+        run.x = spheres.x + k;
+        run.y = spheres.y + k;
+        run.z = spheres.z + k;
+        run.radius = spheres.radius + k;
+        run.count = std::min(spheres.count - k, MAX_KERNEL_SPHERES);
+
+        //Runs only take hits closer than the runs before them, so ties
+        //still go to the lowest index
+        size_t runIndex;
+        bool runHit = false;
+        size_t tested = hitSphereBlocks(run, origin, direction, a, minT, closest, runIndex, runHit);
+        if (runHit)
+        {
+            index = k + runIndex;
+            hit = true;
+        }
+        k += tested;
+        if (tested < run.count)
+        {
+            break;
+        }
+    }
+
+    for (; k < spheres.count; ++k)
+    {
+        if (hitOneSphere(spheres, k, origin, direction, a, minT, closest))
+        {
+            index = k;
+            hit = true;
+        }
+    }
+
+    t = closest;
+    return hit;
+}
+
+/**
+ * @brief fillSphereHit Sets the distance, location and normal of a hit.
+ * The material is left to the caller, which knows how materials are
+ * referred to.
+ */
+void fillSphereHit(const SphereArrays &spheres, size_t index, const Ray &r, float t, HitRecord &rec)
+{
+    Vector3 centre(spheres.x[index], spheres.y[index], spheres.z[index]);
+    rec.t = t;
+    rec.hitLocation = r.getPointAtParameter(t);
+    rec.normal = (rec.hitLocation - centre) / spheres.radius[index];
+}
+
+SphereCloud::SphereCloud()
+{
+}
+
+bool SphereCloud::addSphere(Vector3 centre, float radius, Material *material)
+{
+    std::unordered_map<Material *, uint16_t>::iterator found = materialLookup.find(material);
+    uint16_t materialIndex;
+    if (found != materialLookup.end())
+    {
+        materialIndex = found->second;
+    }
+    else
+    {
+        if (materials.size() > UINT16_MAX)
+        {
+            return false;
+        }
+        materialIndex = (uint16_t) materials.size();
+        materialLookup[material] = materialIndex;
+        materials.push_back(material);
+    }
+
+    x.push_back(centre.x);
+    y.push_back(centre.y);
+    z.push_back(centre.z);
+    this->radius.push_back(radius);
+    materialIndices.push_back(materialIndex);
+    return true;
+}
+
+/**
+ * @brief reserve Makes room for a number of spheres, so that a cloud
+ * whose size is known takes no more memory than its spheres need
+ */
+void SphereCloud::reserve(size_t count)
+{
+    x.reserve(count);
+    y.reserve(count);
+    z.reserve(count);
+    radius.reserve(count);
+    materialIndices.reserve(count);
+}
+
+size_t SphereCloud::getSphereCount() const
+{
+    return x.size();
+}
+
+SphereArrays SphereCloud::getArrays() const
+{
+    SphereArrays arrays;
+    arrays.x = x.data();
+    arrays.y = y.data();
+    arrays.z = z.data();
+    arrays.radius = radius.data();
+    arrays.count = x.size();
+    return arrays;
+}
+
+bool SphereCloud::hitWithRay(const Ray r, const float minT, const float maxT, HitRecord &rec) const
+{
+    SphereArrays arrays = getArrays();
+    float t;
+    size_t index;
+    if (!hitSphereArrays(arrays, r, minT, maxT, t, index))
+    {
+        return false;
+    }
+
+    fillSphereHit(arrays, index, r, t, rec);
+    rec.material = materials[materialIndices[index]];
+    return true;
+}
+
+/**
+ * @brief flatten Adds the spheres to a compiler, which refers to the
+ * arrays of the cloud rather than copying them where it can, so the cloud
+ * must not be changed or destroyed while what is built from it is in use
+ */
+void SphereCloud::flatten(SceneCompiler &compiler) const
+{
+    compiler.addSphereCloud(getArrays(), materialIndices.data(), materials.data(), materials.size());
+}
@@ -0,0 +1,75 @@
+#ifndef SPHERECLOUD_HPP
+#define SPHERECLOUD_HPP
+
+#include "surface.hpp"
+#include <stddef.h>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Spheres stored as one array per coordinate rather than one record per
+ * sphere, so that a ray can be tested against several spheres at once
+ * @brief The SphereArrays struct
+ */
+struct SphereArrays
+{
+    const float *x, *y, *z, *radius;
+    size_t count;
+};
+
+/**
+ * @brief hitSphereArrays Finds the closest sphere hit by a ray. The
+ * spheres are tested eight at a time on cpus with AVX2 and sixteen at a
+ * time with AVX-512, and the hit found is the same as testing them one
+ * at a time with hitSphere.
+ * @param spheres The spheres to test
+ * @param r The ray
+ * @param minT The nearest distance along the ray to accept a hit
+ * @param maxT The furthest distance along the ray to accept a hit
+ * @param t Receives the distance to the closest hit
+ * @param index Receives the index of the closest sphere hit
+ * @return Whether any sphere was hit
+ */
+bool hitSphereArrays(const SphereArrays &spheres, const Ray &r, float minT, float maxT, float &t, size_t &index);
+
+/**
+ * @brief fillSphereHit Fills a HitRecord for a hit found by hitSphereArrays
+ */
+void fillSphereHit(const SphereArrays &spheres, size_t index, const Ray &r, float t, HitRecord &rec);
+
+/**
+ * A large number of spheres stored as a single Surface, for particle and
+ * molecule scenes. Each sphere takes 18 bytes: its centre and radius,
+ * and the index of its material in a table kept by the cloud. A
+ * RenderScene tests the spheres where the cloud keeps them, so rendering
+ * takes no more memory per sphere.
+ * @brief The SphereCloud class
+ */
+class SphereCloud : public Surface
+{
+    public:
+        SphereCloud();
+
+        /**
+         * @brief addSphere Adds a sphere to the cloud
+         * @return False if the cloud already uses the most different
+         * materials it can refer to, 65536, and material is a new one
+         */
+        bool addSphere(Vector3 centre, float radius, Material *material);
+        void reserve(size_t count);
+        size_t getSphereCount() const;
+
+        virtual bool hitWithRay(const Ray r, const float minT, const float maxT, HitRecord &rec) const;
+        virtual void flatten(SceneCompiler &compiler) const;
+
+    private:
+        std::vector<float> x, y, z, radius;
+        std::vector<uint16_t> materialIndices;
+        std::vector<Material *> materials;
+        std::unordered_map<Material *, uint16_t> materialLookup;
+
+        SphereArrays getArrays() const;
+};
+
+#endif // SPHERECLOUD_HPP
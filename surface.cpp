@@ -3,25 +3,28 @@
 #include <iostream>
 #include <float.h>
 #include "surfaceinstance.hpp"
+#include "scene.hpp"
+#include "compiledscene.hpp"
+#include "renderstats.hpp"
 
-Surface * Surface::rotateAroundX(float degrees)
+Surface * Surface::rotateAroundX(Scene &scene, float degrees)
 {
-    return new XRotatedSurface(this, degrees);
+    return scene.create<XRotatedSurface>(this, degrees);
 }
 
-Surface * Surface::rotateAroundY(float degrees)
+Surface * Surface::rotateAroundY(Scene &scene, float degrees)
 {
-    return new YRotatedSurface(this, degrees);
+    return scene.create<YRotatedSurface>(this, degrees);
 }
 
-Surface * Surface::rotateAroundZ(float degrees)
+Surface * Surface::rotateAroundZ(Scene &scene, float degrees)
 {
-    return new ZRotatedSurface(this, degrees);
+    return scene.create<ZRotatedSurface>(this, degrees);
 }
 
-Surface * Surface::translate(Vector3 offset)
+Surface * Surface::translate(Scene &scene, Vector3 offset)
 {
-    return new TranslatedSurface(this, offset);
+    return scene.create<TranslatedSurface>(this, offset);
 }
 
 Plane::Plane(Vector3 point, Vector3 normal, Material *material)
@@ -31,8 +34,11 @@ Plane::Plane(Vector3 point, Vector3 normal, Material *material)
     this->material = material;
 }
 
-bool Plane::hitWithRay(const Ray r, const float minT, const float maxT, HitRecord &rec) const
+bool hitPlane(const Vector3 &point, const Vector3 &normal, Material *material,
+              const Ray &r, float minT, float maxT, HitRecord &rec)
 {
+    COUNT_STAT(planeTests);
+
     //Ray is parallel with plane, so it will never intersect it
     if (r.getDirection().dot(normal) == 0)
     {
@@ -56,6 +62,16 @@ bool Plane::hitWithRay(const Ray r, const float minT, const float maxT, HitRecor
     return false;
 }
 
+bool Plane::hitWithRay(const Ray r, const float minT, const float maxT, HitRecord &rec) const
+{
+    return hitPlane(point, normal, material, r, minT, maxT, rec);
+}
+
+void Plane::flatten(SceneCompiler &compiler) const
+{
+    compiler.addPlane(point, normal, material);
+}
+
 Rectangle::Rectangle()
 {
 }
@@ -102,8 +118,10 @@ Rectangle::Rectangle(Vector3 centre, Vector3 normal, float length, float width,
     d = centre - u*width + v*length;
 }
 
-bool Rectangle::hitWithRay(const Ray r, const float minT, const float maxT, HitRecord &rec) const
+bool hitRectangle(const Vector3 &centre, const Vector3 &normal, const Vector3 &a, const Vector3 &b, const Vector3 &d,
+                  Material *material, const Ray &r, float minT, float maxT, HitRecord &rec)
 {
+    COUNT_STAT(rectangleTests);
 
     //Ray is parallel with Rectangle plane, so it will never intersect it
     if (r.getDirection().dot(normal) == 0)
@@ -146,6 +164,16 @@ bool Rectangle::hitWithRay(const Ray r, const float minT, const float maxT, HitR
     return false;
 }
 
+bool Rectangle::hitWithRay(const Ray r, const float minT, const float maxT, HitRecord &rec) const
+{
+    return hitRectangle(centre, normal, a, b, d, material, r, minT, maxT, rec);
+}
+
+void Rectangle::flatten(SceneCompiler &compiler) const
+{
+    compiler.addRectangle(centre, normal, a, b, d, material);
+}
+
 Triangle::Triangle()
 {
 }
@@ -158,10 +186,12 @@ Triangle::Triangle(Vector3 a, Vector3 b, Vector3 c, Material *material)
     this->material = material;
 }
 
-bool Triangle::hitWithRay(const Ray r, const float minT, const float maxT, HitRecord &rec) const
+bool hitTriangle(const Vector3 &a, const Vector3 &b, const Vector3 &c, Material *material,
+                 const Ray &r, float minT, float maxT, HitRecord &rec)
 {
-    
-    Vector3 normal = (this->b - this->a).cross(this->b - this->c);
+    COUNT_STAT(triangleTests);
+
+    Vector3 normal = (b - a).cross(b - c);
 
     //Ray is parallel with triangle plane, so it will never intersect it
     if (r.getDirection().dot(normal) == 0)
@@ -171,7 +201,7 @@ bool Triangle::hitWithRay(const Ray r, const float minT, const float maxT, HitRe
     
     //Otherwise Ray intersects plane of the triangle
 
-    float temp = ((this->b - r.getOrigin()).dot(normal)) /
+    float temp = ((b - r.getOrigin()).dot(normal)) /
             (r.getDirection().dot(normal));
 
     if (temp > minT && temp < maxT)
@@ -183,12 +213,12 @@ bool Triangle::hitWithRay(const Ray r, const float minT, const float maxT, HitRe
         //Point where ray intersects the plane
         Vector3 p = r.getPointAtParameter(temp);
         
-        float a = (this->b - this->a).cross(p - this->a).dot(normal);
-        float b = (this->c - this->b).cross(p - this->b).dot(normal);
-        float c = (this->a - this->c).cross(p - this->c).dot(normal);
+        float abSide = (b - a).cross(p - a).dot(normal);
+        float bcSide = (c - b).cross(p - b).dot(normal);
+        float caSide = (a - c).cross(p - c).dot(normal);
         
 
-        if (!((a < 0) == (b < 0) == (c < 0)))
+        if (!((abSide < 0) == (bcSide < 0) == (caSide < 0)))
         {
             return false;
         }
@@ -203,6 +233,16 @@ bool Triangle::hitWithRay(const Ray r, const float minT, const float maxT, HitRe
     return false;
 }
 
+bool Triangle::hitWithRay(const Ray r, const float minT, const float maxT, HitRecord &rec) const
+{
+    return hitTriangle(a, b, c, material, r, minT, maxT, rec);
+}
+
+void Triangle::flatten(SceneCompiler &compiler) const
+{
+    compiler.addTriangle(a, b, c, material);
+}
+
 Sphere::Sphere()
 {
 }
@@ -224,8 +264,10 @@ float Sphere::getRadius() const
     return radius;
 }
 
-bool Sphere::hitWithRay(const Ray r, const float minT, const float maxT, HitRecord &rec) const
+bool hitSphere(const Vector3 &centre, float radius, Material *material,
+               const Ray &r, float minT, float maxT, HitRecord &rec)
 {
+    COUNT_STAT(sphereTests);
 
     Vector3 oc = r.getOrigin() - centre;
     float a = r.getDirection().dot(r.getDirection());
@@ -262,3 +304,12 @@ bool Sphere::hitWithRay(const Ray r, const float minT, const float maxT, HitReco
     return false;
 }
 
+bool Sphere::hitWithRay(const Ray r, const float minT, const float maxT, HitRecord &rec) const
+{
+    return hitSphere(centre, radius, material, r, minT, maxT, rec);
+}
+
+void Sphere::flatten(SceneCompiler &compiler) const
+{
+    compiler.addSphere(centre, radius, material);
+}
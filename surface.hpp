@@ -3,8 +3,11 @@
 
 #include "ray.hpp"
 #include "float.h"
+#include <stdint.h>
 
 class Material;
+class Scene;
+class SceneCompiler;
 
 struct HitRecord
 {
@@ -13,17 +16,30 @@ struct HitRecord
         Vector3 hitLocation;
         Vector3 normal;
         Material *material;
+
+        //The index of the material in the material table of a flattened
+        //scene. Only set by hits against flat primitives.
+        uint32_t materialIndex;
 };
 
 class Surface
 {
     public:
+        virtual ~Surface() {}
+
         virtual bool hitWithRay(const Ray r, const float minT, const float maxT, HitRecord &rec) const = 0;
 
-        Surface * rotateAroundX(float degrees);
-        Surface * rotateAroundY(float degrees);
-        Surface * rotateAroundZ(float degrees);
-        Surface * translate(Vector3 offset);
+        /**
+         * @brief flatten Adds the primitives of this Surface to a compiled
+         * scene, with any transforms baked into their coordinates
+         */
+        virtual void flatten(SceneCompiler &compiler) const = 0;
+
+        //Wrap this Surface in a transformed instance owned by the scene
+        Surface * rotateAroundX(Scene &scene, float degrees);
+        Surface * rotateAroundY(Scene &scene, float degrees);
+        Surface * rotateAroundZ(Scene &scene, float degrees);
+        Surface * translate(Scene &scene, Vector3 offset);
 };
 
 class Plane : public Surface
@@ -32,6 +48,7 @@ class Plane : public Surface
         Plane(Vector3 point, Vector3 normal, Material *material);
 
         virtual bool hitWithRay(const Ray r, const float minT, const float maxT, HitRecord &rec) const;
+        virtual void flatten(SceneCompiler &compiler) const;
 
     private:
         Vector3 point;
@@ -46,6 +63,7 @@ class Sphere : public Surface
         Sphere(Vector3 centre, float radius, Material *material);
 
         virtual bool hitWithRay(const Ray r, const float minT, const float maxT, HitRecord &rec) const;
+        virtual void flatten(SceneCompiler &compiler) const;
         Vector3 getCentre() const;
         float getRadius() const;
 
@@ -62,6 +80,7 @@ class Rectangle : public Surface
         Rectangle(Vector3 centre, Vector3 normal, float length, float width, Material *material);
 
         virtual bool hitWithRay(const Ray r, const float minT, const float maxT, HitRecord &rec) const;
+        virtual void flatten(SceneCompiler &compiler) const;
 
     private:
         Material *material;
@@ -77,6 +96,7 @@ class Triangle : public Surface
         Triangle(Vector3 a, Vector3 b, Vector3 c, Material *material);
         
         virtual bool hitWithRay(const Ray r, const float minT, const float maxT, HitRecord &rec) const;
+        virtual void flatten(SceneCompiler &compiler) const;
         
     private:
         Material *material;
@@ -84,4 +104,15 @@ class Triangle : public Surface
         
 };
 
+//Ray intersection for each primitive, shared by the Surface classes and
+//the flat primitive arrays of a compiled scene
+bool hitPlane(const Vector3 &point, const Vector3 &normal, Material *material,
+              const Ray &r, float minT, float maxT, HitRecord &rec);
+bool hitSphere(const Vector3 &centre, float radius, Material *material,
+               const Ray &r, float minT, float maxT, HitRecord &rec);
+bool hitRectangle(const Vector3 &centre, const Vector3 &normal, const Vector3 &a, const Vector3 &b, const Vector3 &d,
+                  Material *material, const Ray &r, float minT, float maxT, HitRecord &rec);
+bool hitTriangle(const Vector3 &a, const Vector3 &b, const Vector3 &c, Material *material,
+                 const Ray &r, float minT, float maxT, HitRecord &rec);
+
 #endif // SURFACE_HPP
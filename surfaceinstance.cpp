@@ -1,4 +1,6 @@
 #include "surfaceinstance.hpp"
+#include "compiledscene.hpp"
+#include "renderstats.hpp"
 #include "math.h"
 
 Vector3 rotateAboutX(Vector3 v, float theta)
@@ -36,6 +38,8 @@ XRotatedSurface::XRotatedSurface(Surface *surface, float degrees)
 
 bool XRotatedSurface::hitWithRay(const Ray r, const float minT, const float maxT, HitRecord &rec) const
 {
+    COUNT_STAT(instanceTests);
+
     Vector3 origin = rotateAboutX(r.getOrigin(), theta);
     Vector3 direction = rotateAboutX(r.getDirection(), theta);
     Ray rotatedRay = Ray(origin, direction);
@@ -51,6 +55,14 @@ bool XRotatedSurface::hitWithRay(const Ray r, const float minT, const float maxT
     return false;
 }
 
+void XRotatedSurface::flatten(SceneCompiler &compiler) const
+{
+    //A hit on the rotated surface is rotated back by -theta
+    compiler.pushRotation(SceneCompiler::X_AXIS, -theta);
+    surface->flatten(compiler);
+    compiler.popTransform();
+}
+
 YRotatedSurface::YRotatedSurface(Surface *surface, float degrees)
 {
     this->surface = surface;
@@ -59,6 +71,8 @@ YRotatedSurface::YRotatedSurface(Surface *surface, float degrees)
 
 bool YRotatedSurface::hitWithRay(const Ray r, const float minT, const float maxT, HitRecord &rec) const
 {
+    COUNT_STAT(instanceTests);
+
     Vector3 origin = rotateAboutY(r.getOrigin(), theta);
     Vector3 direction = rotateAboutY(r.getDirection(), theta);
     Ray rotatedRay = Ray(origin, direction);
@@ -74,6 +88,14 @@ bool YRotatedSurface::hitWithRay(const Ray r, const float minT, const float maxT
     return false;
 }
 
+void YRotatedSurface::flatten(SceneCompiler &compiler) const
+{
+    //A hit on the rotated surface is rotated back by -theta
+    compiler.pushRotation(SceneCompiler::Y_AXIS, -theta);
+    surface->flatten(compiler);
+    compiler.popTransform();
+}
+
 ZRotatedSurface::ZRotatedSurface(Surface *surface, float degrees)
 {
     this->surface = surface;
@@ -82,6 +104,8 @@ ZRotatedSurface::ZRotatedSurface(Surface *surface, float degrees)
 
 bool ZRotatedSurface::hitWithRay(const Ray r, const float minT, const float maxT, HitRecord &rec) const
 {
+    COUNT_STAT(instanceTests);
+
     Vector3 origin = rotateAboutZ(r.getOrigin(), theta);
     Vector3 direction = rotateAboutZ(r.getDirection(), theta);
     Ray rotatedRay = Ray(origin, direction);
@@ -97,6 +121,14 @@ bool ZRotatedSurface::hitWithRay(const Ray r, const float minT, const float maxT
     return false;
 }
 
+void ZRotatedSurface::flatten(SceneCompiler &compiler) const
+{
+    //A hit on the rotated surface is rotated back by -theta
+    compiler.pushRotation(SceneCompiler::Z_AXIS, -theta);
+    surface->flatten(compiler);
+    compiler.popTransform();
+}
+
 TranslatedSurface::TranslatedSurface(Surface *surface, Vector3 offset)
 {
     this->surface = surface;
@@ -105,6 +137,8 @@ TranslatedSurface::TranslatedSurface(Surface *surface, Vector3 offset)
 
 bool TranslatedSurface::hitWithRay(const Ray r, const float minT, const float maxT, HitRecord &rec) const
 {
+    COUNT_STAT(instanceTests);
+
     Ray translatedRay = Ray(r.getOrigin()-offset, r.getDirection());
 
     if (surface->hitWithRay(translatedRay, minT, maxT, rec)) {
@@ -113,3 +147,10 @@ bool TranslatedSurface::hitWithRay(const Ray r, const float minT, const float ma
     }
     return false;
 }
+
+void TranslatedSurface::flatten(SceneCompiler &compiler) const
+{
+    compiler.pushTranslation(offset);
+    surface->flatten(compiler);
+    compiler.popTransform();
+}
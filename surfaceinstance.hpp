@@ -3,12 +3,17 @@
 
 #include "surface.hpp"
 
+Vector3 rotateAboutX(Vector3 v, float theta);
+Vector3 rotateAboutY(Vector3 v, float theta);
+Vector3 rotateAboutZ(Vector3 v, float theta);
+
 class XRotatedSurface : public Surface
 {
     public:
         XRotatedSurface(Surface *surface, float degrees);
 
         virtual bool hitWithRay(const Ray r, const float minT, const float maxT, HitRecord &rec) const;
+        virtual void flatten(SceneCompiler &compiler) const;
 
     private:
         Surface *surface;
@@ -22,6 +27,7 @@ class YRotatedSurface : public Surface
         YRotatedSurface(Surface *surface, float degrees);
 
         virtual bool hitWithRay(const Ray r, const float minT, const float maxT, HitRecord &rec) const;
+        virtual void flatten(SceneCompiler &compiler) const;
 
     private:
         Surface *surface;
@@ -35,6 +41,7 @@ class ZRotatedSurface : public Surface
         ZRotatedSurface(Surface *surface, float degrees);
 
         virtual bool hitWithRay(const Ray r, const float minT, const float maxT, HitRecord &rec) const;
+        virtual void flatten(SceneCompiler &compiler) const;
 
     private:
         Surface *surface;
@@ -48,6 +55,7 @@ class TranslatedSurface : public Surface
         TranslatedSurface(Surface *surface, Vector3 offset);
 
         virtual bool hitWithRay(const Ray r, const float minT, const float maxT, HitRecord &rec) const;
+        virtual void flatten(SceneCompiler &compiler) const;
 
     private:
         Surface *surface;
@@ -0,0 +1,140 @@
+#include "tonemap.hpp"
+#include "cpudispatch.hpp"
+#include <math.h>
+#include <algorithm>
+
+static_assert(sizeof(Vector3) == 3*sizeof(float), "Vector3 must be three packed floats");
+
+ToneMapOptions::ToneMapOptions()
+{
+    exposure = 1;
+    gamma = 2;
+}
+
+//Colours must be converted from range [0, 1] to [0, 255].
+//Using slightly less than 256 eliminates the problem where
+//we have 256*1.0=256, which is outside the valid range.
+static inline unsigned char toByte(float value)
+{
+    value = value < 1 ? value : 1;
+    return (unsigned char) (value * 255.99f);
+}
+
+//Negative radiance and NaNs become black. This is written as a compare
+//rather than fmaxf, which the compiler will not vectorise.
+static inline float clampNegative(float value)
+{
+    return value > 0 ? value : 0;
+}
+
+//The pixels converted by each call of a kernel, which is enough for the
+//cost of the call to be small but leaves work for every thread
+static const int TONEMAP_BLOCK = 4096;
+
+/**
+ * @brief tonemapPixels Converts pixels [begin, end). This is inlined into
+ * a kernel for each instruction set level. The loops work on flat float
+ * arrays so the compiler can vectorise them for the level.
+ */
+static ALWAYS_INLINE void tonemapPixels(const float *in, unsigned char *bytes, int begin, int end,
+                                        float exposure, float gamma)
+{
+    //The default gamma of 2 is a square root, which vectorises far
+    //better than the general power function
+    if (gamma == 2)
+    {
+#pragma omp simd
+        for (int k = begin; k < end; ++k)
+        {
+            bytes[4*k] = toByte(sqrtf(clampNegative(in[3*k] * exposure)));
+            bytes[4*k + 1] = toByte(sqrtf(clampNegative(in[3*k + 1] * exposure)));
+            bytes[4*k + 2] = toByte(sqrtf(clampNegative(in[3*k + 2] * exposure)));
+            bytes[4*k + 3] = 255;
+        }
+    }
+    else
+    {
+        const float inverseGamma = 1 / gamma;
+#pragma omp simd
+        for (int k = begin; k < end; ++k)
+        {
+            bytes[4*k] = toByte(powf(clampNegative(in[3*k] * exposure), inverseGamma));
+            bytes[4*k + 1] = toByte(powf(clampNegative(in[3*k + 1] * exposure), inverseGamma));
+            bytes[4*k + 2] = toByte(powf(clampNegative(in[3*k + 2] * exposure), inverseGamma));
+            bytes[4*k + 3] = 255;
+        }
+    }
+}
+
+typedef void (*TonemapPixelsFunction)(const float *in, unsigned char *bytes, int begin, int end,
+                                      float exposure, float gamma);
+
+static void tonemapPixelsBaseline(const float *in, unsigned char *bytes, int begin, int end, float exposure, float gamma)
+{
+    tonemapPixels(in, bytes, begin, end, exposure, gamma);
+}
+
+#ifdef RAYTRACER_CPU_DISPATCH
+TARGET_SSE42 static void tonemapPixelsSse42(const float *in, unsigned char *bytes, int begin, int end, float exposure, float gamma)
+{
+    tonemapPixels(in, bytes, begin, end, exposure, gamma);
+}
+
+TARGET_AVX2 static void tonemapPixelsAvx2(const float *in, unsigned char *bytes, int begin, int end, float exposure, float gamma)
+{
+    tonemapPixels(in, bytes, begin, end, exposure, gamma);
+}
+
+TARGET_AVX512 static void tonemapPixelsAvx512(const float *in, unsigned char *bytes, int begin, int end, float exposure, float gamma)
+{
+    tonemapPixels(in, bytes, begin, end, exposure, gamma);
+}
+#endif
+
+static TonemapPixelsFunction selectTonemapPixels()
+{
+#ifdef RAYTRACER_CPU_DISPATCH
+    switch (getCpuLevel())
+    {
+        case CPU_LEVEL_AVX512:
+            return tonemapPixelsAvx512;
+        case CPU_LEVEL_AVX2:
+            return tonemapPixelsAvx2;
+        case CPU_LEVEL_SSE42:
+            return tonemapPixelsSse42;
+        default:
+            break;
+    }
+#endif
+    return tonemapPixelsBaseline;
+}
+
+/**
+ * @brief tonemap Converts linear radiance to 8-bit display colours.
+ * This runs as a pass over the finished framebuffer, so changing the
+ * exposure or gamma of an image does not require rendering it again.
+ * Blocks of pixels are converted in parallel by the kernel for the best
+ * instruction set the cpu supports.
+ * @param radiance The linear radiance of each pixel
+ * @param count The number of pixels
+ * @param options The exposure and gamma to apply
+ * @param out Receives the display colour of each pixel
+ */
+void tonemap(const Vector3 *radiance, size_t count, const ToneMapOptions &options, RGBAVector *out)
+{
+    static const TonemapPixelsFunction tonemapBlock = selectTonemapPixels();
+
+    const float *in = &radiance[0].x;
+    unsigned char *bytes = &out[0].r;
+    const long long blocks = (count + TONEMAP_BLOCK - 1) / TONEMAP_BLOCK;
+
+    //Each kernel is given pointers to its own block, so the indices it
+    //works with stay small however many pixels the image has
+#pragma omp parallel for schedule(static)
+    for (long long block = 0; block < blocks; ++block)
+    {
+        size_t begin = (size_t) block * TONEMAP_BLOCK;
+        int pixels = (int) std::min(count - begin, (size_t) TONEMAP_BLOCK);
+        tonemapBlock(in + 3*begin, bytes + 4*begin, 0, pixels, options.exposure, options.gamma);
+    }
+}
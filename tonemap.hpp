@@ -0,0 +1,20 @@
+#ifndef TONEMAP_HPP
+#define TONEMAP_HPP
+
+#include "vector3.hpp"
+#include "rgbvector.hpp"
+#include <stddef.h>
+
+class ToneMapOptions
+{
+    public:
+        //Radiance is multiplied by this before the gamma curve is applied
+        float exposure;
+        float gamma;
+
+        ToneMapOptions();
+};
+
+void tonemap(const Vector3 *radiance, size_t count, const ToneMapOptions &options, RGBAVector *out);
+
+#endif // TONEMAP_HPP
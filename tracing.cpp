@@ -0,0 +1,171 @@
+#include "tracing.hpp"
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <vector>
+
+struct TraceEvent
+{
+    const char *name;
+    const char *argumentName;
+    long long argument;
+    long long start, end;
+};
+
+struct TraceBuffer
+{
+    int thread;
+    std::string threadName;
+    std::vector<TraceEvent> events;
+};
+
+static std::atomic<bool> tracing(false);
+static std::chrono::steady_clock::time_point traceStart;
+
+//Every buffer ever created, so that the spans of threads which have
+//already exited are still written. The mutex is only taken when a
+//thread records its first span and when the trace is written.
+static std::mutex buffersMutex;
+static std::vector<TraceBuffer *> buffers;
+static thread_local TraceBuffer *threadBuffer = NULL;
+
+static TraceBuffer * getThreadBuffer()
+{
+    if (!threadBuffer)
+    {
+        threadBuffer = new TraceBuffer();
+        threadBuffer->events.reserve(4096);
+
+        std::lock_guard<std::mutex> lock(buffersMutex);
+        threadBuffer->thread = (int) buffers.size();
+        buffers.push_back(threadBuffer);
+    }
+    return threadBuffer;
+}
+
+//Nanoseconds since tracing was started
+static long long getTraceTime()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - traceStart).count();
+}
+
+/**
+ * @brief startTracing Starts recording spans. This must be called before
+ * any other thread records a span.
+ */
+void startTracing()
+{
+    traceStart = std::chrono::steady_clock::now();
+    tracing = true;
+}
+
+bool isTracing()
+{
+    return tracing.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief setTraceThreadName Names the timeline of the calling thread.
+ * A thread that has already been named keeps its first name, so each
+ * render thread can name itself every time it starts work.
+ */
+void setTraceThreadName(const std::string &name)
+{
+    if (!isTracing())
+    {
+        return;
+    }
+
+    TraceBuffer *buffer = getThreadBuffer();
+    if (buffer->threadName.empty())
+    {
+        buffer->threadName = name;
+    }
+}
+
+static void writeEventTime(std::ostream &out, long long nanoseconds)
+{
+    //Trace times are in microseconds
+    out << nanoseconds / 1000 << "." << (char) ('0' + nanoseconds / 100 % 10)
+        << (char) ('0' + nanoseconds / 10 % 10) << (char) ('0' + nanoseconds % 10);
+}
+
+/**
+ * @brief writeTrace Writes every span recorded so far as a Chrome trace
+ * (the JSON format read by chrome://tracing and Perfetto). No spans may
+ * be recorded while the trace is being written.
+ * @param filename The file to write
+ * @return Whether the file was written
+ */
+bool writeTrace(const std::string &filename)
+{
+    std::ofstream out(filename.c_str());
+    std::lock_guard<std::mutex> lock(buffersMutex);
+
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    bool first = true;
+    for (TraceBuffer *buffer : buffers)
+    {
+        if (!buffer->threadName.empty())
+        {
+            out << (first ? "" : ",\n")
+                << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << buffer->thread
+                << ", \"args\": {\"name\": \"" << buffer->threadName << "\"}}";
+            first = false;
+        }
+
+        for (const TraceEvent &event : buffer->events)
+        {
+            out << (first ? "" : ",\n")
+                << "{\"name\": \"" << event.name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << buffer->thread
+                << ", \"ts\": ";
+            writeEventTime(out, event.start);
+            out << ", \"dur\": ";
+            writeEventTime(out, event.end - event.start);
+            if (event.argumentName)
+            {
+                out << ", \"args\": {\"" << event.argumentName << "\": " << event.argument << "}";
+            }
+            out << "}";
+            first = false;
+        }
+    }
+    out << "\n]}\n";
+    return (bool) out;
+}
+
+TraceSpan::TraceSpan(const char *name)
+    : TraceSpan(name, NULL, 0)
+{
+}
+
+/**
+ * @brief TraceSpan Starts a span with a single numeric argument, such
+ * as the row or frame being worked on
+ * @param name The name of the span, which must outlive the trace
+ * @param argumentName The name of the argument, which must outlive the trace
+ * @param argument The value of the argument
+ */
+TraceSpan::TraceSpan(const char *name, const char *argumentName, long long argument)
+{
+    this->name = name;
+    this->argumentName = argumentName;
+    this->argument = argument;
+    active = isTracing();
+    start = active ? getTraceTime() : 0;
+}
+
+TraceSpan::~TraceSpan()
+{
+    if (active)
+    {
+        TraceEvent event;
+        event.name = name;
+        event.argumentName = argumentName;
+        event.argument = argument;
+        event.start = start;
+        event.end = getTraceTime();
+        getThreadBuffer()->events.push_back(event);
+    }
+}
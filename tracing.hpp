@@ -0,0 +1,36 @@
+#ifndef TRACING_HPP
+#define TRACING_HPP
+
+#include <string>
+
+void startTracing();
+bool isTracing();
+void setTraceThreadName(const std::string &name);
+bool writeTrace(const std::string &filename);
+
+/**
+ * Records the time between its construction and destruction as a span
+ * on the timeline of the calling thread, if tracing has been started.
+ * Each thread appends to its own buffer, so spans can be recorded from
+ * render threads without locking.
+ * @brief The TraceSpan class
+ */
+class TraceSpan
+{
+    public:
+        TraceSpan(const char *name);
+        TraceSpan(const char *name, const char *argumentName, long long argument);
+        ~TraceSpan();
+
+    private:
+        const char *name;
+        const char *argumentName;
+        long long argument;
+        long long start;
+        bool active;
+
+        TraceSpan(const TraceSpan &) = delete;
+        TraceSpan & operator=(const TraceSpan &) = delete;
+};
+
+#endif // TRACING_HPP